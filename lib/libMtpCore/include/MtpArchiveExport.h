@@ -0,0 +1,149 @@
+#ifndef MTP_ARCHIVE_EXPORT_H
+#define MTP_ARCHIVE_EXPORT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+// Предварительное объявление классов
+class MtpFile;
+class MtpDirectory;
+class MtpTransfer;
+
+/**
+ * @brief Формат архива
+ */
+enum class MtpArchiveFormat {
+    Tar,    ///< POSIX tar (ustar, длинные имена и большие файлы - через PAX-заголовки)
+    Zip     ///< ZIP без сжатия (ZIP64 для больших архивов)
+};
+
+/**
+ * @brief Выгрузка директории устройства прямо в архив
+ *
+ * Содержимое файлов читается с устройства потоком и сразу пишется
+ * в архив, без промежуточной копии на диске. Заголовки записей
+ * строятся по метаданным MtpFile, поэтому архив пишется одним
+ * последовательным проходом.
+ */
+class MtpArchiveExport {
+public:
+    /**
+     * @brief Тип функции, принимающей байты архива
+     *
+     * Позволяет направить архив в сокет, канал или внешний компрессор.
+     * Возврат false прерывает выгрузку.
+     */
+    using OutputWriter = std::function<bool(const char* data, size_t length)>;
+
+    /**
+     * @brief Конструктор
+     * @param format Формат архива
+     */
+    explicit MtpArchiveExport(MtpArchiveFormat format = MtpArchiveFormat::Tar);
+
+    /**
+     * @brief Выгружает директорию в файл архива
+     * @param directory Директория на устройстве
+     * @param archivePath Путь к создаваемому архиву
+     * @param transfer Дескриптор для отслеживания и отмены выгрузки (может быть nullptr)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool exportToFile(const std::shared_ptr<MtpDirectory>& directory, const std::string& archivePath,
+                      std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Выгружает директорию в произвольный поток
+     * @param directory Директория на устройстве
+     * @param writer Функция, принимающая байты архива
+     * @param transfer Дескриптор для отслеживания и отмены выгрузки (может быть nullptr)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool exportToWriter(const std::shared_ptr<MtpDirectory>& directory, const OutputWriter& writer,
+                        std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Запись архива
+     */
+    struct Entry {
+        std::string path;                   ///< Путь внутри архива
+        std::shared_ptr<MtpFile> file;      ///< Объект на устройстве
+        uint64_t size;                      ///< Размер (0 для директорий)
+        time_t modificationDate;            ///< Время изменения
+        bool isDirectory;                   ///< Признак директории
+    };
+
+    /**
+     * @brief Сведения о записи ZIP для центрального каталога
+     */
+    struct ZipRecord {
+        std::string path;                   ///< Путь внутри архива
+        uint32_t crc;                       ///< CRC-32 данных
+        uint64_t size;                      ///< Размер данных
+        uint64_t offset;                    ///< Смещение локального заголовка
+        time_t modificationDate;            ///< Время изменения
+        bool isDirectory;                   ///< Признак директории
+    };
+
+    /**
+     * @brief Собирает список записей архива
+     * @param directory Директория на устройстве
+     * @param prefix Путь директории внутри архива
+     * @param entries Список записей
+     */
+    void collectEntries(const std::shared_ptr<MtpDirectory>& directory, const std::string& prefix,
+                        std::vector<Entry>& entries);
+
+    /**
+     * @brief Пишет одну запись tar
+     * @return true в случае успеха
+     */
+    bool writeTarEntry(const Entry& entry, const OutputWriter& writer, uint64_t& done, MtpTransfer* transfer);
+
+    /**
+     * @brief Пишет заголовок tar (при необходимости с PAX-заголовком)
+     * @return true в случае успеха
+     */
+    bool writeTarHeader(const Entry& entry, const OutputWriter& writer);
+
+    /**
+     * @brief Пишет одну запись ZIP
+     * @return true в случае успеха
+     */
+    bool writeZipEntry(const Entry& entry, const OutputWriter& writer, uint64_t& offset,
+                       uint64_t& done, MtpTransfer* transfer, std::vector<ZipRecord>& records);
+
+    /**
+     * @brief Пишет центральный каталог ZIP
+     * @return true в случае успеха
+     */
+    bool writeZipDirectory(const std::vector<ZipRecord>& records, const OutputWriter& writer, uint64_t offset);
+
+    /**
+     * @brief Передает содержимое файла в архив
+     * @param entry Запись архива
+     * @param writer Функция, принимающая байты архива
+     * @param done Общий объем уже записанных данных файлов
+     * @param transfer Дескриптор передачи (может быть nullptr)
+     * @param crc Если не nullptr, сюда накапливается CRC-32 данных
+     * @return true в случае успеха
+     */
+    bool streamContent(const Entry& entry, const OutputWriter& writer, uint64_t& done,
+                       MtpTransfer* transfer, uint32_t* crc);
+
+private:
+    MtpArchiveFormat m_format;  ///< Формат архива
+    std::string m_lastError;    ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_ARCHIVE_EXPORT_H
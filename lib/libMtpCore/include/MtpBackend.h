@@ -0,0 +1,87 @@
+#ifndef MTP_BACKEND_H
+#define MTP_BACKEND_H
+
+#include <memory>
+#include <libmtp.h>
+
+/**
+ * @brief Точка входа для всех обращений к устройству
+ *
+ * Классы библиотеки вызывают libmtp только через текущий бэкенд.
+ * Базовая реализация передает вызовы в libmtp без изменений;
+ * наследники (запись и воспроизведение сессий) подменяют отдельные
+ * методы и передают остальные следующему бэкенду в цепочке.
+ *
+ * Методы повторяют сигнатуры и соглашения libmtp: возвращаемые
+ * списки и строки освобождаются вызывающим теми же функциями
+ * LIBMTP_destroy_* и free().
+ */
+class MtpBackend {
+public:
+    /**
+     * @brief Деструктор
+     */
+    virtual ~MtpBackend();
+
+    /**
+     * @brief Получает текущий бэкенд
+     *
+     * Вызов не берет блокировок и не трогает счетчики ссылок.
+     * @return Ссылка на бэкенд
+     */
+    static MtpBackend& instance();
+
+    /**
+     * @brief Устанавливает текущий бэкенд
+     *
+     * Устанавливать бэкенд следует до открытия устройств: уже
+     * выполняющиеся команды могут завершиться на прежнем бэкенде.
+     * Установленные бэкенды живут до завершения процесса.
+     * @param backend Бэкенд (nullptr - вернуть прямые вызовы libmtp)
+     */
+    static void install(std::shared_ptr<MtpBackend> backend);
+
+    /**
+     * @brief Вызывается при открытии устройства, до первых команд
+     * @param device Указатель на устройство libmtp
+     * @param rawDevice Структура сырого устройства libmtp
+     */
+    virtual void deviceOpened(LIBMTP_mtpdevice_t* device, const LIBMTP_raw_device_t& rawDevice);
+
+    /**
+     * @name Обертки над одноименными функциями libmtp
+     */
+    ///@{
+    virtual void releaseDevice(LIBMTP_mtpdevice_t* device);
+    virtual char* getFriendlyname(LIBMTP_mtpdevice_t* device);
+    virtual char* getManufacturername(LIBMTP_mtpdevice_t* device);
+    virtual char* getModelname(LIBMTP_mtpdevice_t* device);
+    virtual char* getSerialnumber(LIBMTP_mtpdevice_t* device);
+    virtual char* getDeviceversion(LIBMTP_mtpdevice_t* device);
+    virtual int getStorage(LIBMTP_mtpdevice_t* device, int sortBy);
+    virtual int checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability);
+    virtual LIBMTP_error_t* getErrorstack(LIBMTP_mtpdevice_t* device);
+    virtual void clearErrorstack(LIBMTP_mtpdevice_t* device);
+    virtual LIBMTP_file_t* getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id);
+    virtual LIBMTP_file_t* getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId, uint32_t parentId);
+    virtual LIBMTP_file_t* getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                          const void* data);
+    virtual LIBMTP_folder_t* getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId);
+    virtual int getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                                 LIBMTP_progressfunc_t progress, const void* data);
+    virtual int getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset, uint32_t maxBytes,
+                                 unsigned char** data, unsigned int* size);
+    virtual int sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                                 LIBMTP_progressfunc_t progress, const void* data);
+    virtual int sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                                    LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress, const void* data);
+    virtual uint32_t createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId, uint32_t storageId);
+    virtual int deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id);
+    virtual int setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name);
+    virtual int moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId);
+    virtual int copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId);
+    virtual int readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data);
+    ///@}
+};
+
+#endif // MTP_BACKEND_H
@@ -0,0 +1,237 @@
+#ifndef MTP_BATCH_DOWNLOAD_H
+#define MTP_BATCH_DOWNLOAD_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "MtpTransferJournal.h"
+#include "MtpFileWriter.h"
+
+// Предварительное объявление классов
+class MtpDeviceManager;
+class MtpDevice;
+class MtpStorage;
+class MtpFile;
+class MtpTransfer;
+
+/**
+ * @brief Пакетная загрузка файлов с журналом и переподключением
+ *
+ * Состояние каждого файла сохраняется в MtpTransferJournal. Если
+ * устройство пропадает (блокировка экрана, переподключение кабеля),
+ * недокачанный файл сохраняется вместе с записанным смещением, а
+ * загрузка ждет, пока MtpDeviceManager снова не откроет устройство
+ * с тем же серийным номером, и продолжается с того же байта. После
+ * перезапуска программы загрузка продолжается из журнала через load().
+ *
+ * Порядок использования:
+ * @code
+ * MtpBatchDownload batch(manager, "/archive/.import.journal");
+ * if (!batch.load()) {
+ *     for (const auto& file : files) {
+ *         batch.add(file, "/archive/" + file->getName());
+ *     }
+ * }
+ * batch.run(transfer);
+ * @endcode
+ */
+class MtpBatchDownload {
+public:
+    /**
+     * @brief Время ожидания переподключения по умолчанию, с
+     */
+    static const uint32_t DEFAULT_RECONNECT_TIMEOUT = 600;
+
+    /**
+     * @brief Интервал попыток открыть устройство заново при ожидании по умолчанию, с
+     */
+    static const uint32_t DEFAULT_DETECT_INTERVAL = 3;
+
+    /**
+     * @brief Сколько раз подряд элемент может прерваться без продвижения, прежде чем считаться ошибочным
+     */
+    static const int MAX_ATTEMPTS_WITHOUT_PROGRESS = 3;
+
+    /**
+     * @brief Конструктор
+     * @param manager Менеджер устройств, через который устройство открывается заново
+     * @param journalPath Путь к файлу журнала
+     */
+    MtpBatchDownload(MtpDeviceManager& manager, const std::string& journalPath);
+
+    /**
+     * @brief Деструктор
+     */
+    ~MtpBatchDownload();
+
+    MtpBatchDownload(const MtpBatchDownload&) = delete;
+    MtpBatchDownload& operator=(const MtpBatchDownload&) = delete;
+
+    /**
+     * @brief Загружает незавершенную загрузку из журнала
+     * @return true если журнал найден и прочитан
+     */
+    bool load();
+
+    /**
+     * @brief Добавляет файл в загрузку
+     *
+     * Все файлы одной загрузки должны быть с одного устройства.
+     * Журнал сохраняется при запуске run().
+     * @param file Файл на устройстве
+     * @param localPath Путь для сохранения файла
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool add(const std::shared_ptr<MtpFile>& file, const std::string& localPath);
+
+    /**
+     * @brief Загружает все незавершенные файлы
+     *
+     * Блокирует вызывающий поток до завершения, отмены через transfer
+     * или истечения времени ожидания переподключения. Файлы, которые не
+     * удалось загрузить по причинам, не связанным с отключением, помечаются
+     * как ошибочные, и загрузка продолжается со следующего.
+     * @param transfer Дескриптор для отслеживания и отмены загрузки (может быть nullptr)
+     * @return true если все файлы загружены, false в противном случае
+     */
+    bool run(std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Устанавливает время ожидания переподключения
+     * @param seconds Время в секундах (0 - не ждать)
+     */
+    void setReconnectTimeout(uint32_t seconds);
+
+    /**
+     * @brief Устанавливает интервал попыток открыть устройство заново при ожидании
+     *
+     * Попытка открывает только устройства, которых нет в менеджере
+     * (MtpDeviceManager::reconnectDevice); открытые устройства не затрагиваются.
+     * @param seconds Интервал в секундах (0 - только ждать обнаружения, запущенного приложением)
+     */
+    void setDetectInterval(uint32_t seconds);
+
+    /**
+     * @brief Устанавливает параметры записи файлов на диск
+     * @param options Параметры записи
+     */
+    void setWriterOptions(const MtpFileWriterOptions& options);
+
+    /**
+     * @brief Получает элементы загрузки
+     * @return Копия элементов журнала
+     */
+    std::vector<MtpJournalItem> getItems() const;
+
+    /**
+     * @brief Получает количество незавершенных элементов
+     * @return Количество элементов
+     */
+    size_t getPendingCount() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Итог одной попытки загрузить элемент
+     */
+    enum class AttemptResult {
+        Completed,      ///< Файл загружен
+        Interrupted,    ///< Чтение прервалось; вероятно, устройство отключилось
+        Failed,         ///< Ошибка элемента (объект не найден)
+        Cancelled,      ///< Загрузка отменена
+        Fatal           ///< Ошибка записи на диск; продолжать нет смысла
+    };
+
+    /**
+     * @brief Сигнал о том, что менеджер открыл устройство
+     *
+     * Менеджер вызывает подписчиков вне своей блокировки и при отписке
+     * их не ждет, поэтому подписка владеет сигналом, а не загрузчиком:
+     * поздний вызов после уничтожения загрузчика ничего не портит.
+     */
+    struct ReadySignal {
+        std::mutex mutex;                   ///< Мьютекс счетчика
+        std::condition_variable condition;  ///< Условие смены счетчика
+        uint64_t count = 0;                 ///< Количество открытых устройств
+    };
+
+    /**
+     * @brief Получает серийный номер устройства из журнала
+     * @return Серийный номер
+     */
+    std::string getSerialNumber() const;
+
+    /**
+     * @brief Ищет открытое устройство с серийным номером из журнала
+     * @return Устройство или nullptr
+     */
+    std::shared_ptr<MtpDevice> findDevice() const;
+
+    /**
+     * @brief Ждет повторного появления устройства
+     *
+     * Если прервавшееся устройство еще отвечает, возвращает его же.
+     * Иначе убирает его из менеджера и периодически открывает заново
+     * только устройство с серийным номером из журнала.
+     * @param lost Экземпляр устройства, на котором прервалось чтение (может быть nullptr)
+     * @param transfer Дескриптор передачи (для отмены ожидания)
+     * @return Экземпляр устройства или nullptr по истечении времени или отмене
+     */
+    std::shared_ptr<MtpDevice> waitForDevice(std::shared_ptr<MtpDevice> lost,
+                                             const std::shared_ptr<MtpTransfer>& transfer);
+
+    /**
+     * @brief Находит файл элемента на устройстве
+     *
+     * Сначала по ID объекта, затем, если ID сменился, по пути.
+     * @param device Устройство
+     * @param item Элемент
+     * @return Файл или nullptr, если он не найден
+     */
+    std::shared_ptr<MtpFile> resolveFile(const std::shared_ptr<MtpDevice>& device, const MtpJournalItem& item);
+
+    /**
+     * @brief Получает путь к директории от корня хранилища
+     * @param storage Хранилище
+     * @param folderId ID директории
+     * @param path Путь
+     * @return true в случае успеха
+     */
+    bool getFolderPath(const std::shared_ptr<MtpStorage>& storage, uint32_t folderId, std::string& path);
+
+    /**
+     * @brief Выполняет одну попытку загрузить элемент
+     * @param device Устройство
+     * @param item Элемент
+     * @param transfer Дескриптор передачи (может быть nullptr)
+     * @param baseBytes Общий ход без начала элемента, записанного до run();
+     *        к нему прибавляется размер временного файла
+     * @return Итог попытки
+     */
+    AttemptResult download(const std::shared_ptr<MtpDevice>& device, MtpJournalItem& item,
+                           const std::shared_ptr<MtpTransfer>& transfer, uint64_t baseBytes);
+
+private:
+    MtpDeviceManager& m_manager;                        ///< Менеджер устройств
+    MtpTransferJournal m_journal;                       ///< Журнал
+    MtpFileWriterOptions m_writerOptions;               ///< Параметры записи на диск
+    uint32_t m_reconnectTimeout;                        ///< Время ожидания переподключения, с
+    uint32_t m_detectInterval;                          ///< Интервал попыток открыть устройство, с
+    std::map<std::pair<uint32_t, uint32_t>, std::string> m_folderPaths; ///< (хранилище, директория) -> путь
+    int m_readyCallbackId;                              ///< ID подписки на готовность устройств
+    std::shared_ptr<ReadySignal> m_ready;               ///< Сигнал готовности устройства (общий с подпиской)
+    mutable std::mutex m_mutex;                         ///< Мьютекс журнала и параметров
+    std::string m_lastError;                            ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_BATCH_DOWNLOAD_H
@@ -0,0 +1,201 @@
+#ifndef MTP_COMMAND_SCHEDULER_H
+#define MTP_COMMAND_SCHEDULER_H
+
+#include "MtpTransfer.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <utility>
+
+/**
+ * @brief Приоритет команды устройства
+ */
+enum class MtpCommandPriority {
+    Interactive,    ///< Команды пользователя: списки, метаданные, миниатюры
+    Bulk,           ///< Части больших передач
+    Idle            ///< Фоновые команды, выполняемые только при простое
+};
+
+/**
+ * @brief Планировщик команд MTP-устройства
+ *
+ * Все команды устройства выполняются в одном рабочем потоке, так как
+ * сеанс MTP обслуживает только одну операцию за раз. Большие передачи
+ * разбиваются на части (GetPartialObject), и между частями в первую
+ * очередь выполняются интерактивные команды, поэтому просмотр папок
+ * не ждет окончания многогигабайтной загрузки.
+ */
+class MtpCommandScheduler {
+public:
+    /**
+     * @brief Тип команды устройства
+     */
+    using Command = std::function<void()>;
+
+    /**
+     * @brief Размер части большой передачи по умолчанию (4 МиБ)
+     *
+     * Одна часть передается по USB 2.0 примерно за 100-150 мс, что и
+     * ограничивает задержку интерактивных команд под нагрузкой.
+     */
+    static const uint32_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * @brief Конструктор; запускает рабочий поток
+     */
+    MtpCommandScheduler();
+
+    /**
+     * @brief Деструктор; останавливает рабочий поток
+     */
+    ~MtpCommandScheduler();
+
+    /**
+     * @brief Ставит команду в очередь, не дожидаясь ее выполнения
+     * @param priority Приоритет команды
+     * @param command Команда
+     * @return true если команда поставлена в очередь, false если планировщик остановлен
+     */
+    bool post(MtpCommandPriority priority, Command command);
+
+    /**
+     * @brief Ставит команду в очередь и возвращает ее будущий результат
+     *
+     * При вызове из рабочего потока команда выполняется сразу, чтобы
+     * вложенные вызовы не приводили к взаимной блокировке. После остановки
+     * планировщика команда тоже выполняется сразу в вызывающем потоке:
+     * устройство к этому моменту уже снято с учета в MtpHandleTable,
+     * и команда завершается ошибкой, не обращаясь к нему.
+     * @param priority Приоритет команды
+     * @param function Функция, выполняемая в рабочем потоке
+     * @return Будущий результат функции
+     */
+    template <typename Function, typename Result = decltype(std::declval<Function&>()())>
+    std::future<Result> submit(MtpCommandPriority priority, Function function)
+    {
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+        std::future<Result> result = task->get_future();
+
+        if (isWorkerThread() || !post(priority, [task]() { (*task)(); })) {
+            (*task)();
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Выполняет команду в рабочем потоке и дожидается результата
+     * @param priority Приоритет команды
+     * @param function Функция, выполняемая в рабочем потоке
+     * @return Результат функции
+     */
+    template <typename Function, typename Result = decltype(std::declval<Function&>()())>
+    Result call(MtpCommandPriority priority, Function function)
+    {
+        return submit(priority, std::move(function)).get();
+    }
+
+    /**
+     * @brief Проверяет, выполняется ли вызов в рабочем потоке планировщика
+     * @return true если вызов из рабочего потока
+     */
+    bool isWorkerThread() const;
+
+    /**
+     * @brief Получает количество ожидающих команд с указанным приоритетом
+     * @param priority Приоритет
+     * @return Количество команд в очереди
+     */
+    size_t getPendingCount(MtpCommandPriority priority) const;
+
+    /**
+     * @brief Устанавливает размер части больших передач
+     * @param chunkSize Размер в байтах
+     */
+    void setChunkSize(uint32_t chunkSize);
+
+    /**
+     * @brief Получает размер части больших передач
+     * @return Размер в байтах
+     */
+    uint32_t getChunkSize() const;
+
+    /**
+     * @brief Останавливает рабочий поток
+     *
+     * Команды, оставшиеся в очереди, выполняются перед выходом потока.
+     * Вызывающая сторона должна снять устройство с учета в MtpHandleTable
+     * до остановки, чтобы эти команды не обращались к устройству.
+     */
+    void stop();
+
+private:
+    /**
+     * @brief Цикл рабочего потока
+     */
+    void run();
+
+private:
+    std::deque<Command> m_queues[3];        ///< Очереди команд по приоритетам
+    uint32_t m_chunkSize;                   ///< Размер части больших передач
+    bool m_stopping;                        ///< Флаг остановки
+    std::thread m_worker;                   ///< Рабочий поток
+    std::thread::id m_workerId;             ///< ID рабочего потока
+    mutable std::mutex m_mutex;             ///< Мьютекс для потокобезопасности
+    std::condition_variable m_condition;    ///< Условие появления команд
+};
+
+/**
+ * @brief Выполняет команду через планировщик устройства
+ *
+ * Если планировщик не задан, команда выполняется в текущем потоке.
+ * @param scheduler Планировщик устройства (может быть nullptr)
+ * @param priority Приоритет команды
+ * @param function Функция, обращающаяся к устройству
+ * @return Результат функции
+ */
+template <typename Function, typename Result = decltype(std::declval<Function&>()())>
+Result runOnDevice(const std::shared_ptr<MtpCommandScheduler>& scheduler,
+                   MtpCommandPriority priority, Function function)
+{
+    if (!scheduler) {
+        return function();
+    }
+    return scheduler->call(priority, std::move(function));
+}
+
+/**
+ * @brief Выполняет команду передачи через планировщик устройства
+ *
+ * Команда сообщает ход только через MtpTransfer::report и не ждет;
+ * функцию обратного вызова, пока команда выполняется, вызывает
+ * ожидающий поток (MtpTransfer::poll).
+ * @param scheduler Планировщик устройства (может быть nullptr)
+ * @param priority Приоритет команды
+ * @param transfer Дескриптор передачи (может быть nullptr)
+ * @param function Функция, обращающаяся к устройству
+ * @return Результат функции
+ */
+template <typename Function, typename Result = decltype(std::declval<Function&>()())>
+Result runTransferOnDevice(const std::shared_ptr<MtpCommandScheduler>& scheduler,
+                           MtpCommandPriority priority, MtpTransfer* transfer, Function function)
+{
+    if (!scheduler || !transfer) {
+        return runOnDevice(scheduler, priority, std::move(function));
+    }
+
+    std::future<Result> result = scheduler->submit(priority, std::move(function));
+    while (result.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) {
+        transfer->poll();
+    }
+    transfer->poll();
+    return result.get();
+}
+
+#endif // MTP_COMMAND_SCHEDULER_H
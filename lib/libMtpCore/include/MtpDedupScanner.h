@@ -0,0 +1,197 @@
+#ifndef MTP_DEDUP_SCANNER_H
+#define MTP_DEDUP_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+// Предварительное объявление классов
+class MtpFile;
+
+/**
+ * @brief Параметры поиска дубликатов
+ */
+struct MtpDedupOptions {
+    uint32_t sampleSize = 64 * 1024;        ///< Размер начального и конечного фрагментов, байт
+    bool matchName = false;                 ///< Требовать совпадения имени файла
+    bool matchModificationDate = false;     ///< Требовать совпадения времени изменения
+    bool verifyContent = false;             ///< Подтверждать любое совпадение хешем всего файла
+};
+
+/**
+ * @brief Результат проверки файла устройства
+ */
+struct MtpDedupResult {
+    std::shared_ptr<MtpFile> file;  ///< Файл на устройстве
+    std::string localPath;          ///< Совпавший локальный файл (пусто, если копии нет)
+
+    /**
+     * @brief Проверяет, найдена ли локальная копия
+     * @return true если файл уже есть в локальном архиве
+     */
+    bool isDuplicate() const { return !localPath.empty(); }
+};
+
+/**
+ * @brief Поиск файлов устройства, уже имеющихся в локальном архиве
+ *
+ * Сравнение идет по ступеням, и каждая следующая читает с устройства
+ * больше данных, но нужна все реже:
+ * 1. Размер (и при необходимости имя и время изменения) сверяются с
+ *    индексом локальных файлов без обращения к устройству; файлы
+ *    уникального размера сразу считаются новыми.
+ * 2. У оставшихся через GetPartialObject читаются начальный и конечный
+ *    фрагменты по sampleSize байт, и их хеш сравнивается с хешем тех же
+ *    фрагментов локальных кандидатов.
+ * 3. Только если фрагменты совпали у нескольких разных локальных файлов
+ *    (или включен verifyContent), файл читается с устройства целиком.
+ *
+ * Хеши локальных файлов считаются при первой необходимости и
+ * запоминаются. Файлы не больше двух фрагментов сразу сравниваются
+ * целиком: это не дороже чтения фрагментов.
+ */
+class MtpDedupScanner {
+public:
+    /**
+     * @brief Тип функции отображения хода проверки
+     *
+     * Возврат false прерывает проверку.
+     */
+    using ProgressCallback = std::function<bool(uint64_t checked, uint64_t total)>;
+
+    /**
+     * @brief Конструктор
+     * @param options Параметры поиска
+     */
+    explicit MtpDedupScanner(const MtpDedupOptions& options = MtpDedupOptions());
+
+    /**
+     * @brief Добавляет в индекс все файлы локальной директории, включая вложенные
+     * @param path Путь к директории
+     * @return true в случае успеха, false если директорию не удалось прочитать
+     */
+    bool addLocalDirectory(const std::string& path);
+
+    /**
+     * @brief Добавляет в индекс локальный файл
+     * @param path Путь к файлу
+     * @return true в случае успеха, false если файл не найден
+     */
+    bool addLocalFile(const std::string& path);
+
+    /**
+     * @brief Получает количество файлов в индексе
+     * @return Количество файлов
+     */
+    size_t getLocalCount() const;
+
+    /**
+     * @brief Ищет локальную копию файла устройства
+     * @param file Файл на устройстве
+     * @return Результат проверки; при ошибке чтения файл считается новым
+     */
+    MtpDedupResult check(const std::shared_ptr<MtpFile>& file);
+
+    /**
+     * @brief Проверяет список файлов устройства
+     *
+     * Директории пропускаются.
+     * @param files Файлы на устройстве
+     * @param progress Функция отображения хода проверки (может быть пустой)
+     * @return Результаты по порядку файлов; при прерывании - только проверенные
+     */
+    std::vector<MtpDedupResult> scan(const std::vector<std::shared_ptr<MtpFile>>& files,
+                                     ProgressCallback progress = nullptr);
+
+    /**
+     * @brief Получает объем данных, прочитанных с устройства при проверках
+     * @return Объем в байтах
+     */
+    uint64_t getBytesRead() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Хеш SHA-256
+     */
+    using Digest = std::array<unsigned char, 32>;
+
+    /**
+     * @brief Файл локального архива
+     */
+    struct LocalFile {
+        std::string path;               ///< Путь к файлу
+        std::string name;               ///< Имя файла
+        uint64_t size = 0;              ///< Размер файла
+        time_t modificationDate = 0;    ///< Время изменения
+        bool hasSample = false;         ///< Хеш фрагментов посчитан
+        bool hasContent = false;        ///< Хеш всего файла посчитан
+        bool unreadable = false;        ///< Файл не удалось прочитать
+        Digest sample = Digest();       ///< Хеш начального и конечного фрагментов
+        Digest content = Digest();      ///< Хеш всего файла
+    };
+
+    /**
+     * @brief Проверяет, что файл попадает в фрагментное сравнение
+     * @param size Размер файла
+     * @return true если файл больше двух фрагментов
+     */
+    bool isSampled(uint64_t size) const;
+
+    /**
+     * @brief Считает хеш фрагментов локального файла
+     * @param local Локальный файл
+     * @return true в случае успеха
+     */
+    bool hashLocalSample(LocalFile& local);
+
+    /**
+     * @brief Считает хеш всего локального файла
+     * @param local Локальный файл
+     * @return true в случае успеха
+     */
+    bool hashLocalContent(LocalFile& local);
+
+    /**
+     * @brief Читает с устройства фрагменты файла и считает их хеш
+     * @param file Файл на устройстве
+     * @param digest Хеш фрагментов
+     * @return true в случае успеха, false если частичное чтение не удалось
+     */
+    bool hashDeviceSample(const std::shared_ptr<MtpFile>& file, Digest& digest);
+
+    /**
+     * @brief Читает файл с устройства целиком и считает его хеш
+     * @param file Файл на устройстве
+     * @param digest Хеш файла
+     * @return true в случае успеха
+     */
+    bool hashDeviceContent(const std::shared_ptr<MtpFile>& file, Digest& digest);
+
+    /**
+     * @brief Ищет среди кандидатов файл с тем же содержимым
+     * @param file Файл на устройстве
+     * @param candidates Индексы локальных кандидатов
+     * @return Путь к совпавшему файлу или пустая строка
+     */
+    std::string matchContent(const std::shared_ptr<MtpFile>& file, const std::vector<size_t>& candidates);
+
+private:
+    MtpDedupOptions m_options;                  ///< Параметры поиска
+    std::vector<LocalFile> m_locals;            ///< Файлы локального архива
+    std::multimap<uint64_t, size_t> m_bySize;   ///< Размер -> индекс в m_locals
+    uint64_t m_bytesRead;                       ///< Прочитано с устройства, байт
+    std::string m_lastError;                    ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_DEDUP_SCANNER_H
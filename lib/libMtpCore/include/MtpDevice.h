@@ -4,10 +4,15 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
+#include <mutex>
 #include <libmtp.h>
+#include "MtpEventListener.h"
+#include "MtpHandle.h"
 
 // Предварительное объявление классов
 class MtpStorage;
+class MtpCommandScheduler;
 
 /**
  * @brief Представление MTP-устройства
@@ -65,6 +70,12 @@ public:
      */
     std::string getMtpVersion() const;
 
+    /**
+     * @brief Получает структуру сырого устройства, из которой открыто устройство
+     * @return Структура сырого устройства libmtp
+     */
+    LIBMTP_raw_device_t getRawDevice() const;
+
     /**
      * @brief Обновляет список хранилищ устройства
      * @return true в случае успеха, false в случае ошибки
@@ -102,11 +113,94 @@ public:
      */
     LIBMTP_mtpdevice_t* getLibMtpDevice() const;
 
+    /**
+     * @brief Получает ссылку на устройство
+     *
+     * Ссылка перестает разрешаться после удаления объекта устройства.
+     * @return Ссылка на устройство
+     */
+    MtpDeviceHandle getHandle() const;
+
+    /**
+     * @brief Получает планировщик команд устройства
+     * @return Умный указатель на планировщик
+     */
+    std::shared_ptr<MtpCommandScheduler> getScheduler() const;
+
+    /**
+     * @brief Тип функции обратного вызова для событий устройства
+     */
+    using EventCallback = std::function<void(const MtpDeviceEvent&)>;
+
+    /**
+     * @brief Регистрирует функцию обратного вызова для событий устройства
+     *
+     * Функции вызываются в потоке планировщика устройства. Для ObjectAdded
+     * сведения об объекте уже запрошены с устройства. Изменения объектов
+     * также рассылаются подписчикам хранилищ (см. MtpStorage::registerObjectChangeCallback),
+     * поэтому индексы и кэши обновляются без повторного чтения списков.
+     * Изменения, сделанные через библиотеку, устройство тоже сообщает
+     * событиями, поэтому подписчики должны допускать повторные уведомления.
+     * @param callback Функция обратного вызова
+     * @return ID зарегистрированного обратного вызова
+     */
+    int registerEventCallback(EventCallback callback);
+
+    /**
+     * @brief Удаляет функцию обратного вызова по ID
+     * @param callbackId ID функции обратного вызова
+     * @return true если функция обратного вызова успешно удалена
+     */
+    bool unregisterEventCallback(int callbackId);
+
+    /**
+     * @brief Запускает чтение событий устройства
+     *
+     * Вызывается конструктором; повторный вызов нужен только после stopEventListener.
+     * @return true если чтение событий запущено
+     */
+    bool startEventListener();
+
+    /**
+     * @brief Останавливает чтение событий устройства
+     */
+    void stopEventListener();
+
+    /**
+     * @brief Проверяет, читаются ли события устройства
+     *
+     * Поток останавливается сам, если устройство не поддерживает события
+     * или было отключено.
+     * @return true если поток чтения событий работает
+     */
+    bool isEventListenerRunning() const;
+
+private:
+    /**
+     * @brief Обрабатывает событие, полученное потоком чтения событий
+     * @param event Событие
+     */
+    void handleEvent(const MtpDeviceEvent& event);
+
+    /**
+     * @brief Применяет событие к хранилищам и рассылает его подписчикам;
+     *        выполняется в потоке планировщика
+     * @param event Событие
+     */
+    void dispatchEvent(MtpDeviceEvent event);
+
 private:
     LIBMTP_mtpdevice_t* m_device;                        ///< Указатель на устройство libmtp
     LIBMTP_raw_device_t m_rawDevice;                     ///< Структура сырого устройства libmtp
+    MtpDeviceHandle m_handle;                            ///< Ссылка на устройство в MtpHandleTable
     std::vector<std::shared_ptr<MtpStorage>> m_storages;  ///< Список хранилищ устройства
     mutable std::string m_lastError;                     ///< Последнее сообщение об ошибке
+    std::shared_ptr<MtpCommandScheduler> m_scheduler;    ///< Планировщик команд устройства
+    mutable std::mutex m_storagesMutex;                  ///< Мьютекс списка хранилищ
+    std::unique_ptr<MtpEventListener> m_eventListener;   ///< Поток чтения событий устройства
+    std::vector<std::pair<int, EventCallback>> m_eventCallbacks; ///< Функции обратного вызова для событий
+    int m_nextCallbackId;                                ///< ID для следующей функции обратного вызова
+    mutable std::mutex m_callbackMutex;                  ///< Мьютекс списка функций обратного вызова
 };
 
 #endif // MTP_DEVICE_H
\ No newline at end of file
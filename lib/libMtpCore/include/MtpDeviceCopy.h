@@ -0,0 +1,101 @@
+#ifndef MTP_DEVICE_COPY_H
+#define MTP_DEVICE_COPY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Предварительное объявление классов
+class MtpFile;
+class MtpDirectory;
+class MtpTransfer;
+
+/**
+ * @brief Копирование файлов с одного MTP-устройства на другое
+ *
+ * Данные читаются с исходного устройства и одновременно отправляются
+ * на целевое через ограниченный кольцевой буфер в памяти, без
+ * временного файла на диске. Чтение и запись идут в разных потоках,
+ * поэтому скорость копирования определяется более медленным устройством.
+ */
+class MtpDeviceCopy {
+public:
+    /**
+     * @brief Размер кольцевого буфера по умолчанию (16 МиБ)
+     */
+    static const size_t DEFAULT_BUFFER_SIZE = 16 * 1024 * 1024;
+
+    /**
+     * @brief Конструктор
+     * @param bufferSize Размер кольцевого буфера в байтах
+     */
+    explicit MtpDeviceCopy(size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    /**
+     * @brief Копирует файл в директорию на другом устройстве
+     * @param source Исходный файл
+     * @param target Целевая директория
+     * @param transfer Дескриптор для отслеживания и отмены копирования (может быть nullptr)
+     * @return ID созданного файла или 0 в случае ошибки
+     */
+    uint32_t copyFile(const std::shared_ptr<MtpFile>& source, const std::shared_ptr<MtpDirectory>& target,
+                      std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Копирует директорию со всем содержимым в директорию на другом устройстве
+     *
+     * В целевой директории создается поддиректория с именем исходной.
+     * Сначала воссоздается структура директорий и подсчитывается общий
+     * объем, затем файлы копируются по одному.
+     * @param source Исходная директория
+     * @param target Целевая директория
+     * @param transfer Дескриптор для отслеживания и отмены копирования (может быть nullptr)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool copyTree(const std::shared_ptr<MtpDirectory>& source, const std::shared_ptr<MtpDirectory>& target,
+                  std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Файл, ожидающий копирования
+     */
+    struct PendingCopy {
+        std::shared_ptr<MtpFile> source;        ///< Исходный файл
+        std::shared_ptr<MtpDirectory> target;   ///< Целевая директория
+    };
+
+    /**
+     * @brief Передает содержимое файла через кольцевой буфер
+     * @param source Исходный файл
+     * @param target Целевая директория
+     * @param baseOffset Объем, скопированный до этого файла (для общего хода)
+     * @param transfer Дескриптор передачи (может быть nullptr)
+     * @return ID созданного файла или 0 в случае ошибки
+     */
+    uint32_t streamFile(const std::shared_ptr<MtpFile>& source, const std::shared_ptr<MtpDirectory>& target,
+                        uint64_t baseOffset, MtpTransfer* transfer);
+
+    /**
+     * @brief Воссоздает структуру директорий и собирает список файлов
+     * @param source Исходная директория
+     * @param target Директория, в которой создается копия
+     * @param files Список файлов для копирования
+     * @param totalBytes Общий объем файлов
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool collectTree(const std::shared_ptr<MtpDirectory>& source, const std::shared_ptr<MtpDirectory>& target,
+                     std::vector<PendingCopy>& files, uint64_t& totalBytes);
+
+private:
+    size_t m_bufferSize;        ///< Размер кольцевого буфера
+    std::string m_lastError;    ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_DEVICE_COPY_H
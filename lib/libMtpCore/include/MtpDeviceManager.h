@@ -6,7 +6,9 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <libmtp.h>
+#include "MtpHandle.h"
 
 // Предварительное объявление классов
 class MtpDevice;
@@ -30,7 +32,11 @@ public:
     ~MtpDeviceManager();
 
     /**
-     * @brief Инициализирует libmtp
+     * @brief Инициализирует libmtp и запускает фоновое обнаружение устройств
+     *
+     * Возвращает управление сразу, не дожидаясь открытия устройств.
+     * О каждом готовом устройстве сообщают функции обратного вызова
+     * (см. registerDeviceReadyCallback и registerDeviceChangeCallback).
      * @return true в случае успеха, false в случае ошибки
      */
     bool initialize();
@@ -42,10 +48,54 @@ public:
 
     /**
      * @brief Обнаруживает подключенные MTP-устройства
+     *
+     * Устройства открываются параллельно, каждое в своем потоке, и
+     * публикуются сразу по готовности. Метод ждет завершения всех потоков.
      * @return true если обнаружены устройства, false в противном случае
      */
     bool detectDevices();
 
+    /**
+     * @brief Запускает обнаружение устройств в фоновом потоке
+     *
+     * Если фоновое обнаружение уже идет, метод не ждет его: идущий проход
+     * повторяет обнаружение после завершения. Поэтому метод можно вызывать
+     * из функций обратного вызова менеджера.
+     */
+    void detectDevicesAsync();
+
+    /**
+     * @brief Проверяет, идет ли сейчас обнаружение устройств
+     * @return true если обнаружение не завершено
+     */
+    bool isDetecting() const;
+
+    /**
+     * @brief Дожидается завершения фонового обнаружения устройств
+     */
+    void waitForDetection();
+
+    /**
+     * @brief Открывает заново устройство с заданным серийным номером
+     *
+     * В отличие от detectDevices, уже открытые устройства не трогает:
+     * открываются только сырые устройства, которых еще нет в списке.
+     * Найденные при этом другие устройства тоже публикуются.
+     * @param serialNumber Серийный номер устройства
+     * @return Устройство или nullptr, если оно не найдено
+     */
+    std::shared_ptr<MtpDevice> reconnectDevice(const std::string& serialNumber);
+
+    /**
+     * @brief Убирает устройство из списка
+     *
+     * Используется для экземпляра, переставшего отвечать: устройство
+     * освобождается, когда на него не останется других указателей.
+     * @param device Устройство
+     * @return true если устройство было в списке
+     */
+    bool removeDevice(const std::shared_ptr<MtpDevice>& device);
+
     /**
      * @brief Возвращает количество обнаруженных устройств
      * @return Количество устройств
@@ -59,6 +109,13 @@ public:
      */
     std::shared_ptr<MtpDevice> getDevice(size_t index) const;
 
+    /**
+     * @brief Возвращает устройство по ссылке
+     * @param handle Ссылка на устройство
+     * @return Умный указатель на устройство или nullptr, если устройство отключено
+     */
+    std::shared_ptr<MtpDevice> getDevice(MtpDeviceHandle handle) const;
+
     /**
      * @brief Возвращает список всех устройств
      * @return Вектор умных указателей на устройства
@@ -84,6 +141,27 @@ public:
      */
     bool unregisterDeviceChangeCallback(int callbackId);
 
+    /**
+     * @brief Тип функции обратного вызова для уведомлений о готовности устройства
+     */
+    using DeviceReadyCallback = std::function<void(std::shared_ptr<MtpDevice>)>;
+
+    /**
+     * @brief Регистрирует функцию обратного вызова, вызываемую для каждого открытого устройства
+     *
+     * Функция вызывается из потока, открывшего устройство.
+     * @param callback Функция обратного вызова
+     * @return ID зарегистрированного обратного вызова
+     */
+    int registerDeviceReadyCallback(DeviceReadyCallback callback);
+
+    /**
+     * @brief Удаляет функцию обратного вызова готовности устройства по ID
+     * @param callbackId ID функции обратного вызова
+     * @return true если функция обратного вызова успешно удалена
+     */
+    bool unregisterDeviceReadyCallback(int callbackId);
+
     /**
      * @brief Возвращает последнее сообщение об ошибке
      * @return Строка с сообщением об ошибке
@@ -91,6 +169,20 @@ public:
     std::string getLastError() const;
 
 private:
+    /**
+     * @brief Открывает одно устройство и публикует его (выполняется в рабочем потоке)
+     * @param rawDevice Структура сырого устройства libmtp
+     * @param generation Номер прохода обнаружения, запустившего открытие
+     * @return Опубликованное устройство или nullptr
+     */
+    std::shared_ptr<MtpDevice> openDevice(LIBMTP_raw_device_t rawDevice, uint64_t generation);
+
+    /**
+     * @brief Вызывает функции обратного вызова готовности устройства
+     * @param device Открытое устройство
+     */
+    void notifyDeviceReady(const std::shared_ptr<MtpDevice>& device);
+
     /**
      * @brief Освобождает все обнаруженные устройства
      */
@@ -108,7 +200,14 @@ private:
     std::vector<std::shared_ptr<MtpDevice>> m_devices; ///< Список MTP-устройств
     std::string m_lastError;                          ///< Последнее сообщение об ошибке
     std::vector<std::pair<int, DeviceChangeCallback>> m_callbacks; ///< Список функций обратного вызова
+    std::vector<std::pair<int, DeviceReadyCallback>> m_readyCallbacks; ///< Функции обратного вызова готовности
     int m_nextCallbackId;                             ///< ID для следующей функции обратного вызова
+    uint64_t m_generation;                            ///< Номер текущего прохода обнаружения
+    bool m_detecting;                                 ///< Флаг идущего обнаружения
+    bool m_detectionRunning;                          ///< Поток фонового обнаружения выполняет проход
+    bool m_rescanRequested;                           ///< Запрошен повторный проход фонового обнаружения
+    std::thread m_detectionThread;                    ///< Поток фонового обнаружения
+    std::mutex m_detectionMutex;                      ///< Мьютекс для управления потоком обнаружения
     mutable std::mutex m_mutex;                       ///< Мьютекс для потокобезопасности
 };
 
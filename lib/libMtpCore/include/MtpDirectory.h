@@ -4,6 +4,8 @@
 #include "MtpFile.h"
 #include <vector>
 #include <memory>
+#include <functional>
+#include <ctime>
 
 /**
  * @brief Представление директории на MTP-устройстве
@@ -15,14 +17,33 @@ class MtpDirectory : public MtpFile {
 public:
     /**
      * @brief Конструктор
-     * @param device Указатель на устройство libmtp
+     * @param device Ссылка на устройство
      * @param id ID директории
      * @param storageId ID хранилища
      * @param name Имя директории
      * @param parentId ID родительской директории
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     * @param listings Кэш содержимого директорий хранилища (может быть nullptr)
      */
-    MtpDirectory(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, 
-                 const std::string& name, uint32_t parentId = 0);
+    MtpDirectory(MtpDeviceHandle device, uint32_t id, uint32_t storageId, 
+                 const std::string& name, uint32_t parentId = 0,
+                 std::shared_ptr<MtpObjectNotifier> notifier = nullptr,
+                 std::shared_ptr<MtpCommandScheduler> scheduler = nullptr,
+                 std::shared_ptr<MtpListingCache> listings = nullptr);
+
+    /**
+     * @brief Конструктор по сведениям об объекте
+     * @param device Ссылка на устройство
+     * @param info Сведения о директории
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     * @param listings Кэш содержимого директорий хранилища (может быть nullptr)
+     */
+    MtpDirectory(MtpDeviceHandle device, const MtpObjectInfo& info,
+                 std::shared_ptr<MtpObjectNotifier> notifier = nullptr,
+                 std::shared_ptr<MtpCommandScheduler> scheduler = nullptr,
+                 std::shared_ptr<MtpListingCache> listings = nullptr);
 
     /**
      * @brief Деструктор
@@ -37,6 +58,10 @@ public:
 
     /**
      * @brief Получает содержимое директории
+     *
+     * Если задан кэш содержимого директорий, список берется из него, а
+     * после получения в фоне загружаются списки поддиректорий и
+     * родительских директорий.
      * @return Вектор умных указателей на файлы и поддиректории
      */
     std::vector<std::shared_ptr<MtpFile>> getContent();
@@ -59,9 +84,51 @@ public:
      * @brief Отправляет файл в директорию
      * @param localPath Локальный путь к файлу
      * @param remoteName Имя файла на устройстве (если пусто, используется имя локального файла)
+     * @param transfer Дескриптор для отслеживания и отмены передачи (может быть nullptr)
+     * @return ID созданного файла или 0 в случае ошибки
+     */
+    uint32_t sendFile(const std::string& localPath, const std::string& remoteName = "",
+                      std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Тип функции, поставляющей данные для отправки
+     *
+     * Заполняет буфер не более чем length байтами и возвращает их
+     * количество. Возврат 0 до окончания данных прерывает отправку.
+     */
+    using DataSource = std::function<size_t(unsigned char* buffer, size_t length)>;
+
+    /**
+     * @brief Отправляет в директорию файл из потока данных, без локального файла
+     * @param name Имя файла на устройстве
+     * @param size Точный размер файла в байтах
+     * @param source Функция, поставляющая данные (вызывается из потока планировщика
+     *               устройства; не должна ждать, ход сообщает через MtpTransfer::report)
+     * @param modificationDate Время изменения файла (0 - текущее время)
+     * @param transfer Дескриптор передачи, ход которой сообщается из вызывающего потока (может быть nullptr)
      * @return ID созданного файла или 0 в случае ошибки
      */
-    uint32_t sendFile(const std::string& localPath, const std::string& remoteName = "");
+    uint32_t sendData(const std::string& name, uint64_t size, const DataSource& source,
+                      time_t modificationDate = 0, MtpTransfer* transfer = nullptr);
+
+    /**
+     * @brief Создает поддиректорию и возвращает объект для работы с ней
+     * @param name Имя новой директории
+     * @return Умный указатель на директорию или nullptr в случае ошибки
+     */
+    std::shared_ptr<MtpDirectory> createSubdirectory(const std::string& name);
+
+private:
+    /**
+     * @brief Сообщает подписчикам о созданном файле
+     * @param fileData Структура libmtp с заполненным ID
+     */
+    void notifyFileAdded(const LIBMTP_file_t* fileData);
+
+    /**
+     * @brief Запрашивает данные для отправки у DataSource
+     */
+    static uint16_t getFromSource(void* params, void* priv, uint32_t wantlen, unsigned char* data, uint32_t* gotlen);
 };
 
 #endif // MTP_DIRECTORY_H
\ No newline at end of file
@@ -0,0 +1,137 @@
+#ifndef MTP_EVENT_LISTENER_H
+#define MTP_EVENT_LISTENER_H
+
+#include "MtpTypes.h"
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <libmtp.h>
+
+/**
+ * @brief Вид события MTP-устройства
+ */
+enum class MtpDeviceEventType {
+    StoreAdded,             ///< Подключено хранилище (например, вставлена карта памяти)
+    StoreRemoved,           ///< Хранилище отключено
+    ObjectAdded,            ///< На устройстве появился объект
+    ObjectRemoved,          ///< Объект удален
+    DevicePropertyChanged   ///< Изменилось свойство устройства
+};
+
+/**
+ * @brief Событие MTP-устройства
+ */
+struct MtpDeviceEvent {
+    MtpDeviceEventType type;    ///< Вид события
+    uint32_t param = 0;         ///< ID хранилища, ID объекта или код свойства - в зависимости от вида
+    MtpObjectInfo info;         ///< Сведения об объекте (заполняются для ObjectAdded)
+};
+
+/**
+ * @brief Фоновый поток чтения событий MTP-устройства
+ *
+ * Читает события асинхронно через LIBMTP_Read_Event_Async и передает
+ * их обработчику. Обработчик вызывается из потока обработки событий
+ * libusb и не должен блокироваться: команды к устройству из него
+ * следует ставить в очередь планировщика.
+ */
+class MtpEventListener {
+public:
+    /**
+     * @brief Тип функции, получающей события
+     */
+    using EventHandler = std::function<void(const MtpDeviceEvent&)>;
+
+    /**
+     * @brief Конструктор
+     * @param device Указатель на устройство libmtp
+     * @param handler Функция, получающая события
+     */
+    MtpEventListener(LIBMTP_mtpdevice_t* device, EventHandler handler);
+
+    /**
+     * @brief Деструктор; останавливает поток
+     *
+     * Перед удалением недолго обрабатывает события, чтобы получить ответ
+     * на отправленный запрос, если устройство уже отключено.
+     */
+    ~MtpEventListener();
+
+    /**
+     * @brief Запускает поток чтения событий
+     * @return true если поток запущен
+     */
+    bool start();
+
+    /**
+     * @brief Останавливает поток чтения событий
+     */
+    void stop();
+
+    /**
+     * @brief Запрещает обработку событий libusb потоками слушателей
+     *
+     * Устройство освобождается под этой блокировкой, чтобы ожидающий
+     * запрос события не завершился в потоке слушателя во время
+     * освобождения. Синхронные передачи других устройств обрабатывают
+     * события libusb сами, и от них блокировка не защищает: libmtp не
+     * умеет отменять запрос, поэтому его сначала завершают при
+     * уничтожении слушателя, а здесь лишь сужается оставшееся окно.
+     * @return Блокировка, действующая до своего уничтожения
+     */
+    static std::unique_lock<std::mutex> blockEvents();
+
+    /**
+     * @brief Проверяет, работает ли поток чтения событий
+     * @return true если события читаются
+     */
+    bool isRunning() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Основной цикл потока
+     */
+    void run();
+
+    /**
+     * @brief Ограниченное время ждет ответа на отправленный запрос события
+     */
+    void drain();
+
+    /**
+     * @brief Функция обратного вызова libmtp
+     */
+    static void eventCallback(int ret, LIBMTP_event_t event, uint32_t param, void* data);
+
+    /**
+     * @brief Обрабатывает событие, полученное от libmtp
+     */
+    void handleEvent(int ret, LIBMTP_event_t event, uint32_t param);
+
+    /**
+     * @brief Сохраняет сообщение об ошибке
+     * @param error Сообщение
+     */
+    void setError(const std::string& error);
+
+private:
+    LIBMTP_mtpdevice_t* m_device;   ///< Указатель на устройство libmtp
+    EventHandler m_handler;         ///< Функция, получающая события
+    uintptr_t m_token;              ///< Ключ в реестре слушателей, передаваемый в libmtp
+    std::thread m_thread;           ///< Поток чтения событий
+    std::atomic<bool> m_running;    ///< Поток работает
+    std::atomic<bool> m_stopping;   ///< Запрошена остановка
+    std::atomic<bool> m_armed;      ///< Запрос события отправлен и ждет ответа
+    std::string m_lastError;        ///< Последнее сообщение об ошибке
+    mutable std::mutex m_mutex;     ///< Мьютекс для сообщения об ошибке
+};
+
+#endif // MTP_EVENT_LISTENER_H
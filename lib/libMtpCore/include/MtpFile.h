@@ -5,6 +5,18 @@
 #include <libmtp.h>
 #include <memory>
 #include <vector>
+#include <functional>
+#include <ctime>
+#include "MtpTypes.h"
+#include "MtpFileWriter.h"
+#include "MtpHandle.h"
+
+// Предварительное объявление классов
+class MtpObjectNotifier;
+class MtpCommandScheduler;
+class MtpListingCache;
+class MtpTransfer;
+class MtpDirectory;
 
 /**
  * @brief Представление файла на MTP-устройстве
@@ -16,11 +28,42 @@ class MtpFile {
 public:
     /**
      * @brief Конструктор
-     * @param device Указатель на устройство libmtp
+     * @param device Ссылка на устройство
      * @param file Указатель на файл libmtp
      * @param storageId ID хранилища
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     */
+    MtpFile(MtpDeviceHandle device, LIBMTP_file_t* file, uint32_t storageId,
+            std::shared_ptr<MtpObjectNotifier> notifier = nullptr,
+            std::shared_ptr<MtpCommandScheduler> scheduler = nullptr);
+
+    /**
+     * @brief Конструктор по сведениям об объекте
+     * @param device Ссылка на устройство
+     * @param info Сведения об объекте
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     * @param listings Кэш содержимого директорий хранилища (может быть nullptr)
      */
-    MtpFile(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, uint32_t storageId);
+    MtpFile(MtpDeviceHandle device, const MtpObjectInfo& info,
+            std::shared_ptr<MtpObjectNotifier> notifier = nullptr,
+            std::shared_ptr<MtpCommandScheduler> scheduler = nullptr,
+            std::shared_ptr<MtpListingCache> listings = nullptr);
+
+    /**
+     * @brief Создает MtpFile или MtpDirectory в зависимости от типа объекта
+     * @param device Ссылка на устройство
+     * @param info Сведения об объекте
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     * @param listings Кэш содержимого директорий хранилища (может быть nullptr)
+     * @return Умный указатель на объект
+     */
+    static std::shared_ptr<MtpFile> create(MtpDeviceHandle device, const MtpObjectInfo& info,
+                                           std::shared_ptr<MtpObjectNotifier> notifier = nullptr,
+                                           std::shared_ptr<MtpCommandScheduler> scheduler = nullptr,
+                                           std::shared_ptr<MtpListingCache> listings = nullptr);
 
     /**
      * @brief Виртуальный деструктор
@@ -57,18 +100,112 @@ public:
      */
     uint64_t getSize() const;
 
+    /**
+     * @brief Получает тип файла
+     * @return Тип файла libmtp
+     */
+    LIBMTP_filetype_t getType() const;
+
+    /**
+     * @brief Получает время последнего изменения
+     * @return Время изменения или 0, если устройство его не сообщило
+     */
+    time_t getModificationDate() const;
+
+    /**
+     * @brief Получает расширение имени файла
+     * @return Расширение в нижнем регистре без точки или пустая строка
+     */
+    std::string getExtension() const;
+
+    /**
+     * @brief Получает все сведения об объекте
+     * @return Сведения об объекте
+     */
+    MtpObjectInfo getInfo() const;
+
     /**
      * @brief Проверяет, является ли объект директорией
      * @return true если объект - директория, false в противном случае
      */
     virtual bool isDirectory() const;
 
+    /**
+     * @brief Проверяет, находятся ли два объекта на одном устройстве
+     * @param other Другой объект
+     * @return true если объекты принадлежат одному устройству
+     */
+    bool isOnSameDevice(const MtpFile& other) const;
+
+    /**
+     * @brief Получает ссылку на устройство объекта
+     *
+     * По ссылке можно найти устройство в MtpDeviceManager и проверить
+     * через MtpHandleTable, подключено ли оно еще.
+     * @return Ссылка на устройство
+     */
+    MtpDeviceHandle getDeviceHandle() const;
+
+    /**
+     * @brief Проверяет, подключено ли еще устройство объекта
+     *
+     * После отключения все операции с объектом сразу завершаются
+     * ошибкой, не обращаясь к устройству.
+     * @return true если устройство подключено
+     */
+    bool isValid() const;
+
     /**
      * @brief Скачивает файл на компьютер
+     *
+     * Если устройство поддерживает частичное чтение, большие файлы
+     * читаются частями, и между частями устройство успевает выполнять
+     * интерактивные команды. Данные пишутся через MtpFileWriter: файл
+     * появляется по указанному пути только после успешной загрузки.
      * @param path Путь для сохранения файла
+     * @param transfer Дескриптор для отслеживания и отмены передачи (может быть nullptr)
+     * @param options Параметры записи на диск
      * @return true в случае успеха, false в случае ошибки
      */
-    bool downloadFile(const std::string& path);
+    bool downloadFile(const std::string& path, std::shared_ptr<MtpTransfer> transfer = nullptr,
+                      const MtpFileWriterOptions& options = MtpFileWriterOptions());
+
+    /**
+     * @brief Тип функции, получающей данные файла по мере чтения
+     *
+     * Возврат false прерывает чтение.
+     */
+    using DataSink = std::function<bool(const unsigned char* data, size_t length)>;
+
+    /**
+     * @brief Читает содержимое файла потоком
+     *
+     * Данные передаются функции по порядку. Большие файлы читаются
+     * частями так же, как в downloadFile. Функция вызывается в
+     * вызывающем потоке и может ждать, не задерживая другие команды
+     * устройства. Без частичного чтения файл читается одной командой,
+     * и данные, которые функция не успела принять, накапливаются
+     * в памяти, а сверх 16 МиБ - во временном файле.
+     *
+     * Чтение со смещения использует частичное чтение; без его поддержки
+     * файл читается с начала, и первые offset байт пропускаются.
+     * @param sink Функция, получающая данные
+     * @param offset Смещение, с которого передаются данные
+     * @return true в случае успеха, false в случае ошибки или прерывания
+     */
+    bool readContent(const DataSink& sink, uint64_t offset = 0);
+
+    /**
+     * @brief Читает часть файла через GetPartialObject
+     *
+     * Часть, выходящая за конец файла, укорачивается до его размера.
+     * @param offset Смещение от начала файла
+     * @param length Количество байт
+     * @param data Прочитанные данные
+     * @return true в случае успеха, false в случае ошибки или если
+     *         устройство не поддерживает частичное чтение
+     */
+    bool readRange(uint64_t offset, uint32_t length, std::vector<unsigned char>& data);
 
     /**
      * @brief Удаляет файл с устройства
@@ -76,6 +213,44 @@ public:
      */
     bool deleteFile();
 
+    /**
+     * @brief Переименовывает файл или директорию на устройстве
+     *
+     * libmtp может изменить имя под ограничения устройства; итоговое
+     * имя возвращает getName().
+     * @param name Новое имя
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool rename(const std::string& name);
+
+    /**
+     * @brief Перемещает файл или директорию в другую директорию того же устройства
+     *
+     * Целевая директория может находиться в другом хранилище. Перемещение
+     * выполняет устройство (MoveObject), данные по USB не передаются. Если
+     * устройство не поддерживает MoveObject, объект копируется через
+     * copyTo() и исходный удаляется; тогда у объекта меняется ID. После
+     * перемещения объект описывает новое расположение.
+     * @param target Целевая директория
+     * @param transfer Дескриптор для отслеживания и отмены копирования (может быть nullptr)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool moveTo(const std::shared_ptr<MtpDirectory>& target, std::shared_ptr<MtpTransfer> transfer = nullptr);
+
+    /**
+     * @brief Копирует файл или директорию в директорию того же устройства
+     *
+     * Файлы копирует само устройство (CopyObject). Если устройство этого
+     * не поддерживает, каждый файл читается во временный файл на
+     * компьютере и отправляется обратно: прочитать и одновременно
+     * отправить файл в одном сеансе MTP нельзя. Директории воссоздаются
+     * в цели вместе с содержимым.
+     * @param target Целевая директория
+     * @param transfer Дескриптор для отслеживания и отмены копирования (может быть nullptr)
+     * @return ID копии или 0 в случае ошибки
+     */
+    uint32_t copyTo(const std::shared_ptr<MtpDirectory>& target, std::shared_ptr<MtpTransfer> transfer = nullptr);
+
     /**
      * @brief Получает последнее сообщение об ошибке
      * @return Строка с сообщением об ошибке
@@ -83,13 +258,112 @@ public:
     std::string getLastError() const;
 
 protected:
-    LIBMTP_mtpdevice_t* m_device;     ///< Указатель на устройство libmtp
+    /**
+     * @brief Конструктор для директорий, для которых нет структуры libmtp
+     * @param device Ссылка на устройство
+     * @param id ID объекта
+     * @param storageId ID хранилища
+     * @param name Имя объекта
+     * @param parentId ID родительской директории
+     * @param notifier Рассыльщик уведомлений об изменениях хранилища (может быть nullptr)
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
+     * @param listings Кэш содержимого директорий хранилища (может быть nullptr)
+     */
+    MtpFile(MtpDeviceHandle device, uint32_t id, uint32_t storageId,
+            const std::string& name, uint32_t parentId,
+            std::shared_ptr<MtpObjectNotifier> notifier,
+            std::shared_ptr<MtpCommandScheduler> scheduler,
+            std::shared_ptr<MtpListingCache> listings);
+
+    /**
+     * @brief Читает файл частями через GetPartialObject
+     * @param sink Функция, получающая данные
+     * @param offset Смещение начала чтения
+     * @return true в случае успеха, false в случае ошибки или прерывания
+     */
+    bool readInChunks(const DataSink& sink, uint64_t offset);
+
+    /**
+     * @brief Проверяет, поддерживает ли устройство операцию
+     * @param capability Операция
+     * @return true если поддерживает
+     */
+    bool hasCapability(LIBMTP_devicecap_t capability);
+
+    /**
+     * @brief Проверяет, находится ли объект внутри этой директории
+     * @param other Объект
+     * @return true если объект - эта директория или вложен в нее
+     */
+    bool containsObject(const MtpFile& other);
+
+    /**
+     * @brief Получает общий размер файла или содержимого директории
+     * @return Размер в байтах
+     */
+    uint64_t getTreeSize();
+
+    /**
+     * @brief Сообщает подписчикам о появлении содержимого директории
+     *
+     * Вызывается после переноса директории в другое хранилище: объекты
+     * переезжают вместе с ней, и индекс поиска и статистика целевого
+     * хранилища должны узнать о каждом. Родитель сообщается раньше потомков.
+     */
+    void notifyContentAdded();
+
+    /**
+     * @brief Копирует объект и, для директорий, их содержимое
+     * @param target Целевая директория
+     * @param onDevice Копировать файлы средствами устройства
+     * @param doneBytes Объем, обработанный до этого объекта; увеличивается по ходу
+     * @param transfer Дескриптор передачи (может быть nullptr)
+     * @return ID копии или 0 в случае ошибки
+     */
+    uint32_t copyRecursive(const std::shared_ptr<MtpDirectory>& target, bool onDevice,
+                           uint64_t& doneBytes, MtpTransfer* transfer);
+
+    /**
+     * @brief Копирует файл командой CopyObject
+     * @param target Целевая директория
+     * @return ID копии или 0 в случае ошибки
+     */
+    uint32_t copyOnDevice(const std::shared_ptr<MtpDirectory>& target);
+
+    /**
+     * @brief Копирует файл чтением во временный файл и повторной отправкой
+     * @param target Целевая директория
+     * @param doneBytes Объем, обработанный до этого файла; увеличивается по ходу
+     * @param transfer Дескриптор передачи (может быть nullptr)
+     * @return ID копии или 0 в случае ошибки
+     */
+    uint32_t streamCopy(const std::shared_ptr<MtpDirectory>& target, uint64_t& doneBytes, MtpTransfer* transfer);
+
+    /**
+     * @brief Разрешает ссылку на устройство; вызывается в потоке планировщика
+     * @return Указатель на устройство или nullptr, если устройство отключено
+     *         (тогда сообщение об ошибке уже сохранено)
+     */
+    LIBMTP_mtpdevice_t* resolveDevice();
+
+    /**
+     * @brief Сохраняет сообщение об ошибке из стека ошибок libmtp
+     * @param fallback Сообщение, если стек ошибок пуст
+     */
+    void captureError(const std::string& fallback);
+
+    MtpDeviceHandle m_device;         ///< Ссылка на устройство
     uint32_t m_id;                    ///< ID файла
     uint32_t m_parentId;              ///< ID родительской директории
     uint32_t m_storageId;             ///< ID хранилища
     std::string m_name;               ///< Имя файла
     uint64_t m_size;                  ///< Размер файла
+    LIBMTP_filetype_t m_type;         ///< Тип файла
+    time_t m_modificationDate;        ///< Время последнего изменения
     mutable std::string m_lastError;  ///< Последнее сообщение об ошибке
+    std::shared_ptr<MtpObjectNotifier> m_notifier; ///< Рассыльщик уведомлений об изменениях
+    std::shared_ptr<MtpCommandScheduler> m_scheduler; ///< Планировщик команд устройства
+    std::shared_ptr<MtpListingCache> m_listings;      ///< Кэш содержимого директорий
 };
 
 #endif // MTP_FILE_H
\ No newline at end of file
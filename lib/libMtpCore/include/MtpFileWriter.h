@@ -0,0 +1,192 @@
+#ifndef MTP_FILE_WRITER_H
+#define MTP_FILE_WRITER_H
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Режим сброса данных на диск
+ */
+enum class MtpSyncMode {
+    None,           ///< Сброс оставляется системе
+    WriteBehind,    ///< Запись на диск запускается сразу за каждым блоком (sync_file_range), кэш страниц не засоряется
+    Durable         ///< Как WriteBehind, плюс fdatasync перед переименованием
+};
+
+/**
+ * @brief Параметры записи файла
+ */
+struct MtpFileWriterOptions {
+    size_t blockSize = 8 * 1024 * 1024;             ///< Размер блока записи (кратен 4 КиБ)
+    size_t queueDepth = 3;                          ///< Сколько заполненных блоков может ждать записи
+    MtpSyncMode syncMode = MtpSyncMode::WriteBehind; ///< Режим сброса на диск
+    bool preallocate = true;                        ///< Резервировать место под файл заранее
+};
+
+/**
+ * @brief Запись скачиваемого файла на локальный диск
+ *
+ * Данные пишутся во временный файл рядом с целевым. Место под файл
+ * резервируется заранее по известному размеру, а запись идет
+ * крупными выровненными блоками из общего пула буферов в отдельном
+ * потоке, поэтому чтение с устройства не ждет диск. После commit()
+ * временный файл атомарно переименовывается в целевой; при ошибке
+ * или abort() он удаляется, и неполных файлов не остается.
+ */
+class MtpFileWriter {
+public:
+    /**
+     * @brief Конструктор
+     * @param path Путь к целевому файлу
+     * @param expectedSize Ожидаемый размер файла (0 если неизвестен)
+     * @param options Параметры записи
+     */
+    MtpFileWriter(const std::string& path, uint64_t expectedSize = 0,
+                  const MtpFileWriterOptions& options = MtpFileWriterOptions());
+
+    /**
+     * @brief Деструктор; удаляет временный файл, если не было commit()
+     */
+    ~MtpFileWriter();
+
+    MtpFileWriter(const MtpFileWriter&) = delete;
+    MtpFileWriter& operator=(const MtpFileWriter&) = delete;
+
+    /**
+     * @brief Создает временный файл и запускает поток записи
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool open();
+
+    /**
+     * @brief Продолжает запись, начатую раньше и прерванную suspend()
+     *
+     * Открывает оставшийся временный файл и отбрасывает все после offset.
+     * Данные до offset должны быть записаны на диск (см. suspend()).
+     * @param offset Количество уже записанных байт
+     * Если на диске не хватает места под резервирование, временный
+     * файл остается на месте, и resume() можно повторить позже.
+     * @return true в случае успеха, false если временного файла нет, он короче offset
+     *         или не хватает места
+     */
+    bool resume(uint64_t offset);
+
+    /**
+     * @brief Добавляет данные в конец файла
+     *
+     * Данные копируются в текущий блок; заполненный блок передается
+     * потоку записи. Если очередь заполнена, вызов ждет диск.
+     * @param data Данные
+     * @param length Длина данных
+     * @return true в случае успеха, false если запись на диск не удалась
+     */
+    bool write(const unsigned char* data, size_t length);
+
+    /**
+     * @brief Дописывает оставшиеся данные и переименовывает файл в целевой
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool commit();
+
+    /**
+     * @brief Прерывает запись, сохраняя временный файл для resume()
+     *
+     * Дописывает принятые данные и сбрасывает их на диск, поэтому после
+     * успешного вызова getBytesWritten() байт переживают и сбой системы.
+     * @return true в случае успеха, false если запись не удалась (тогда
+     *         временный файл удален)
+     */
+    bool suspend();
+
+    /**
+     * @brief Прерывает запись и удаляет временный файл
+     */
+    void abort();
+
+    /**
+     * @brief Получает количество принятых байт
+     * @return Количество байт
+     */
+    uint64_t getBytesWritten() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    /**
+     * @brief Блок данных, ожидающий записи
+     */
+    struct Block {
+        unsigned char* data = nullptr;  ///< Буфер из пула
+        size_t length = 0;              ///< Заполненная часть буфера
+        uint64_t offset = 0;            ///< Смещение блока в файле
+    };
+
+    /**
+     * @brief Открывает временный файл и запускает поток записи
+     * @param flags Флаги open()
+     * @param offset Смещение, с которого продолжается запись
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool start(int flags, uint64_t offset);
+
+    /**
+     * @brief Основной цикл потока записи
+     */
+    void run();
+
+    /**
+     * @brief Пишет блок на диск
+     * @param block Блок
+     * @return true в случае успеха
+     */
+    bool writeBlock(const Block& block);
+
+    /**
+     * @brief Передает текущий блок потоку записи
+     * @return true если поток записи не сообщал об ошибке
+     */
+    bool submitCurrent();
+
+    /**
+     * @brief Останавливает поток записи
+     * @param discard Отбросить блоки, ожидающие записи
+     */
+    void stopThread(bool discard);
+
+    /**
+     * @brief Сохраняет сообщение об ошибке с описанием errno
+     * @param message Сообщение
+     */
+    void setError(const std::string& message);
+
+private:
+    std::string m_path;                 ///< Путь к целевому файлу
+    std::string m_tempPath;             ///< Путь к временному файлу
+    uint64_t m_expectedSize;            ///< Ожидаемый размер файла
+    MtpFileWriterOptions m_options;     ///< Параметры записи
+    int m_fd;                           ///< Дескриптор временного файла
+    bool m_preallocated;                ///< Место под файл зарезервировано
+    Block m_current;                    ///< Заполняемый блок
+    uint64_t m_bytesWritten;            ///< Принято байт
+    uint64_t m_flushedUpTo;             ///< До этого смещения данные уже на диске (WriteBehind)
+    std::deque<Block> m_queue;          ///< Блоки, ожидающие записи
+    bool m_closing;                     ///< Новых блоков не будет
+    bool m_discard;                     ///< Ожидающие блоки нужно отбросить
+    std::atomic<bool> m_failed;         ///< Поток записи сообщил об ошибке
+    std::thread m_thread;               ///< Поток записи
+    mutable std::mutex m_mutex;         ///< Мьютекс очереди и сообщения об ошибке
+    std::condition_variable m_notEmpty; ///< В очереди появился блок
+    std::condition_variable m_notFull;  ///< В очереди освободилось место
+    std::string m_lastError;            ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_FILE_WRITER_H
@@ -0,0 +1,128 @@
+#ifndef MTP_FOLDER_STATS_H
+#define MTP_FOLDER_STATS_H
+
+#include "MtpTypes.h"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+
+/**
+ * @brief Суммарные размер и количество объектов в поддереве директории
+ */
+struct MtpFolderSize {
+    uint64_t totalSize = 0;     ///< Суммарный размер файлов
+    uint64_t fileCount = 0;     ///< Количество файлов
+    uint64_t folderCount = 0;   ///< Количество вложенных директорий
+};
+
+/**
+ * @brief Размеры и количество объектов директорий хранилища
+ *
+ * Объекты сначала добавляются списком за один проход по хранилищу,
+ * затем recalculate() считает суммы всех директорий за один обход
+ * дерева. После этого каждое добавление, удаление или изменение
+ * объекта обновляет суммы только у его предков, то есть за время,
+ * пропорциональное глубине вложенности.
+ */
+class MtpFolderStats {
+public:
+    /**
+     * @brief Конструктор
+     */
+    MtpFolderStats();
+
+    /**
+     * @brief Очищает статистику
+     */
+    void clear();
+
+    /**
+     * @brief Резервирует место под ожидаемое количество объектов
+     * @param count Количество объектов
+     */
+    void reserve(size_t count);
+
+    /**
+     * @brief Добавляет объект (или обновляет объект с тем же ID)
+     *
+     * До recalculate() объект только запоминается; после - суммы
+     * его предков обновляются сразу.
+     * @param info Сведения об объекте
+     */
+    void add(const MtpObjectInfo& info);
+
+    /**
+     * @brief Удаляет объект и, если это директория, все ее содержимое
+     * @param id ID объекта
+     * @return true если объект был известен
+     */
+    bool remove(uint32_t id);
+
+    /**
+     * @brief Применяет уведомление об изменении объекта
+     * @param change Описание изменения
+     */
+    void applyChange(const MtpObjectChange& change);
+
+    /**
+     * @brief Пересчитывает суммы всех директорий и включает обновление по изменениям
+     */
+    void recalculate();
+
+    /**
+     * @brief Получает суммы для директории
+     * @param folderId ID директории (0 для всего хранилища)
+     * @param result Суммы по поддереву директории
+     * @return true если директория известна и суммы посчитаны
+     */
+    bool getFolderSize(uint32_t folderId, MtpFolderSize& result) const;
+
+    /**
+     * @brief Получает количество известных объектов
+     * @return Количество объектов
+     */
+    size_t size() const;
+
+private:
+    /**
+     * @brief Объект хранилища
+     */
+    struct Node {
+        uint32_t parentId = 0;      ///< ID родительской директории
+        uint64_t size = 0;          ///< Размер файла
+        bool isDirectory = false;   ///< Объект - директория
+        MtpFolderSize total;        ///< Суммы по поддереву (только для директорий)
+    };
+
+    /**
+     * @brief Вклад объекта в суммы его предков
+     * @param node Объект
+     * @return Суммы, которые объект добавляет предкам
+     */
+    static MtpFolderSize contributionOf(const Node& node);
+
+    /**
+     * @brief Прибавляет или вычитает вклад у всех предков, включая корень
+     * @param parentId ID родительской директории
+     * @param delta Вклад
+     * @param add true - прибавить, false - вычесть
+     */
+    void applyToAncestorsLocked(uint32_t parentId, const MtpFolderSize& delta, bool add);
+
+    /**
+     * @brief Удаляет объект из списка детей родителя
+     * @param parentId ID родителя
+     * @param id ID объекта
+     */
+    void detachLocked(uint32_t parentId, uint32_t id);
+
+private:
+    std::unordered_map<uint32_t, Node> m_nodes;                              ///< Объекты по ID
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> m_children;   ///< ID родителя -> ID детей
+    MtpFolderSize m_root;                                                    ///< Суммы по всему хранилищу
+    bool m_ready;                                                            ///< Суммы посчитаны
+    mutable std::mutex m_mutex;                                              ///< Мьютекс для потокобезопасности
+};
+
+#endif // MTP_FOLDER_STATS_H
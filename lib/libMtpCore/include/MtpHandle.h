@@ -0,0 +1,110 @@
+#ifndef MTP_HANDLE_H
+#define MTP_HANDLE_H
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <libmtp.h>
+
+/**
+ * @brief Ссылка на подключенное устройство
+ *
+ * Пара "номер ячейки - поколение" в MtpHandleTable. После отключения
+ * устройства поколение ячейки меняется, и старые ссылки перестают
+ * разрешаться, даже если ячейку занимает уже другое устройство.
+ * Копируется как обычное значение, без счетчиков ссылок.
+ */
+struct MtpDeviceHandle {
+    uint32_t index = 0;         ///< Номер ячейки в таблице
+    uint32_t generation = 0;    ///< Поколение ячейки (0 - пустая ссылка)
+
+    /**
+     * @brief Проверяет, что ссылка не пустая
+     * @return true если ссылка была выдана таблицей
+     */
+    bool isNull() const { return generation == 0; }
+
+    bool operator==(const MtpDeviceHandle& other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const MtpDeviceHandle& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief Центральная таблица подключенных устройств
+ *
+ * Файлы, директории и хранилища хранят MtpDeviceHandle, а указатель
+ * libmtp получают через resolve() непосредственно перед командой.
+ * Разрешение ссылки не берет блокировок и не трогает счетчики ссылок.
+ * Устройство снимается с учета до своего освобождения, поэтому
+ * объекты, пережившие отключение, получают nullptr вместо висячего
+ * указателя.
+ *
+ * Таблица учитывает только устройства. У хранилищ и объектов нет
+ * своих поколений: их ID проверяет само устройство, а MtpFile и
+ * MtpStorage по-прежнему живут в shared_ptr и держат общие с
+ * устройством уведомитель, планировщик и кэш списков.
+ */
+class MtpHandleTable {
+public:
+    /**
+     * @brief Максимальное количество одновременно подключенных устройств
+     */
+    static const uint32_t CAPACITY = 256;
+
+    /**
+     * @brief Сообщение об ошибке для операций с отключенным устройством
+     */
+    static constexpr const char* DISCONNECTED_ERROR = "Device is disconnected";
+
+    /**
+     * @brief Получает общую таблицу
+     * @return Ссылка на таблицу
+     */
+    static MtpHandleTable& instance();
+
+    /**
+     * @brief Регистрирует устройство
+     * @param device Указатель на устройство libmtp
+     * @return Ссылка на устройство или пустая ссылка, если таблица заполнена
+     */
+    MtpDeviceHandle add(LIBMTP_mtpdevice_t* device);
+
+    /**
+     * @brief Снимает устройство с учета; все выданные ссылки устаревают
+     * @param handle Ссылка на устройство
+     */
+    void remove(MtpDeviceHandle handle);
+
+    /**
+     * @brief Разрешает ссылку в указатель libmtp
+     * @param handle Ссылка на устройство
+     * @return Указатель на устройство или nullptr, если ссылка устарела
+     */
+    LIBMTP_mtpdevice_t* resolve(MtpDeviceHandle handle) const;
+
+    /**
+     * @brief Проверяет, что устройство по ссылке еще подключено
+     * @param handle Ссылка на устройство
+     * @return true если ссылка актуальна
+     */
+    bool isValid(MtpDeviceHandle handle) const;
+
+private:
+    MtpHandleTable();
+
+    /**
+     * @brief Ячейка таблицы
+     */
+    struct Slot {
+        std::atomic<uint32_t> generation;               ///< Текущее поколение ячейки
+        std::atomic<LIBMTP_mtpdevice_t*> device;        ///< Устройство или nullptr, если ячейка свободна
+    };
+
+    Slot m_slots[CAPACITY];     ///< Ячейки; таблица не перераспределяется
+    std::mutex m_mutex;         ///< Мьютекс для выдачи и освобождения ячеек
+};
+
+#endif // MTP_HANDLE_H
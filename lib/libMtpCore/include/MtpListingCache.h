@@ -0,0 +1,182 @@
+#ifndef MTP_LISTING_CACHE_H
+#define MTP_LISTING_CACHE_H
+
+#include "MtpTypes.h"
+#include "MtpHandle.h"
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+// Предварительное объявление классов
+class MtpCommandScheduler;
+
+/**
+ * @brief Кэш содержимого директорий хранилища с фоновой предзагрузкой
+ *
+ * После открытия директории пользователь почти всегда переходит в одну
+ * из ее поддиректорий или возвращается к родителю. Кэш заранее
+ * загружает эти списки командами с приоритетом Idle: планировщик берет
+ * их только при пустых очередях Interactive и Bulk, поэтому команда
+ * пользователя ждет не дольше одного уже начатого запроса списка.
+ * Переход в другую директорию отменяет еще не выполненную предзагрузку.
+ *
+ * Записи сбрасываются по уведомлениям об изменениях хранилища и
+ * устаревают через заданное время, так как не все устройства сообщают
+ * событиями об изменениях, сделанных на самом устройстве.
+ */
+class MtpListingCache : public std::enable_shared_from_this<MtpListingCache> {
+public:
+    /**
+     * @brief Максимальное количество директорий в кэше по умолчанию
+     */
+    static const size_t DEFAULT_MAX_ENTRIES = 256;
+
+    /**
+     * @brief Максимальное количество списков, загружаемых после одного перехода, по умолчанию
+     */
+    static const size_t DEFAULT_PREFETCH_LIMIT = 32;
+
+    /**
+     * @brief Время жизни записи по умолчанию, с
+     */
+    static const uint32_t DEFAULT_MAX_AGE = 30;
+
+    /**
+     * @brief Конструктор
+     * @param device Ссылка на устройство
+     * @param storageId ID хранилища
+     * @param scheduler Планировщик команд устройства (без него предзагрузка отключена)
+     */
+    MtpListingCache(MtpDeviceHandle device, uint32_t storageId,
+                    std::shared_ptr<MtpCommandScheduler> scheduler);
+
+    /**
+     * @brief Получает содержимое директории из кэша
+     * @param folderId ID директории (0 для корня хранилища)
+     * @param listing Сведения об объектах директории
+     * @return true если список есть в кэше и не устарел
+     */
+    bool get(uint32_t folderId, std::vector<MtpObjectInfo>& listing);
+
+    /**
+     * @brief Получает версию кэша для последующего put()
+     *
+     * Версия увеличивается при каждом изменении хранилища. Ее нужно
+     * получить до запроса списка, чтобы не сохранить список, который
+     * устарел, пока шел запрос.
+     * @return Текущая версия
+     */
+    uint64_t getVersion() const;
+
+    /**
+     * @brief Сохраняет содержимое директории
+     * @param folderId ID директории
+     * @param listing Сведения об объектах директории
+     * @param version Версия, полученная до запроса списка
+     */
+    void put(uint32_t folderId, const std::vector<MtpObjectInfo>& listing, uint64_t version);
+
+    /**
+     * @brief Запускает фоновую загрузку поддиректорий и цепочки родителей
+     *
+     * Отменяет предзагрузку, запущенную предыдущим вызовом.
+     * @param folderId ID открытой директории
+     * @param parentId ID ее родительской директории
+     * @param listing Содержимое открытой директории
+     */
+    void prefetch(uint32_t folderId, uint32_t parentId, const std::vector<MtpObjectInfo>& listing);
+
+    /**
+     * @brief Применяет уведомление об изменении объекта
+     * @param change Описание изменения
+     */
+    void applyChange(const MtpObjectChange& change);
+
+    /**
+     * @brief Очищает кэш и отменяет предзагрузку
+     */
+    void clear();
+
+    /**
+     * @brief Устанавливает время жизни записи
+     * @param seconds Время в секундах (0 отключает кэш)
+     */
+    void setMaxAge(uint32_t seconds);
+
+    /**
+     * @brief Устанавливает количество списков, загружаемых после одного перехода
+     * @param count Количество списков (0 отключает предзагрузку)
+     */
+    void setPrefetchLimit(size_t count);
+
+    /**
+     * @brief Получает количество запросов, обслуженных из кэша
+     * @return Количество запросов
+     */
+    uint64_t getHitCount() const;
+
+    /**
+     * @brief Получает количество списков, загруженных в фоне
+     * @return Количество списков
+     */
+    uint64_t getPrefetchCount() const;
+
+private:
+    /**
+     * @brief Содержимое одной директории
+     */
+    struct Entry {
+        std::vector<MtpObjectInfo> listing;                 ///< Сведения об объектах
+        std::chrono::steady_clock::time_point fetchTime;    ///< Время загрузки
+    };
+
+    /**
+     * @brief Ставит в очередь фоновую загрузку списка
+     * @param generation Поколение предзагрузки
+     * @param folderId ID директории
+     * @param followParents Загрузить после нее и родительскую директорию
+     * @return true если команда поставлена в очередь
+     */
+    bool schedule(uint64_t generation, uint32_t folderId, bool followParents);
+
+    /**
+     * @brief Загружает список директории; выполняется в потоке планировщика
+     * @param generation Поколение предзагрузки
+     * @param folderId ID директории
+     * @param followParents Загрузить после нее и родительскую директорию
+     */
+    void fetchOnDevice(uint64_t generation, uint32_t folderId, bool followParents);
+
+    /**
+     * @brief Проверяет, что запись есть и не устарела
+     * @param folderId ID директории
+     * @return true если запись актуальна
+     */
+    bool isFreshLocked(uint32_t folderId) const;
+
+    /**
+     * @brief Удаляет записи, которые могли измениться вместе с объектом
+     * @param id ID объекта
+     */
+    void invalidateLocked(uint32_t id);
+
+private:
+    MtpDeviceHandle m_device;                           ///< Ссылка на устройство
+    uint32_t m_storageId;                               ///< ID хранилища
+    std::shared_ptr<MtpCommandScheduler> m_scheduler;   ///< Планировщик команд устройства
+    std::unordered_map<uint32_t, Entry> m_entries;      ///< Содержимое директорий по ID
+    std::unordered_map<uint32_t, uint32_t> m_parents;   ///< ID директории -> ID ее родителя
+    uint64_t m_version;                                 ///< Версия; растет при изменениях
+    uint64_t m_generation;                              ///< Поколение текущей предзагрузки
+    size_t m_budget;                                    ///< Сколько еще списков можно загрузить в этом поколении
+    std::chrono::seconds m_maxAge;                      ///< Время жизни записи
+    size_t m_prefetchLimit;                             ///< Списков на один переход
+    uint64_t m_hitCount;                                ///< Запросов, обслуженных из кэша
+    uint64_t m_prefetchCount;                           ///< Списков, загруженных в фоне
+    mutable std::mutex m_mutex;                         ///< Мьютекс для потокобезопасности
+};
+
+#endif // MTP_LISTING_CACHE_H
@@ -0,0 +1,54 @@
+#ifndef MTP_OBJECT_NOTIFIER_H
+#define MTP_OBJECT_NOTIFIER_H
+
+#include "MtpTypes.h"
+#include <vector>
+#include <functional>
+#include <mutex>
+
+/**
+ * @brief Рассыльщик уведомлений об изменениях объектов хранилища
+ *
+ * Один экземпляр разделяется хранилищем и всеми созданными им
+ * файлами и директориями, поэтому любые изменения, сделанные через
+ * библиотеку, доходят до подписчиков (индексов, кэшей, ViewModel).
+ */
+class MtpObjectNotifier {
+public:
+    /**
+     * @brief Тип функции обратного вызова для уведомлений об изменениях объектов
+     */
+    using ObjectChangeCallback = std::function<void(const MtpObjectChange&)>;
+
+    /**
+     * @brief Конструктор
+     */
+    MtpObjectNotifier();
+
+    /**
+     * @brief Регистрирует функцию обратного вызова
+     * @param callback Функция обратного вызова
+     * @return ID зарегистрированного обратного вызова
+     */
+    int registerCallback(ObjectChangeCallback callback);
+
+    /**
+     * @brief Удаляет функцию обратного вызова по ID
+     * @param callbackId ID функции обратного вызова
+     * @return true если функция обратного вызова успешно удалена
+     */
+    bool unregisterCallback(int callbackId);
+
+    /**
+     * @brief Рассылает уведомление всем подписчикам
+     * @param change Описание изменения
+     */
+    void notify(const MtpObjectChange& change) const;
+
+private:
+    std::vector<std::pair<int, ObjectChangeCallback>> m_callbacks; ///< Список функций обратного вызова
+    int m_nextCallbackId;                                          ///< ID для следующей функции обратного вызова
+    mutable std::mutex m_mutex;                                    ///< Мьютекс для потокобезопасности
+};
+
+#endif // MTP_OBJECT_NOTIFIER_H
@@ -0,0 +1,107 @@
+#ifndef MTP_SEARCH_INDEX_H
+#define MTP_SEARCH_INDEX_H
+
+#include "MtpTypes.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+/**
+ * @brief Параметры поиска по индексу хранилища
+ *
+ * К условиям отбора по свойствам добавляются условия на имя.
+ * Все заданные условия объединяются по "И". Пустые строки и
+ * значения по умолчанию означают отсутствие ограничения.
+ */
+struct MtpSearchQuery : MtpObjectFilter {
+    std::string substring;                                     ///< Подстрока имени (без учета регистра)
+    std::string glob;                                          ///< Шаблон имени: *, ? и [...] (без учета регистра)
+};
+
+/**
+ * @brief Поисковый индекс имен и атрибутов объектов хранилища
+ *
+ * Хранит объекты в столбцах (имя, размер, тип, дата) и строит
+ * триграммный индекс по именам в нижнем регистре. Поиск подстроки
+ * и шаблона сначала пересекает списки триграмм, а затем проверяет
+ * только оставшихся кандидатов. Удаление помечает строку как
+ * удаленную; место освобождается при периодическом уплотнении.
+ */
+class MtpSearchIndex {
+public:
+    /**
+     * @brief Конструктор
+     */
+    MtpSearchIndex();
+
+    /**
+     * @brief Очищает индекс
+     */
+    void clear();
+
+    /**
+     * @brief Резервирует место под ожидаемое количество объектов
+     * @param count Количество объектов
+     */
+    void reserve(size_t count);
+
+    /**
+     * @brief Добавляет объект (или заменяет объект с тем же ID)
+     * @param info Сведения об объекте
+     */
+    void add(const MtpObjectInfo& info);
+
+    /**
+     * @brief Удаляет объект и, если это директория, все ее содержимое
+     * @param id ID объекта
+     * @return true если объект был в индексе
+     */
+    bool remove(uint32_t id);
+
+    /**
+     * @brief Применяет уведомление об изменении объекта
+     * @param change Описание изменения
+     */
+    void applyChange(const MtpObjectChange& change);
+
+    /**
+     * @brief Выполняет поиск
+     * @param query Параметры поиска
+     * @return Сведения о найденных объектах в порядке добавления
+     */
+    std::vector<MtpObjectInfo> search(const MtpSearchQuery& query) const;
+
+    /**
+     * @brief Получает количество объектов в индексе
+     * @return Количество объектов
+     */
+    size_t size() const;
+
+private:
+    void addLocked(const MtpObjectInfo& info);
+    bool removeRowLocked(uint32_t row);
+    void compactLocked();
+    MtpObjectInfo rowInfoLocked(uint32_t row) const;
+    bool matchesAttributesLocked(uint32_t row, const MtpSearchQuery& query) const;
+    bool candidatesForLocked(const std::string& literal, std::vector<uint32_t>& rows) const;
+
+private:
+    std::string m_names;                                      ///< Имена объектов подряд
+    std::string m_lowerNames;                                 ///< Те же имена в нижнем регистре
+    std::vector<uint32_t> m_nameOffsets;                      ///< Смещения имен
+    std::vector<uint32_t> m_nameLengths;                      ///< Длины имен
+    std::vector<uint32_t> m_ids;                              ///< ID объектов
+    std::vector<uint32_t> m_parentIds;                        ///< ID родительских директорий
+    std::vector<uint32_t> m_storageIds;                       ///< ID хранилищ
+    std::vector<uint64_t> m_sizes;                            ///< Размеры
+    std::vector<LIBMTP_filetype_t> m_types;                   ///< Типы
+    std::vector<time_t> m_dates;                              ///< Даты изменения
+    std::vector<uint8_t> m_alive;                             ///< Признак актуальности строки
+    std::unordered_map<uint32_t, uint32_t> m_rowById;         ///< ID объекта -> номер строки
+    std::unordered_map<uint32_t, std::vector<uint32_t>> m_trigrams; ///< Триграмма -> номера строк
+    size_t m_deadRows;                                        ///< Количество удаленных строк
+    mutable std::mutex m_mutex;                               ///< Мьютекс для потокобезопасности
+};
+
+#endif // MTP_SEARCH_INDEX_H
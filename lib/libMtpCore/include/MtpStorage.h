@@ -4,11 +4,22 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <functional>
+#include <mutex>
 #include <libmtp.h>
+#include "MtpTypes.h"
+#include "MtpHandle.h"
 
 // Предварительное объявление классов
 class MtpFile;
 class MtpDirectory;
+class MtpObjectNotifier;
+class MtpSearchIndex;
+class MtpFolderStats;
+class MtpListingCache;
+class MtpCommandScheduler;
+struct MtpSearchQuery;
+struct MtpFolderSize;
 
 /**
  * @brief Представление хранилища MTP-устройства
@@ -20,10 +31,12 @@ class MtpStorage {
 public:
     /**
      * @brief Конструктор
-     * @param device Указатель на устройство libmtp
-     * @param storage Указатель на хранилище libmtp
+     * @param device Ссылка на устройство
+     * @param storage Хранилище libmtp; свойства копируются, указатель не сохраняется
+     * @param scheduler Планировщик команд устройства (может быть nullptr)
      */
-    MtpStorage(LIBMTP_mtpdevice_t* device, LIBMTP_devicestorage_t* storage);
+    MtpStorage(MtpDeviceHandle device, const LIBMTP_devicestorage_t* storage,
+               std::shared_ptr<MtpCommandScheduler> scheduler = nullptr);
 
     /**
      * @brief Деструктор
@@ -36,6 +49,18 @@ public:
      */
     uint32_t getId() const;
 
+    /**
+     * @brief Получает ссылку на устройство хранилища
+     * @return Ссылка на устройство
+     */
+    MtpDeviceHandle getDeviceHandle() const;
+
+    /**
+     * @brief Проверяет, подключено ли еще устройство хранилища
+     * @return true если устройство подключено
+     */
+    bool isValid() const;
+
     /**
      * @brief Получает описание хранилища
      * @return Строка с описанием хранилища
@@ -54,6 +79,15 @@ public:
      */
     uint64_t getFreeSpace() const;
 
+    /**
+     * @brief Обновляет свойства хранилища (описание, объем)
+     *
+     * Вызывается устройством при обновлении списка хранилищ; объект
+     * хранилища при этом сохраняется вместе с индексом и подписчиками.
+     * @param storage Хранилище libmtp с тем же ID
+     */
+    void update(const LIBMTP_devicestorage_t* storage);
+
     /**
      * @brief Получает корневую директорию хранилища
      * @return Умный указатель на корневую директорию
@@ -89,6 +123,204 @@ public:
      */
     bool deleteObject(uint32_t id);
 
+    /**
+     * @brief Переименовывает файл или директорию
+     * @param id ID объекта
+     * @param name Новое имя
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool renameObject(uint32_t id, const std::string& name);
+
+    /**
+     * @brief Перемещает файл или директорию внутри хранилища
+     *
+     * Для перемещения в другое хранилище используется MtpFile::moveTo().
+     * @param id ID объекта
+     * @param parentId ID новой родительской директории (0 для корневой директории)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool moveObject(uint32_t id, uint32_t parentId);
+
+    /**
+     * @brief Копирует файл или директорию внутри хранилища
+     * @param id ID объекта
+     * @param parentId ID директории для копии (0 для корневой директории)
+     * @return ID копии или 0 в случае ошибки
+     */
+    uint32_t copyObject(uint32_t id, uint32_t parentId);
+
+    /**
+     * @brief Тип функции, вызываемой для каждого объекта при обходе хранилища
+     */
+    using ObjectVisitor = std::function<void(const MtpObjectInfo&)>;
+
+    /**
+     * @brief Обходит все объекты поддерева за один проход
+     *
+     * Директории перечисляются раньше своего содержимого.
+     * @param visitor Функция, вызываемая для каждого объекта
+     * @param parentId ID директории, с которой начинается обход (0 для корневой директории)
+     * @return true в случае успеха, false если часть поддерева прочитать не удалось
+     */
+    bool enumerateObjects(const ObjectVisitor& visitor, uint32_t parentId = 0);
+
+    /**
+     * @brief Тип функции обратного вызова для отображения хода обхода
+     *
+     * Получает количество обработанных объектов и их общее число
+     * (при обходе по директориям общее число заранее неизвестно и
+     * совпадает с количеством уже обработанных объектов).
+     * Возврат false прерывает обход.
+     */
+    using EnumerationProgressCallback = std::function<bool(uint64_t processed, uint64_t total)>;
+
+    /**
+     * @brief Устанавливает способ обхода всего хранилища
+     * @param mode Способ обхода
+     */
+    void setEnumerationMode(MtpEnumerationMode mode);
+
+    /**
+     * @brief Получает способ обхода всего хранилища
+     * @return Способ обхода
+     */
+    MtpEnumerationMode getEnumerationMode() const;
+
+    /**
+     * @brief Обходит все объекты хранилища
+     *
+     * В пакетном режиме libmtp получает описание всех объектов устройства
+     * за один проход (GetObjPropList, если устройство его поддерживает),
+     * а дерево директорий строится из того же кэша. Если пакетный обход
+     * не удался, в режиме Auto выполняется обход по директориям; прерванный
+     * функцией хода обход не повторяется.
+     * Директории перечисляются раньше своего содержимого.
+     * @param visitor Функция, вызываемая для каждого объекта
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @return true в случае успеха, false в случае ошибки или прерывания
+     */
+    bool enumerateAll(const ObjectVisitor& visitor, EnumerationProgressCallback progress = nullptr);
+
+    /**
+     * @brief Обходит объекты, подходящие под условия отбора
+     *
+     * Условия проверяются по мере получения списков, поэтому неподходящие
+     * объекты не накапливаются в памяти. Для всего хранилища используется
+     * enumerateAll, для поддерева - enumerateObjects. Время изменения
+     * директорий при пакетном обходе неизвестно, поэтому при ограничении
+     * по дате директории в результат не попадают.
+     * @param filter Условия отбора
+     * @param visitor Функция, вызываемая для каждого подходящего объекта
+     * @param parentId ID директории, с которой начинается обход (0 для всего хранилища)
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool queryObjects(const MtpObjectFilter& filter, const ObjectVisitor& visitor, uint32_t parentId = 0);
+
+    /**
+     * @brief Находит файлы и директории, подходящие под условия отбора
+     *
+     * Объекты MtpFile создаются только для подходящих записей.
+     * @param filter Условия отбора
+     * @param parentId ID директории, с которой начинается обход (0 для всего хранилища)
+     * @return Вектор умных указателей на найденные объекты
+     */
+    std::vector<std::shared_ptr<MtpFile>> query(const MtpObjectFilter& filter, uint32_t parentId = 0);
+
+    /**
+     * @brief Строит поисковый индекс по всему хранилищу
+     *
+     * После построения индекс автоматически обновляется при изменениях,
+     * сделанных через библиотеку (создание, удаление, отправка файлов).
+     * Если обход не завершен, прежний индекс остается в силе.
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @return true в случае успеха, false в случае ошибки или прерывания
+     */
+    bool buildSearchIndex(EnumerationProgressCallback progress = nullptr);
+
+    /**
+     * @brief Ищет объекты по всему хранилищу
+     *
+     * При первом вызове строит поисковый индекс; если построить его
+     * не удалось, возвращает пустой результат и повторяет попытку при
+     * следующем вызове.
+     * @param query Параметры поиска
+     * @return Сведения о найденных объектах
+     */
+    std::vector<MtpObjectInfo> search(const MtpSearchQuery& query);
+
+    /**
+     * @brief Получает поисковый индекс хранилища
+     * @return Умный указатель на индекс или nullptr, если индекс не построен
+     */
+    std::shared_ptr<MtpSearchIndex> getSearchIndex() const;
+
+    /**
+     * @brief Считает размеры и количество объектов всех директорий хранилища
+     *
+     * Выполняет один обход хранилища. После этого суммы обновляются
+     * при изменениях, сделанных через библиотеку, только у предков
+     * измененного объекта. Если обход не завершен, прежняя статистика
+     * остается в силе.
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @return true в случае успеха, false в случае ошибки или прерывания
+     */
+    bool buildFolderStats(EnumerationProgressCallback progress = nullptr);
+
+    /**
+     * @brief Получает суммарный размер и количество объектов директории
+     *
+     * При первом вызове считает статистику по всему хранилищу; если
+     * обход не завершен, возвращает false с его ошибкой и повторяет
+     * подсчет при следующем вызове.
+     * @param folderId ID директории (0 для всего хранилища)
+     * @param result Суммы по поддереву директории
+     * @return true в случае успеха, false если директория неизвестна или подсчет не удался
+     */
+    bool getFolderSize(uint32_t folderId, MtpFolderSize& result);
+
+    /**
+     * @brief Получает статистику директорий хранилища
+     * @return Умный указатель на статистику или nullptr, если она не посчитана
+     */
+    std::shared_ptr<MtpFolderStats> getFolderStats() const;
+
+    /**
+     * @brief Получает кэш содержимого директорий хранилища
+     *
+     * Кэш разделяется всеми директориями, созданными хранилищем; через
+     * него настраиваются время жизни списков и фоновая предзагрузка.
+     * @return Умный указатель на кэш
+     */
+    std::shared_ptr<MtpListingCache> getListingCache() const;
+
+    /**
+     * @brief Тип функции обратного вызова для уведомлений об изменениях объектов
+     */
+    using ObjectChangeCallback = std::function<void(const MtpObjectChange&)>;
+
+    /**
+     * @brief Регистрирует функцию обратного вызова для уведомлений об изменениях объектов
+     * @param callback Функция обратного вызова
+     * @return ID зарегистрированного обратного вызова
+     */
+    int registerObjectChangeCallback(ObjectChangeCallback callback);
+
+    /**
+     * @brief Удаляет функцию обратного вызова по ID
+     * @param callbackId ID функции обратного вызова
+     * @return true если функция обратного вызова успешно удалена
+     */
+    bool unregisterObjectChangeCallback(int callbackId);
+
+    /**
+     * @brief Рассылает уведомление об изменении объекта
+     *
+     * Используется устройством для изменений, о которых оно сообщило событием.
+     * @param type Вид изменения
+     * @param info Сведения об объекте
+     */
+    void notifyObjectChange(MtpObjectChangeType type, const MtpObjectInfo& info);
+
     /**
      * @brief Получает последнее сообщение об ошибке
      * @return Строка с сообщением об ошибке
@@ -96,9 +328,79 @@ public:
     std::string getLastError() const;
 
 private:
-    LIBMTP_mtpdevice_t* m_device;         ///< Указатель на устройство libmtp
-    LIBMTP_devicestorage_t* m_storage;    ///< Указатель на хранилище libmtp
+    /**
+     * @brief Разрешает ссылку на устройство; вызывается в потоке планировщика
+     * @return Указатель на устройство или nullptr, если устройство отключено
+     */
+    LIBMTP_mtpdevice_t* resolveDevice();
+
+    /**
+     * @brief Сохраняет сообщение об ошибке из стека ошибок libmtp
+     * @param fallback Сообщение, если стек ошибок пуст
+     */
+    void captureError(const std::string& fallback);
+
+    /**
+     * @brief Строит структуру по полному обходу хранилища и устанавливает ее
+     *
+     * Подписывает структуру на изменения до обхода, затем передает ей все
+     * объекты хранилища. Структура и подписка заменяют прежние, только
+     * если обход завершен полностью.
+     * @param installed Место установки структуры
+     * @param callbackId ID подписки установленной структуры
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @param finish Действие над заполненной структурой перед установкой (может быть пустым)
+     * @return true если обход завершен и структура установлена
+     */
+    template <typename Target>
+    bool buildFromEnumeration(std::shared_ptr<Target>& installed, int& callbackId,
+                              const EnumerationProgressCallback& progress,
+                              const std::function<void(Target&)>& finish);
+
+    /**
+     * @brief Получает директорию по ID
+     * @param id ID директории (0 для корневой директории)
+     * @return Директория или nullptr, если объект не найден или не является директорией
+     */
+    std::shared_ptr<MtpDirectory> getDirectoryById(uint32_t id);
+
+    /**
+     * @brief Обходит хранилище одним пакетным запросом libmtp
+     * @param visitor Функция, вызываемая для каждого объекта
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @param cancelled Устанавливается в true, если обход прерван функцией хода
+     * @return true в случае успеха, false если пакетный обход не удался или прерван
+     */
+    bool enumerateBulk(const ObjectVisitor& visitor, const EnumerationProgressCallback& progress,
+                       bool& cancelled);
+
+    /**
+     * @brief Пакетный обход; выполняется в потоке планировщика устройства
+     * @param visitor Функция, вызываемая для каждого объекта
+     * @param progress Функция отображения хода обхода (может быть пустой)
+     * @param cancelled Устанавливается в true, если обход прерван функцией хода
+     * @return true в случае успеха, false если пакетный обход не удался или прерван
+     */
+    bool enumerateBulkOnDevice(const ObjectVisitor& visitor, const EnumerationProgressCallback& progress,
+                               bool& cancelled);
+
+private:
+    MtpDeviceHandle m_device;             ///< Ссылка на устройство
+    uint32_t m_id;                        ///< ID хранилища
+    std::string m_description;            ///< Описание хранилища
+    uint64_t m_maxCapacity;               ///< Общий объем
+    uint64_t m_freeSpace;                 ///< Свободный объем
+    mutable std::mutex m_propertiesMutex; ///< Мьютекс свойств хранилища
     mutable std::string m_lastError;      ///< Последнее сообщение об ошибке
+    std::shared_ptr<MtpObjectNotifier> m_notifier;    ///< Рассыльщик уведомлений об изменениях
+    std::shared_ptr<MtpCommandScheduler> m_scheduler; ///< Планировщик команд устройства
+    std::shared_ptr<MtpSearchIndex> m_searchIndex;    ///< Поисковый индекс (строится по запросу)
+    int m_searchIndexCallbackId;                      ///< ID подписки индекса на изменения
+    std::shared_ptr<MtpFolderStats> m_folderStats;    ///< Размеры директорий (считаются по запросу)
+    int m_folderStatsCallbackId;                      ///< ID подписки статистики на изменения
+    std::shared_ptr<MtpListingCache> m_listings;      ///< Кэш содержимого директорий
+    int m_listingsCallbackId;                         ///< ID подписки кэша на изменения
+    MtpEnumerationMode m_enumerationMode;             ///< Способ обхода всего хранилища
 };
 
 #endif // MTP_STORAGE_H
\ No newline at end of file
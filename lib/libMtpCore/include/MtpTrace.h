@@ -0,0 +1,179 @@
+#ifndef MTP_TRACE_H
+#define MTP_TRACE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include <libmtp.h>
+
+/**
+ * @brief Операция, записанная в трассу
+ */
+enum class MtpTraceOp : uint8_t {
+    Open = 1,           ///< Открытие устройства (описание сырого устройства)
+    GetFriendlyName,    ///< LIBMTP_Get_Friendlyname
+    GetManufacturer,    ///< LIBMTP_Get_Manufacturername
+    GetModelName,       ///< LIBMTP_Get_Modelname
+    GetSerialNumber,    ///< LIBMTP_Get_Serialnumber
+    GetDeviceVersion,   ///< LIBMTP_Get_Deviceversion
+    GetStorage,         ///< LIBMTP_Get_Storage
+    CheckCapability,    ///< LIBMTP_Check_Capability
+    GetFileMetadata,    ///< LIBMTP_Get_Filemetadata
+    GetFilesAndFolders, ///< LIBMTP_Get_Files_And_Folders
+    GetFileListing,     ///< LIBMTP_Get_Filelisting_With_Callback
+    GetFolderList,      ///< LIBMTP_Get_Folder_List_For_Storage
+    GetFile,            ///< LIBMTP_Get_File_To_Handler
+    GetPartialObject,   ///< LIBMTP_GetPartialObject
+    SendFile,           ///< LIBMTP_Send_File_From_File и LIBMTP_Send_File_From_Handler
+    CreateFolder,       ///< LIBMTP_Create_Folder
+    DeleteObject,       ///< LIBMTP_Delete_Object
+    SetFileName,        ///< LIBMTP_Set_File_Name
+    MoveObject,         ///< LIBMTP_Move_Object
+    CopyObject          ///< LIBMTP_Copy_Object
+};
+
+/**
+ * @brief Объект в ответе устройства
+ */
+struct MtpTraceEntry {
+    uint32_t id = 0;                ///< ID объекта
+    uint32_t parentId = 0;          ///< ID родительской директории
+    uint32_t storageId = 0;         ///< ID хранилища
+    uint64_t size = 0;              ///< Размер
+    int64_t modificationDate = 0;   ///< Время изменения
+    uint32_t type = 0;              ///< Тип libmtp (LIBMTP_filetype_t)
+    std::string name;               ///< Имя
+};
+
+/**
+ * @brief Хранилище в ответе устройства
+ */
+struct MtpTraceStorage {
+    uint32_t id = 0;                ///< ID хранилища
+    uint32_t storageType = 0;       ///< Тип хранилища
+    uint32_t filesystemType = 0;    ///< Тип файловой системы
+    uint32_t accessCapability = 0;  ///< Права доступа
+    uint64_t maxCapacity = 0;       ///< Общий объем
+    uint64_t freeSpace = 0;         ///< Свободный объем
+    uint64_t freeObjects = 0;       ///< Сколько объектов еще можно создать
+    std::string description;        ///< Описание
+    std::string volumeIdentifier;   ///< Идентификатор тома
+};
+
+/**
+ * @brief Запись трассы: одна команда устройству и ответ на нее
+ */
+struct MtpTraceRecord {
+    MtpTraceOp op = MtpTraceOp::Open;       ///< Операция
+    uint32_t device = 0;                    ///< Номер устройства в трассе
+    uint64_t startUs = 0;                   ///< Начало команды от начала записи, мкс
+    uint64_t durationUs = 0;                ///< Длительность команды без обработчиков вызывающего, мкс
+    int64_t result = 0;                     ///< Код возврата libmtp (для CreateFolder - ID директории)
+    uint64_t value = 0;                     ///< Дополнительный результат (ID отправленного файла)
+    std::vector<uint64_t> args;             ///< Числовые аргументы команды
+    std::vector<std::string> strings;       ///< Строковые аргументы или результаты
+    std::string error;                      ///< Текст ошибки libmtp
+    std::vector<MtpTraceEntry> entries;     ///< Объекты в ответе
+    std::vector<MtpTraceStorage> storages;  ///< Хранилища в ответе
+    uint64_t payloadSize = 0;               ///< Объем переданных данных
+    bool hasPayload = false;                ///< Данные сохранены в трассе
+    std::string payload;                    ///< Данные (если сохранены)
+};
+
+/**
+ * @brief Запись трассы в файл
+ *
+ * Формат компактный двоичный: заголовок и последовательность
+ * записей, числа кодируются как varint. Записи могут добавляться
+ * из разных потоков.
+ */
+class MtpTraceWriter {
+public:
+    /**
+     * @brief Конструктор
+     */
+    MtpTraceWriter();
+
+    /**
+     * @brief Деструктор; закрывает файл
+     */
+    ~MtpTraceWriter();
+
+    MtpTraceWriter(const MtpTraceWriter&) = delete;
+    MtpTraceWriter& operator=(const MtpTraceWriter&) = delete;
+
+    /**
+     * @brief Создает файл трассы и пишет заголовок
+     * @param path Путь к файлу
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool open(const std::string& path);
+
+    /**
+     * @brief Добавляет запись
+     * @param record Запись
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool write(const MtpTraceRecord& record);
+
+    /**
+     * @brief Сбрасывает буферы и закрывает файл
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool close();
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    FILE* m_file;                   ///< Файл трассы
+    std::string m_buffer;           ///< Буфер кодирования записи
+    mutable std::mutex m_mutex;     ///< Мьютекс файла
+    std::string m_lastError;        ///< Последнее сообщение об ошибке
+};
+
+/**
+ * @brief Чтение файла трассы
+ */
+class MtpTraceReader {
+public:
+    /**
+     * @brief Читает все записи трассы
+     * @param path Путь к файлу
+     * @param records Вектор для записей
+     * @return true в случае успеха, false если файл поврежден или не найден
+     */
+    bool read(const std::string& path, std::vector<MtpTraceRecord>& records);
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    std::string m_lastError;        ///< Последнее сообщение об ошибке
+};
+
+/**
+ * @brief Преобразует список файлов libmtp в объекты трассы
+ * @param files Список файлов
+ * @return Вектор объектов
+ */
+std::vector<MtpTraceEntry> makeTraceEntries(const LIBMTP_file_t* files);
+
+/**
+ * @brief Создает список файлов libmtp по объектам трассы
+ *
+ * Список освобождается вызывающим через LIBMTP_destroy_file_t.
+ * @param entries Объекты
+ * @return Первый элемент списка или nullptr, если объектов нет
+ */
+LIBMTP_file_t* makeLibmtpFiles(const std::vector<MtpTraceEntry>& entries);
+
+#endif // MTP_TRACE_H
@@ -0,0 +1,173 @@
+#ifndef MTP_TRACE_RECORDER_H
+#define MTP_TRACE_RECORDER_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "MtpBackend.h"
+#include "MtpTrace.h"
+
+/**
+ * @brief Параметры записи трассы
+ */
+struct MtpTraceOptions {
+    bool recordPayloads = false;    ///< Сохранять содержимое прочитанных файлов (иначе только объем)
+};
+
+/**
+ * @brief Запись сессии работы с устройством в файл трассы
+ *
+ * Бэкенд-прослойка: передает все команды следующему бэкенду и
+ * сохраняет для каждой аргументы, длительность и ответ устройства
+ * (списки объектов, хранилища, коды возврата и тексты ошибок).
+ * Трасса затем воспроизводится без устройства через MtpTraceReplayer.
+ *
+ * Порядок использования:
+ * @code
+ * auto recorder = std::make_shared<MtpTraceRecorder>();
+ * MtpBackend::install(recorder);
+ * recorder->start("session.mtptrace");
+ * // ... обнаружение устройств и работа с ними ...
+ * recorder->stop();
+ * @endcode
+ */
+class MtpTraceRecorder : public MtpBackend {
+public:
+    /**
+     * @brief Конструктор
+     * @param next Бэкенд, выполняющий команды (по умолчанию - текущий)
+     */
+    explicit MtpTraceRecorder(MtpBackend& next = MtpBackend::instance());
+
+    /**
+     * @brief Деструктор; завершает запись
+     */
+    ~MtpTraceRecorder() override;
+
+    /**
+     * @brief Начинает запись в файл
+     * @param path Путь к файлу трассы
+     * @param options Параметры записи
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool start(const std::string& path, const MtpTraceOptions& options = MtpTraceOptions());
+
+    /**
+     * @brief Завершает запись и закрывает файл
+     * @return true в случае успеха, false если трасса записана не полностью
+     */
+    bool stop();
+
+    /**
+     * @brief Проверяет, идет ли запись
+     * @return true если запись идет
+     */
+    bool isRecording() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+    void deviceOpened(LIBMTP_mtpdevice_t* device, const LIBMTP_raw_device_t& rawDevice) override;
+    void releaseDevice(LIBMTP_mtpdevice_t* device) override;
+    char* getFriendlyname(LIBMTP_mtpdevice_t* device) override;
+    char* getManufacturername(LIBMTP_mtpdevice_t* device) override;
+    char* getModelname(LIBMTP_mtpdevice_t* device) override;
+    char* getSerialnumber(LIBMTP_mtpdevice_t* device) override;
+    char* getDeviceversion(LIBMTP_mtpdevice_t* device) override;
+    int getStorage(LIBMTP_mtpdevice_t* device, int sortBy) override;
+    int checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability) override;
+    LIBMTP_error_t* getErrorstack(LIBMTP_mtpdevice_t* device) override;
+    void clearErrorstack(LIBMTP_mtpdevice_t* device) override;
+    LIBMTP_file_t* getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id) override;
+    LIBMTP_file_t* getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId, uint32_t parentId) override;
+    LIBMTP_file_t* getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                  const void* data) override;
+    LIBMTP_folder_t* getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId) override;
+    int getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                         LIBMTP_progressfunc_t progress, const void* data) override;
+    int getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset, uint32_t maxBytes,
+                         unsigned char** data, unsigned int* size) override;
+    int sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                         LIBMTP_progressfunc_t progress, const void* data) override;
+    int sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                            LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress, const void* data) override;
+    uint32_t createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId, uint32_t storageId) override;
+    int deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id) override;
+    int setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name) override;
+    int moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId) override;
+    int copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId) override;
+    int readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data) override;
+
+private:
+    /**
+     * @brief Заполняет общие поля записи перед выполнением команды
+     * @param device Указатель на устройство libmtp
+     * @param op Операция
+     * @param record Запись
+     * @return true если запись идет и команду нужно сохранить
+     */
+    bool begin(LIBMTP_mtpdevice_t* device, MtpTraceOp op, MtpTraceRecord& record);
+
+    /**
+     * @brief Дописывает длительность и ошибку и сохраняет запись
+     * @param device Указатель на устройство libmtp
+     * @param record Запись
+     * @param failed Команда завершилась ошибкой
+     * @param callbackUs Время в обработчиках данных и хода вызывающего, мкс;
+     *        вычитается из длительности
+     */
+    void finish(LIBMTP_mtpdevice_t* device, MtpTraceRecord& record, bool failed, uint64_t callbackUs = 0);
+
+    /**
+     * @brief Получает номер устройства в трассе, при первом обращении сохраняет запись Open
+     * @param device Указатель на устройство libmtp
+     * @param rawDevice Структура сырого устройства (nullptr, если неизвестна)
+     * @return Номер устройства
+     */
+    uint32_t deviceIndex(LIBMTP_mtpdevice_t* device, const LIBMTP_raw_device_t* rawDevice);
+
+    /**
+     * @brief Записывает команду, возвращающую строку
+     * @param device Указатель на устройство libmtp
+     * @param op Операция
+     * @param method Метод следующего бэкенда
+     * @return Результат метода
+     */
+    char* recordString(LIBMTP_mtpdevice_t* device, MtpTraceOp op,
+                       char* (MtpBackend::*method)(LIBMTP_mtpdevice_t*));
+
+    /**
+     * @brief Записывает отправку файла
+     * @param device Указатель на устройство libmtp
+     * @param metadata Метаданные отправляемого файла
+     * @param send Функция, выполняющая отправку; сообщает объем данных
+     *        и время в обработчиках вызывающего
+     * @return Код возврата libmtp
+     */
+    template <typename Send>
+    int recordSend(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* metadata, Send send);
+
+    /**
+     * @brief Получает время от начала записи
+     * @return Время в микросекундах
+     */
+    uint64_t elapsedUs() const;
+
+private:
+    MtpBackend* m_next;                                 ///< Бэкенд, выполняющий команды
+    MtpTraceWriter m_writer;                            ///< Файл трассы
+    MtpTraceOptions m_options;                          ///< Параметры записи
+    std::atomic<bool> m_recording;                      ///< Идет запись
+    std::chrono::steady_clock::time_point m_startTime;  ///< Начало записи
+    std::map<LIBMTP_mtpdevice_t*, uint32_t> m_devices;  ///< Номера устройств в трассе
+    uint32_t m_nextDevice;                              ///< Номер для следующего устройства
+    mutable std::mutex m_mutex;                         ///< Мьютекс списка устройств и сообщения об ошибке
+    std::string m_lastError;                            ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_TRACE_RECORDER_H
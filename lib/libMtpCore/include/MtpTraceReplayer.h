@@ -0,0 +1,231 @@
+#ifndef MTP_TRACE_REPLAYER_H
+#define MTP_TRACE_REPLAYER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include "MtpBackend.h"
+#include "MtpTrace.h"
+
+// Предварительное объявление классов
+class MtpDevice;
+
+/**
+ * @brief Воспроизведение записанной сессии без устройства
+ *
+ * Создает виртуальное устройство, команды которого обслуживаются
+ * из трассы MtpTraceRecorder с исходными задержками. Команда
+ * ищется по операции и аргументам; повторные одинаковые команды
+ * получают записанные ответы по порядку. Так измененный код,
+ * выдающий команды в другом порядке, получает те же ответы.
+ *
+ * Команды, которых нет в трассе, по возможности достраиваются:
+ * метаданные - по объектам из записанных списков, чтение - нулями
+ * по известному размеру объекта с задержкой по записанной скорости
+ * чтения, создание и удаление - успехом без задержки. Остальные
+ * завершаются ошибкой; их количество возвращает getMissCount().
+ *
+ * Команды к другим устройствам передаются следующему бэкенду.
+ *
+ * Порядок использования:
+ * @code
+ * auto replayer = std::make_shared<MtpTraceReplayer>();
+ * replayer->load("session.mtptrace");
+ * MtpBackend::install(replayer);
+ * std::shared_ptr<MtpDevice> device = replayer->createDevice();
+ * @endcode
+ */
+class MtpTraceReplayer : public MtpBackend {
+public:
+    /**
+     * @brief Сообщение об ошибке для команд, которых нет в трассе
+     */
+    static constexpr const char* NOT_IN_TRACE_ERROR = "Operation is not in trace";
+
+    /**
+     * @brief Конструктор
+     * @param next Бэкенд для команд к другим устройствам (по умолчанию - текущий)
+     */
+    explicit MtpTraceReplayer(MtpBackend& next = MtpBackend::instance());
+
+    /**
+     * @brief Деструктор
+     */
+    ~MtpTraceReplayer() override;
+
+    /**
+     * @brief Загружает трассу
+     * @param path Путь к файлу трассы
+     * @param device Номер устройства в трассе
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool load(const std::string& path, uint32_t device = 0);
+
+    /**
+     * @brief Устанавливает скорость воспроизведения
+     * @param speed Множитель скорости (1 - исходные задержки, 0 - без задержек)
+     */
+    void setSpeed(double speed);
+
+    /**
+     * @brief Создает виртуальное устройство, обслуживаемое трассой
+     *
+     * Воспроизведение должно быть установлено текущим бэкендом.
+     * @return Умный указатель на устройство или nullptr в случае ошибки
+     */
+    std::shared_ptr<MtpDevice> createDevice();
+
+    /**
+     * @brief Получает количество команд, не найденных в трассе
+     * @return Количество команд
+     */
+    uint64_t getMissCount() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+    void releaseDevice(LIBMTP_mtpdevice_t* device) override;
+    char* getFriendlyname(LIBMTP_mtpdevice_t* device) override;
+    char* getManufacturername(LIBMTP_mtpdevice_t* device) override;
+    char* getModelname(LIBMTP_mtpdevice_t* device) override;
+    char* getSerialnumber(LIBMTP_mtpdevice_t* device) override;
+    char* getDeviceversion(LIBMTP_mtpdevice_t* device) override;
+    int getStorage(LIBMTP_mtpdevice_t* device, int sortBy) override;
+    int checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability) override;
+    LIBMTP_error_t* getErrorstack(LIBMTP_mtpdevice_t* device) override;
+    void clearErrorstack(LIBMTP_mtpdevice_t* device) override;
+    LIBMTP_file_t* getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id) override;
+    LIBMTP_file_t* getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId, uint32_t parentId) override;
+    LIBMTP_file_t* getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                  const void* data) override;
+    LIBMTP_folder_t* getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId) override;
+    int getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                         LIBMTP_progressfunc_t progress, const void* data) override;
+    int getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset, uint32_t maxBytes,
+                         unsigned char** data, unsigned int* size) override;
+    int sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                         LIBMTP_progressfunc_t progress, const void* data) override;
+    int sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                            LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress, const void* data) override;
+    uint32_t createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId, uint32_t storageId) override;
+    int deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id) override;
+    int setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name) override;
+    int moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId) override;
+    int copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId) override;
+    int readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data) override;
+
+private:
+    /**
+     * @brief Записанные ответы на одну и ту же команду
+     */
+    struct Responses {
+        std::vector<size_t> records;    ///< Индексы записей в порядке записи
+        size_t next = 0;                ///< Следующий ответ; последний повторяется
+    };
+
+    /**
+     * @brief Состояние виртуального устройства
+     */
+    struct DeviceState {
+        LIBMTP_error_t error = LIBMTP_error_t();    ///< Стек ошибок из одной ошибки
+        std::string errorText;                      ///< Текст ошибки
+        bool hasError = false;                      ///< Стек ошибок не пуст
+    };
+
+    /**
+     * @brief Проверяет, что устройство виртуальное
+     * @param device Указатель на устройство libmtp
+     * @return true если устройство создано этим объектом
+     */
+    bool isReplayDevice(LIBMTP_mtpdevice_t* device) const;
+
+    /**
+     * @brief Ищет ответ на команду
+     * @param op Операция
+     * @param args Числовые аргументы
+     * @param name Строковый аргумент
+     * @return Запись или nullptr, если команды нет в трассе
+     */
+    const MtpTraceRecord* find(MtpTraceOp op, const std::vector<uint64_t>& args,
+                               const std::string& name = std::string());
+
+    /**
+     * @brief Помещает ошибку в стек ошибок виртуального устройства
+     * @param device Указатель на устройство libmtp
+     * @param error Текст ошибки
+     */
+    void setError(LIBMTP_mtpdevice_t* device, const std::string& error);
+
+    /**
+     * @brief Ждет записанную длительность команды с учетом скорости
+     * @param durationUs Длительность, мкс
+     */
+    void wait(uint64_t durationUs) const;
+
+    /**
+     * @brief Оценивает длительность чтения или записи, которой нет в трассе
+     * @param bytes Объем данных
+     * @return Длительность, мкс
+     */
+    uint64_t estimateTransferUs(uint64_t bytes) const;
+
+    /**
+     * @brief Ищет объект среди записанных ответов
+     * @param id ID объекта
+     * @param entry Объект
+     * @return true если объект найден
+     */
+    bool findObject(uint32_t id, MtpTraceEntry& entry) const;
+
+    /**
+     * @brief Отвечает на команду, возвращающую строку
+     * @param device Указатель на устройство libmtp
+     * @param op Операция
+     * @return Строка (освобождается через free()) или nullptr
+     */
+    char* replayString(LIBMTP_mtpdevice_t* device, MtpTraceOp op);
+
+    /**
+     * @brief Отвечает на команду, возвращающую список объектов
+     * @param device Указатель на устройство libmtp
+     * @param record Запись или nullptr, если команды нет в трассе
+     * @return Список объектов или nullptr
+     */
+    LIBMTP_file_t* replayFiles(LIBMTP_mtpdevice_t* device, const MtpTraceRecord* record);
+
+    /**
+     * @brief Принимает данные отправляемого файла и отвечает на команду
+     * @param device Указатель на устройство libmtp
+     * @param metadata Метаданные файла
+     * @param get Источник данных (nullptr, если данные берутся из файла)
+     * @param priv Контекст источника данных
+     * @return Код возврата libmtp
+     */
+    int replaySend(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* metadata, MTPDataGetFunc get, void* priv);
+
+private:
+    MtpBackend* m_next;                                 ///< Бэкенд для других устройств
+    std::vector<MtpTraceRecord> m_records;              ///< Записи трассы выбранного устройства
+    LIBMTP_raw_device_t m_rawDevice;                    ///< Сырое устройство из записи Open
+    std::string m_vendor;                               ///< Производитель из записи Open
+    std::string m_product;                              ///< Модель из записи Open
+    std::map<std::string, Responses> m_responses;       ///< Ответы по ключу команды
+    std::map<uint32_t, MtpTraceEntry> m_objects;        ///< Все объекты из записанных ответов
+    std::map<LIBMTP_mtpdevice_t*, DeviceState> m_devices; ///< Виртуальные устройства
+    uint64_t m_readBytes;                               ///< Прочитано байт в записанной сессии
+    uint64_t m_readUs;                                  ///< Длительность чтения в записанной сессии
+    uint64_t m_commandUs;                               ///< Средняя длительность короткой команды
+    uint32_t m_nextObjectId;                            ///< ID для объектов, созданных при воспроизведении
+    std::atomic<double> m_speed;                        ///< Множитель скорости
+    std::atomic<uint64_t> m_missCount;                  ///< Команд не найдено в трассе
+    mutable std::mutex m_mutex;                         ///< Мьютекс состояния
+    std::string m_lastError;                            ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_TRACE_REPLAYER_H
@@ -0,0 +1,208 @@
+#ifndef MTP_TRANSFER_H
+#define MTP_TRANSFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Состояние передачи файла
+ */
+enum class MtpTransferState {
+    Pending,    ///< Передача еще не начата
+    Running,    ///< Идет передача
+    Completed,  ///< Передача успешно завершена
+    Failed,     ///< Передача завершилась ошибкой
+    Cancelled   ///< Передача отменена
+};
+
+/**
+ * @brief Дескриптор передачи файла
+ *
+ * Создается вызывающей стороной и передается в MtpFile::downloadFile
+ * или MtpDirectory::sendFile. Из любого потока позволяет узнать
+ * объем переданных данных, скорость и оставшееся время, а также
+ * отменить передачу. Счетчики атомарные, поэтому чтение не мешает
+ * передаче; функция обратного вызова вызывается не чаще заданного
+ * интервала.
+ */
+class MtpTransfer {
+public:
+    /**
+     * @brief Тип функции обратного вызова для отображения хода передачи
+     */
+    using ProgressCallback = std::function<void(const MtpTransfer&)>;
+
+    /**
+     * @brief Конструктор
+     */
+    MtpTransfer();
+
+    /**
+     * @brief Устанавливает функцию обратного вызова для отображения хода передачи
+     *
+     * Функция вызывается из потока, начавшего передачу, и никогда из рабочего
+     * потока планировщика. Устанавливать ее следует до начала передачи.
+     * @param callback Функция обратного вызова
+     * @param intervalMs Минимальный интервал между вызовами в миллисекундах
+     */
+    void setProgressCallback(ProgressCallback callback, uint32_t intervalMs = 200);
+
+    /**
+     * @brief Ограничивает скорость передачи
+     *
+     * Темп выдерживается между частями передачи в потоке, начавшем ее;
+     * команда устройства никогда не ждет. Передача одной командой
+     * (отправка файла, чтение без GetPartialObject) внутри команды
+     * не замедляется.
+     * @param bytesPerSecond Максимальная скорость в байтах в секунду (0 - без ограничения)
+     */
+    void setRateLimit(uint64_t bytesPerSecond);
+
+    /**
+     * @brief Запрашивает отмену передачи
+     *
+     * Передача прерывается при ближайшем обращении к счетчикам.
+     */
+    void cancel();
+
+    /**
+     * @brief Проверяет, запрошена ли отмена передачи
+     * @return true если отмена запрошена
+     */
+    bool isCancelRequested() const;
+
+    /**
+     * @brief Получает состояние передачи
+     * @return Состояние передачи
+     */
+    MtpTransferState getState() const;
+
+    /**
+     * @brief Получает объем переданных данных
+     * @return Количество переданных байт
+     */
+    uint64_t getBytesDone() const;
+
+    /**
+     * @brief Получает общий объем передачи
+     * @return Количество байт (0, если неизвестно)
+     */
+    uint64_t getTotalBytes() const;
+
+    /**
+     * @brief Получает среднюю скорость с начала передачи
+     * @return Скорость в байтах в секунду
+     */
+    double getAverageThroughput() const;
+
+    /**
+     * @brief Получает текущую скорость (сглаженную за последние секунды)
+     * @return Скорость в байтах в секунду
+     */
+    double getInstantThroughput() const;
+
+    /**
+     * @brief Получает оценку оставшегося времени
+     * @return Время в секундах или -1, если оценить невозможно
+     */
+    double getEstimatedSecondsLeft() const;
+
+    /**
+     * @brief Дожидается завершения передачи
+     */
+    void wait() const;
+
+    /**
+     * @brief Отмечает начало передачи (вызывается библиотекой)
+     *
+     * При продолжении прерванной передачи уже полученные байты входят
+     * в счетчик, но не в скорость и не в ограничение скорости.
+     * @param totalBytes Общий объем передачи
+     * @param initialBytes Объем, переданный до начала (при продолжении)
+     */
+    void begin(uint64_t totalBytes, uint64_t initialBytes = 0);
+
+    /**
+     * @brief Обновляет счетчики (вызывается библиотекой из потока передачи)
+     *
+     * Вызывает функцию обратного вызова и выдерживает ограничение
+     * скорости, поэтому вызывается только из потока, начавшего передачу,
+     * и никогда из команды планировщика устройства.
+     * @param bytesDone Количество переданных байт
+     * @return false если передачу нужно прервать
+     */
+    bool update(uint64_t bytesDone);
+
+    /**
+     * @brief Обновляет только счетчик байт (вызывается из команды устройства)
+     *
+     * Не вызывает функцию обратного вызова и не ждет, поэтому не задерживает
+     * рабочий поток планировщика. Ход передачи при этом сообщает poll(),
+     * вызываемый потоком, ожидающим команду.
+     * @param bytesDone Количество переданных байт
+     * @return false если передачу нужно прервать
+     */
+    bool report(uint64_t bytesDone);
+
+    /**
+     * @brief Пересчитывает скорость и вызывает функцию обратного вызова, если подошел интервал
+     *
+     * Вызывается из потока, начавшего передачу; не ждет.
+     */
+    void poll();
+
+    /**
+     * @brief Ждет, пока переданный объем не уложится в ограничение скорости
+     *
+     * Вызывается из потока, начавшего передачу, между частями передачи.
+     * @param bytesDone Количество переданных байт
+     */
+    void pace(uint64_t bytesDone);
+
+    /**
+     * @brief Отмечает завершение передачи (вызывается библиотекой)
+     * @param state Итоговое состояние
+     */
+    void finish(MtpTransferState state);
+
+    /**
+     * @brief Функция хода передачи в формате libmtp
+     *
+     * Вызывается из команды устройства, поэтому только обновляет счетчик (report).
+     * @param sent Количество переданных байт
+     * @param total Общий объем передачи
+     * @param data Указатель на MtpTransfer
+     * @return 0 для продолжения, 1 для отмены
+     */
+    static int libmtpProgress(uint64_t const sent, uint64_t const total, void const* const data);
+
+private:
+    /**
+     * @brief Получает монотонное время в наносекундах
+     * @return Время в наносекундах
+     */
+    static int64_t now();
+
+private:
+    std::atomic<int> m_state;                  ///< Состояние передачи
+    std::atomic<uint64_t> m_bytesDone;         ///< Переданные байты
+    std::atomic<uint64_t> m_totalBytes;        ///< Общий объем
+    std::atomic<uint64_t> m_initialBytes;      ///< Объем, переданный до начала
+    std::atomic<bool> m_cancelRequested;       ///< Флаг запроса отмены
+    std::atomic<int64_t> m_startTime;          ///< Время начала (нс)
+    std::atomic<int64_t> m_finishTime;         ///< Время завершения (нс)
+    std::atomic<double> m_instantThroughput;   ///< Сглаженная текущая скорость
+    std::atomic<uint64_t> m_rateLimit;         ///< Ограничение скорости (байт/с)
+    int64_t m_lastSampleTime;                  ///< Время последнего замера скорости (поток передачи)
+    uint64_t m_lastSampleBytes;                ///< Байты на момент последнего замера (поток передачи)
+    int64_t m_lastCallbackTime;                ///< Время последнего вызова функции обратного вызова
+    int64_t m_callbackInterval;                ///< Интервал между вызовами (нс)
+    ProgressCallback m_callback;               ///< Функция обратного вызова
+    mutable std::mutex m_mutex;                ///< Мьютекс для ожидания завершения
+    mutable std::condition_variable m_finished; ///< Условие завершения передачи
+};
+
+#endif // MTP_TRANSFER_H
@@ -0,0 +1,111 @@
+#ifndef MTP_TRANSFER_JOURNAL_H
+#define MTP_TRANSFER_JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Состояние элемента пакетной передачи
+ */
+enum class MtpJournalItemState {
+    Pending,    ///< Еще не передан или передан частично
+    Completed,  ///< Передан полностью
+    Failed      ///< Не передан из-за ошибки, не связанной с отключением
+};
+
+/**
+ * @brief Элемент пакетной передачи в журнале
+ *
+ * Кроме ID объекта хранится путь к нему: после переподключения
+ * устройство может выдать объектам новые ID.
+ */
+struct MtpJournalItem {
+    MtpJournalItemState state = MtpJournalItemState::Pending; ///< Состояние
+    uint32_t storageId = 0;     ///< ID хранилища
+    uint32_t objectId = 0;      ///< ID объекта в сеансе, в котором он был добавлен
+    std::string folderPath;     ///< Путь к родительской директории от корня хранилища ("DCIM/Camera")
+    std::string name;           ///< Имя файла на устройстве
+    uint64_t size = 0;          ///< Размер файла
+    std::string localPath;      ///< Путь к локальному файлу
+    uint64_t offset = 0;        ///< Байт уже записано на диск во временный файл
+    std::string error;          ///< Описание ошибки (для Failed)
+};
+
+/**
+ * @brief Журнал пакетной передачи
+ *
+ * Хранит устройство (по серийному номеру) и состояние каждого
+ * элемента. Файл журнала текстовый и перезаписывается целиком через
+ * временный файл и переименование, поэтому после сбоя на диске
+ * остается либо старая, либо новая версия.
+ */
+class MtpTransferJournal {
+public:
+    /**
+     * @brief Конструктор
+     * @param path Путь к файлу журнала
+     */
+    explicit MtpTransferJournal(const std::string& path);
+
+    /**
+     * @brief Загружает журнал из файла
+     * @return true в случае успеха, false если файла нет или он поврежден
+     */
+    bool load();
+
+    /**
+     * @brief Сохраняет журнал в файл
+     * @return true в случае успеха, false в случае ошибки
+     */
+    bool save();
+
+    /**
+     * @brief Удаляет файл журнала
+     */
+    void remove();
+
+    /**
+     * @brief Получает путь к файлу журнала
+     * @return Путь к файлу
+     */
+    const std::string& getPath() const;
+
+    /**
+     * @brief Получает серийный номер устройства
+     * @return Серийный номер (пусто, если элементов еще нет)
+     */
+    const std::string& getSerialNumber() const;
+
+    /**
+     * @brief Устанавливает серийный номер устройства
+     * @param serialNumber Серийный номер
+     */
+    void setSerialNumber(const std::string& serialNumber);
+
+    /**
+     * @brief Получает элементы журнала
+     * @return Элементы в порядке добавления
+     */
+    std::vector<MtpJournalItem>& getItems();
+
+    /**
+     * @brief Получает элементы журнала
+     * @return Элементы в порядке добавления
+     */
+    const std::vector<MtpJournalItem>& getItems() const;
+
+    /**
+     * @brief Получает последнее сообщение об ошибке
+     * @return Строка с сообщением об ошибке
+     */
+    std::string getLastError() const;
+
+private:
+    std::string m_path;                 ///< Путь к файлу журнала
+    std::string m_serialNumber;         ///< Серийный номер устройства
+    std::vector<MtpJournalItem> m_items; ///< Элементы
+    std::string m_lastError;            ///< Последнее сообщение об ошибке
+};
+
+#endif // MTP_TRANSFER_JOURNAL_H
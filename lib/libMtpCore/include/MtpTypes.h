@@ -0,0 +1,129 @@
+#ifndef MTP_TYPES_H
+#define MTP_TYPES_H
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <ctime>
+#include <cstdint>
+#include <libmtp.h>
+
+/**
+ * @brief Сведения об объекте на MTP-устройстве
+ *
+ * Легковесная структура со свойствами объекта, которые libmtp
+ * возвращает вместе со списком файлов. Используется индексами,
+ * уведомлениями об изменениях и запросами к хранилищу.
+ */
+struct MtpObjectInfo {
+    uint32_t id = 0;                                   ///< ID объекта
+    uint32_t parentId = 0;                             ///< ID родительской директории
+    uint32_t storageId = 0;                            ///< ID хранилища
+    std::string name;                                  ///< Имя объекта
+    uint64_t size = 0;                                 ///< Размер в байтах
+    LIBMTP_filetype_t type = LIBMTP_FILETYPE_UNKNOWN;  ///< Тип объекта
+    time_t modificationDate = 0;                       ///< Время последнего изменения
+
+    /**
+     * @brief Проверяет, является ли объект директорией
+     * @return true если объект - директория
+     */
+    bool isDirectory() const { return type == LIBMTP_FILETYPE_FOLDER; }
+};
+
+/**
+ * @brief Условия отбора объектов по свойствам из списка файлов
+ *
+ * Все заданные условия объединяются по "И". Значения по умолчанию
+ * означают отсутствие ограничения. Условия проверяются по данным,
+ * которые libmtp возвращает вместе со списком, поэтому отбор не
+ * требует дополнительных запросов к устройству.
+ */
+struct MtpObjectFilter {
+    uint64_t minSize = 0;                                      ///< Минимальный размер в байтах
+    uint64_t maxSize = std::numeric_limits<uint64_t>::max();   ///< Максимальный размер в байтах
+    time_t modifiedAfter = 0;                                  ///< Изменен не раньше (0 - без ограничения)
+    time_t modifiedBefore = 0;                                 ///< Изменен не позже (0 - без ограничения)
+    std::vector<LIBMTP_filetype_t> types;                      ///< Допустимые типы (пусто - любые)
+    std::vector<std::string> extensions;                       ///< Допустимые расширения без учета регистра (пусто - любые)
+    bool includeDirectories = true;                            ///< Включать ли директории в результат
+    size_t limit = 0;                                          ///< Максимум результатов (0 - без ограничения)
+
+    /**
+     * @brief Проверяет объект на соответствие условиям
+     *
+     * Ограничения по размеру к директориям не применяются.
+     * Ограничение limit здесь не учитывается.
+     * @param info Сведения об объекте
+     * @return true если объект подходит
+     */
+    bool matches(const MtpObjectInfo& info) const;
+
+    /**
+     * @brief Проверяет расширение имени
+     * @param name Имя объекта
+     * @return true если список расширений пуст или расширение в нем есть
+     */
+    bool matchesExtension(const std::string& name) const;
+};
+
+/**
+ * @brief Вид изменения объекта
+ */
+enum class MtpObjectChangeType {
+    Added,      ///< Объект создан
+    Removed,    ///< Объект удален (вместе с содержимым, если это директория)
+    Changed     ///< Изменились свойства объекта
+};
+
+/**
+ * @brief Уведомление об изменении объекта на устройстве
+ */
+struct MtpObjectChange {
+    MtpObjectChangeType type;   ///< Вид изменения
+    MtpObjectInfo info;         ///< Сведения об объекте (для Removed достаточно ID)
+};
+
+/**
+ * @brief Способ обхода всего хранилища
+ */
+enum class MtpEnumerationMode {
+    Auto,       ///< Пакетный обход, а при его неудаче - обход по директориям
+    Bulk,       ///< Один проход по всем объектам устройства средствами libmtp
+    PerFolder   ///< Отдельный запрос списка для каждой директории
+};
+
+/**
+ * @brief Создает сведения об объекте из структуры libmtp
+ * @param file Указатель на файл libmtp
+ * @param storageId ID хранилища (используется, если libmtp его не заполнил)
+ * @return Сведения об объекте
+ */
+MtpObjectInfo makeObjectInfo(const LIBMTP_file_t* file, uint32_t storageId);
+
+/**
+ * @brief Приводит строку UTF-8 к нижнему регистру
+ *
+ * Кроме ASCII обрабатываются латиница (Latin-1, Latin Extended-A) и
+ * кириллица; остальные символы и некорректные последовательности
+ * копируются без изменений.
+ * @param text Строка в UTF-8
+ * @return Строка в нижнем регистре
+ */
+std::string toLowerUtf8(const std::string& text);
+
+/**
+ * @brief Получает расширение имени файла
+ * @param name Имя файла
+ * @return Расширение в нижнем регистре без точки или пустая строка
+ */
+std::string fileExtension(const std::string& name);
+
+/**
+ * @brief Определяет тип файла libmtp по расширению имени
+ * @param name Имя файла
+ * @return Тип файла или LIBMTP_FILETYPE_UNKNOWN
+ */
+LIBMTP_filetype_t fileTypeFromName(const std::string& name);
+
+#endif // MTP_TYPES_H
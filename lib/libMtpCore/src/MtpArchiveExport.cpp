@@ -0,0 +1,531 @@
+#include "MtpArchiveExport.h"
+#include "MtpFile.h"
+#include "MtpDirectory.h"
+#include "MtpTransfer.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const size_t TAR_BLOCK_SIZE = 512;
+
+// Максимальное значение 11-значного восьмеричного поля размера tar
+const uint64_t TAR_MAX_OCTAL_SIZE = 077777777777ULL;
+
+const uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+const uint32_t ZIP_DATA_DESCRIPTOR_SIGNATURE = 0x08074b50;
+const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+const uint32_t ZIP64_END_SIGNATURE = 0x06064b50;
+const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+const uint32_t ZIP_END_SIGNATURE = 0x06054b50;
+
+// Флаги записи ZIP: размеры и CRC после данных (бит 3), имена в UTF-8 (бит 11)
+const uint16_t ZIP_FLAG_DATA_DESCRIPTOR = 0x0008;
+const uint16_t ZIP_FLAG_UTF8 = 0x0800;
+
+const uint32_t ZIP32_LIMIT = 0xFFFFFFFFu;
+
+// Размер выходного буфера при записи архива в файл
+const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+
+std::array<uint32_t, 256> makeCrcTable()
+{
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+        }
+        table[i] = value;
+    }
+    return table;
+}
+
+uint32_t crc32Update(uint32_t crc, const unsigned char* data, size_t length)
+{
+    static const std::array<uint32_t, 256> table = makeCrcTable();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void putOctal(char* field, size_t width, uint64_t value)
+{
+    // width - 1 цифр и завершающий нуль
+    snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+}
+
+// Заполняет заголовок tar; name записывается как есть (не более 100 байт)
+void fillTarHeader(char* header, const std::string& name, uint64_t size, time_t modificationDate,
+                   unsigned int mode, char type)
+{
+    memset(header, 0, TAR_BLOCK_SIZE);
+    memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+    putOctal(header + 100, 8, mode);
+    putOctal(header + 108, 8, 0);
+    putOctal(header + 116, 8, 0);
+    putOctal(header + 124, 12, size);
+    putOctal(header + 136, 12, static_cast<uint64_t>(modificationDate));
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+}
+
+// Записывает контрольную сумму, считаемую при поле суммы, заполненном пробелами
+void finishTarHeader(char* header)
+{
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        checksum += static_cast<unsigned char>(header[i]);
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+}
+
+void put16(std::string& out, uint16_t value)
+{
+    out.push_back(static_cast<char>(value & 0xFF));
+    out.push_back(static_cast<char>((value >> 8) & 0xFF));
+}
+
+void put32(std::string& out, uint32_t value)
+{
+    put16(out, static_cast<uint16_t>(value & 0xFFFF));
+    put16(out, static_cast<uint16_t>(value >> 16));
+}
+
+void put64(std::string& out, uint64_t value)
+{
+    put32(out, static_cast<uint32_t>(value & 0xFFFFFFFFu));
+    put32(out, static_cast<uint32_t>(value >> 32));
+}
+
+void dosDateTime(time_t value, uint16_t& dosTime, uint16_t& dosDate)
+{
+    struct tm local;
+    localtime_r(&value, &local);
+
+    // Формат DOS не представляет даты раньше 1980 года
+    if (local.tm_year < 80) {
+        dosTime = 0;
+        dosDate = (1 << 5) | 1;
+        return;
+    }
+
+    dosTime = static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+    dosDate = static_cast<uint16_t>(((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+}
+
+std::string paxRecord(const std::string& key, const std::string& value)
+{
+    // Длина записи включает саму себя, поэтому подбираем ее итеративно
+    size_t body = key.size() + value.size() + 3; // пробел, '=' и '\n'
+    size_t length = body + 1;
+    while (std::to_string(length).size() + body != length) {
+        length = std::to_string(length).size() + body;
+    }
+    return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+bool writePadding(const MtpArchiveExport::OutputWriter& writer, uint64_t size)
+{
+    static const char zeros[TAR_BLOCK_SIZE] = {};
+    size_t padding = static_cast<size_t>((TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+    return padding == 0 || writer(zeros, padding);
+}
+
+} // namespace
+
+MtpArchiveExport::MtpArchiveExport(MtpArchiveFormat format)
+    : m_format(format)
+{
+}
+
+bool MtpArchiveExport::exportToFile(const std::shared_ptr<MtpDirectory>& directory, const std::string& archivePath,
+                                    std::shared_ptr<MtpTransfer> transfer)
+{
+    FILE* output = fopen(archivePath.c_str(), "wb");
+    if (!output) {
+        m_lastError = "Failed to create archive: " + archivePath;
+        return false;
+    }
+
+    // Крупный буфер: архив пишется одним последовательным потоком
+    std::vector<char> buffer(FILE_BUFFER_SIZE);
+    setvbuf(output, buffer.data(), _IOFBF, buffer.size());
+
+    bool ok = exportToWriter(directory, [output](const char* data, size_t length) {
+        return fwrite(data, 1, length, output) == length;
+    }, transfer);
+
+    if (fclose(output) != 0 && ok) {
+        m_lastError = "Failed to write archive: " + archivePath;
+        ok = false;
+    }
+
+    if (!ok) {
+        remove(archivePath.c_str());
+    }
+
+    return ok;
+}
+
+bool MtpArchiveExport::exportToWriter(const std::shared_ptr<MtpDirectory>& directory, const OutputWriter& writer,
+                                      std::shared_ptr<MtpTransfer> transfer)
+{
+    // Сначала собираем записи, чтобы знать общий объем выгрузки
+    std::vector<Entry> entries;
+    collectEntries(directory, directory->getName() + "/", entries);
+
+    uint64_t totalBytes = 0;
+    for (const auto& entry : entries) {
+        totalBytes += entry.size;
+    }
+
+    if (transfer) {
+        transfer->begin(totalBytes);
+    }
+
+    bool ok = true;
+    uint64_t done = 0;
+
+    if (m_format == MtpArchiveFormat::Tar) {
+        for (const auto& entry : entries) {
+            if (!writeTarEntry(entry, writer, done, transfer.get())) {
+                ok = false;
+                break;
+            }
+        }
+
+        // Конец архива - два нулевых блока
+        static const char zeros[TAR_BLOCK_SIZE * 2] = {};
+        if (ok && !writer(zeros, sizeof(zeros))) {
+            m_lastError = "Failed to write archive";
+            ok = false;
+        }
+    } else {
+        uint64_t offset = 0;
+        OutputWriter counting = [&writer, &offset](const char* data, size_t length) {
+            offset += length;
+            return writer(data, length);
+        };
+
+        std::vector<ZipRecord> records;
+        for (const auto& entry : entries) {
+            if (!writeZipEntry(entry, counting, offset, done, transfer.get(), records)) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (ok && !writeZipDirectory(records, counting, offset)) {
+            m_lastError = "Failed to write archive";
+            ok = false;
+        }
+    }
+
+    if (transfer) {
+        if (!ok && transfer->isCancelRequested()) {
+            m_lastError = "Transfer cancelled";
+            transfer->finish(MtpTransferState::Cancelled);
+        } else {
+            transfer->finish(ok ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    return ok;
+}
+
+std::string MtpArchiveExport::getLastError() const
+{
+    return m_lastError;
+}
+
+void MtpArchiveExport::collectEntries(const std::shared_ptr<MtpDirectory>& directory, const std::string& prefix,
+                                      std::vector<Entry>& entries)
+{
+    // Если устройство не сообщило время изменения, ставим текущее
+    time_t now = time(nullptr);
+    auto dateOf = [now](const std::shared_ptr<MtpFile>& file) {
+        return file->getModificationDate() ? file->getModificationDate() : now;
+    };
+
+    entries.push_back({prefix, directory, 0, dateOf(directory), true});
+
+    for (const auto& file : directory->getContent()) {
+        if (file->isDirectory()) {
+            collectEntries(std::static_pointer_cast<MtpDirectory>(file), prefix + file->getName() + "/", entries);
+        } else {
+            entries.push_back({prefix + file->getName(), file, file->getSize(), dateOf(file), false});
+        }
+    }
+}
+
+bool MtpArchiveExport::writeTarEntry(const Entry& entry, const OutputWriter& writer, uint64_t& done,
+                                     MtpTransfer* transfer)
+{
+    if (!writeTarHeader(entry, writer)) {
+        m_lastError = "Failed to write archive";
+        return false;
+    }
+
+    if (entry.isDirectory) {
+        return true;
+    }
+
+    if (!streamContent(entry, writer, done, transfer, nullptr)) {
+        return false;
+    }
+
+    if (!writePadding(writer, entry.size)) {
+        m_lastError = "Failed to write archive";
+        return false;
+    }
+
+    return true;
+}
+
+bool MtpArchiveExport::writeTarHeader(const Entry& entry, const OutputWriter& writer)
+{
+    const std::string& path = entry.path;
+    std::string name = path;
+    std::string prefix;
+    std::string paxData;
+
+    // Длинный путь делим на prefix (до 155 байт) и name (до 100 байт),
+    // а если это невозможно - передаем его в PAX-заголовке
+    if (path.size() > 100) {
+        size_t split = std::string::npos;
+        for (size_t i = 0; i < path.size() && i <= 155; ++i) {
+            if (path[i] == '/' && path.size() - i - 1 <= 100 && i + 1 < path.size()) {
+                split = i;
+                break;
+            }
+        }
+
+        if (split != std::string::npos) {
+            prefix = path.substr(0, split);
+            name = path.substr(split + 1);
+        } else {
+            paxData += paxRecord("path", path);
+            name = path.substr(0, 100);
+        }
+    }
+
+    if (entry.size > TAR_MAX_OCTAL_SIZE) {
+        paxData += paxRecord("size", std::to_string(entry.size));
+    }
+
+    char header[TAR_BLOCK_SIZE];
+
+    if (!paxData.empty()) {
+        std::string paxName = "PaxHeaders/" + std::to_string(std::hash<std::string>()(path));
+        fillTarHeader(header, paxName, paxData.size(), entry.modificationDate, 0644, 'x');
+        finishTarHeader(header);
+
+        if (!writer(header, sizeof(header)) || !writer(paxData.data(), paxData.size()) ||
+            !writePadding(writer, paxData.size())) {
+            return false;
+        }
+    }
+
+    fillTarHeader(header, name, entry.size > TAR_MAX_OCTAL_SIZE ? 0 : entry.size, entry.modificationDate,
+                  entry.isDirectory ? 0755 : 0644, entry.isDirectory ? '5' : '0');
+    memcpy(header + 345, prefix.data(), prefix.size());
+    finishTarHeader(header);
+
+    return writer(header, sizeof(header));
+}
+
+bool MtpArchiveExport::writeZipEntry(const Entry& entry, const OutputWriter& writer, uint64_t& offset,
+                                     uint64_t& done, MtpTransfer* transfer, std::vector<ZipRecord>& records)
+{
+    ZipRecord record = {entry.path, 0, entry.size, offset, entry.modificationDate, entry.isDirectory};
+    bool zip64 = entry.size >= ZIP32_LIMIT;
+
+    uint16_t dosTime = 0;
+    uint16_t dosDate = 0;
+    dosDateTime(entry.modificationDate, dosTime, dosDate);
+
+    std::string header;
+    put32(header, ZIP_LOCAL_HEADER_SIGNATURE);
+    put16(header, zip64 ? 45 : 20);
+    put16(header, entry.isDirectory ? ZIP_FLAG_UTF8 : (ZIP_FLAG_UTF8 | ZIP_FLAG_DATA_DESCRIPTOR));
+    put16(header, 0);                       // без сжатия
+    put16(header, dosTime);
+    put16(header, dosDate);
+    put32(header, 0);                       // CRC - в дескрипторе данных
+    put32(header, zip64 ? ZIP32_LIMIT : 0); // размеры - в дескрипторе данных
+    put32(header, zip64 ? ZIP32_LIMIT : 0);
+    put16(header, static_cast<uint16_t>(entry.path.size()));
+    put16(header, zip64 ? 20 : 0);
+    header += entry.path;
+    if (zip64) {
+        put16(header, 0x0001);
+        put16(header, 16);
+        put64(header, 0);
+        put64(header, 0);
+    }
+
+    if (!writer(header.data(), header.size())) {
+        m_lastError = "Failed to write archive";
+        return false;
+    }
+
+    if (!entry.isDirectory) {
+        if (!streamContent(entry, writer, done, transfer, &record.crc)) {
+            return false;
+        }
+
+        std::string descriptor;
+        put32(descriptor, ZIP_DATA_DESCRIPTOR_SIGNATURE);
+        put32(descriptor, record.crc);
+        if (zip64) {
+            put64(descriptor, entry.size);
+            put64(descriptor, entry.size);
+        } else {
+            put32(descriptor, static_cast<uint32_t>(entry.size));
+            put32(descriptor, static_cast<uint32_t>(entry.size));
+        }
+
+        if (!writer(descriptor.data(), descriptor.size())) {
+            m_lastError = "Failed to write archive";
+            return false;
+        }
+    }
+
+    records.push_back(record);
+    return true;
+}
+
+bool MtpArchiveExport::writeZipDirectory(const std::vector<ZipRecord>& records, const OutputWriter& writer,
+                                         uint64_t offset)
+{
+    uint64_t directoryOffset = offset;
+    std::string directory;
+
+    for (const auto& record : records) {
+        bool bigSize = record.size >= ZIP32_LIMIT;
+        bool bigOffset = record.offset >= ZIP32_LIMIT;
+
+        std::string extra;
+        if (bigSize || bigOffset) {
+            put16(extra, 0x0001);
+            put16(extra, static_cast<uint16_t>((bigSize ? 16 : 0) + (bigOffset ? 8 : 0)));
+            if (bigSize) {
+                put64(extra, record.size);
+                put64(extra, record.size);
+            }
+            if (bigOffset) {
+                put64(extra, record.offset);
+            }
+        }
+
+        uint16_t dosTime = 0;
+        uint16_t dosDate = 0;
+        dosDateTime(record.modificationDate, dosTime, dosDate);
+
+        uint32_t mode = record.isDirectory ? 040755 : 0100644;
+
+        put32(directory, ZIP_CENTRAL_HEADER_SIGNATURE);
+        put16(directory, (3 << 8) | 45);   // создан в Unix, версия 4.5
+        put16(directory, extra.empty() ? 20 : 45);
+        put16(directory, record.isDirectory ? ZIP_FLAG_UTF8 : (ZIP_FLAG_UTF8 | ZIP_FLAG_DATA_DESCRIPTOR));
+        put16(directory, 0);
+        put16(directory, dosTime);
+        put16(directory, dosDate);
+        put32(directory, record.crc);
+        put32(directory, bigSize ? ZIP32_LIMIT : static_cast<uint32_t>(record.size));
+        put32(directory, bigSize ? ZIP32_LIMIT : static_cast<uint32_t>(record.size));
+        put16(directory, static_cast<uint16_t>(record.path.size()));
+        put16(directory, static_cast<uint16_t>(extra.size()));
+        put16(directory, 0);                // комментарий
+        put16(directory, 0);                // номер диска
+        put16(directory, 0);                // внутренние атрибуты
+        put32(directory, (mode << 16) | (record.isDirectory ? 0x10 : 0));
+        put32(directory, bigOffset ? ZIP32_LIMIT : static_cast<uint32_t>(record.offset));
+        directory += record.path;
+        directory += extra;
+    }
+
+    uint64_t directorySize = directory.size();
+    bool zip64 = records.size() >= 0xFFFF || directoryOffset >= ZIP32_LIMIT || directorySize >= ZIP32_LIMIT;
+
+    if (zip64) {
+        uint64_t zip64EndOffset = directoryOffset + directorySize;
+
+        put32(directory, ZIP64_END_SIGNATURE);
+        put64(directory, 44);
+        put16(directory, (3 << 8) | 45);
+        put16(directory, 45);
+        put32(directory, 0);
+        put32(directory, 0);
+        put64(directory, records.size());
+        put64(directory, records.size());
+        put64(directory, directorySize);
+        put64(directory, directoryOffset);
+
+        put32(directory, ZIP64_LOCATOR_SIGNATURE);
+        put32(directory, 0);
+        put64(directory, zip64EndOffset);
+        put32(directory, 1);
+    }
+
+    uint16_t count = zip64 ? 0xFFFF : static_cast<uint16_t>(records.size());
+    put32(directory, ZIP_END_SIGNATURE);
+    put16(directory, 0);
+    put16(directory, 0);
+    put16(directory, count);
+    put16(directory, count);
+    put32(directory, zip64 ? ZIP32_LIMIT : static_cast<uint32_t>(directorySize));
+    put32(directory, zip64 ? ZIP32_LIMIT : static_cast<uint32_t>(directoryOffset));
+    put16(directory, 0);
+
+    return writer(directory.data(), directory.size());
+}
+
+bool MtpArchiveExport::streamContent(const Entry& entry, const OutputWriter& writer, uint64_t& done,
+                                     MtpTransfer* transfer, uint32_t* crc)
+{
+    uint64_t written = 0;
+    bool writeFailed = false;
+    bool tooLong = false;
+
+    bool ok = entry.file->readContent([&](const unsigned char* data, size_t length) {
+        // Размер записи уже объявлен в заголовке, лишние байты испортили бы архив
+        if (written + length > entry.size) {
+            tooLong = true;
+            return false;
+        }
+        if (!writer(reinterpret_cast<const char*>(data), length)) {
+            writeFailed = true;
+            return false;
+        }
+        if (crc) {
+            *crc = crc32Update(*crc, data, length);
+        }
+        written += length;
+        done += length;
+        return !transfer || transfer->update(done);
+    });
+
+    if (writeFailed) {
+        m_lastError = "Failed to write archive";
+        return false;
+    }
+    if (tooLong || (ok && written != entry.size)) {
+        m_lastError = "File size changed during export: " + entry.path;
+        return false;
+    }
+    if (!ok) {
+        m_lastError = "Failed to read " + entry.path + ": " + entry.file->getLastError();
+        return false;
+    }
+
+    return true;
+}
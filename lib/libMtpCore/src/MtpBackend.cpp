@@ -0,0 +1,167 @@
+#include "MtpBackend.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+MtpBackend g_libmtpBackend;
+std::atomic<MtpBackend*> g_current(&g_libmtpBackend);
+
+// Бэкенд может еще выполнять команду после замены, поэтому
+// установленные бэкенды не удаляются
+std::mutex g_installedMutex;
+std::vector<std::shared_ptr<MtpBackend>> g_installed;
+
+} // namespace
+
+MtpBackend::~MtpBackend()
+{
+}
+
+MtpBackend& MtpBackend::instance()
+{
+    return *g_current.load(std::memory_order_acquire);
+}
+
+void MtpBackend::install(std::shared_ptr<MtpBackend> backend)
+{
+    std::lock_guard<std::mutex> lock(g_installedMutex);
+
+    if (!backend) {
+        g_current.store(&g_libmtpBackend, std::memory_order_release);
+        return;
+    }
+
+    g_installed.push_back(backend);
+    g_current.store(backend.get(), std::memory_order_release);
+}
+
+void MtpBackend::deviceOpened(LIBMTP_mtpdevice_t*, const LIBMTP_raw_device_t&)
+{
+}
+
+void MtpBackend::releaseDevice(LIBMTP_mtpdevice_t* device)
+{
+    LIBMTP_Release_Device(device);
+}
+
+char* MtpBackend::getFriendlyname(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Friendlyname(device);
+}
+
+char* MtpBackend::getManufacturername(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Manufacturername(device);
+}
+
+char* MtpBackend::getModelname(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Modelname(device);
+}
+
+char* MtpBackend::getSerialnumber(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Serialnumber(device);
+}
+
+char* MtpBackend::getDeviceversion(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Deviceversion(device);
+}
+
+int MtpBackend::getStorage(LIBMTP_mtpdevice_t* device, int sortBy)
+{
+    return LIBMTP_Get_Storage(device, sortBy);
+}
+
+int MtpBackend::checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability)
+{
+    return LIBMTP_Check_Capability(device, capability);
+}
+
+LIBMTP_error_t* MtpBackend::getErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    return LIBMTP_Get_Errorstack(device);
+}
+
+void MtpBackend::clearErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    LIBMTP_Clear_Errorstack(device);
+}
+
+LIBMTP_file_t* MtpBackend::getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    return LIBMTP_Get_Filemetadata(device, id);
+}
+
+LIBMTP_file_t* MtpBackend::getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId, uint32_t parentId)
+{
+    return LIBMTP_Get_Files_And_Folders(device, storageId, parentId);
+}
+
+LIBMTP_file_t* MtpBackend::getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                          const void* data)
+{
+    return LIBMTP_Get_Filelisting_With_Callback(device, progress, data);
+}
+
+LIBMTP_folder_t* MtpBackend::getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId)
+{
+    return LIBMTP_Get_Folder_List_For_Storage(device, storageId);
+}
+
+int MtpBackend::getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                                 LIBMTP_progressfunc_t progress, const void* data)
+{
+    return LIBMTP_Get_File_To_Handler(device, id, put, priv, progress, data);
+}
+
+int MtpBackend::getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset, uint32_t maxBytes,
+                                 unsigned char** data, unsigned int* size)
+{
+    return LIBMTP_GetPartialObject(device, id, offset, maxBytes, data, size);
+}
+
+int MtpBackend::sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                                 LIBMTP_progressfunc_t progress, const void* data)
+{
+    return LIBMTP_Send_File_From_File(device, path, metadata, progress, data);
+}
+
+int MtpBackend::sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                                    LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress, const void* data)
+{
+    return LIBMTP_Send_File_From_Handler(device, get, priv, metadata, progress, data);
+}
+
+uint32_t MtpBackend::createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId, uint32_t storageId)
+{
+    return LIBMTP_Create_Folder(device, name, parentId, storageId);
+}
+
+int MtpBackend::deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    return LIBMTP_Delete_Object(device, id);
+}
+
+int MtpBackend::setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name)
+{
+    return LIBMTP_Set_File_Name(device, file, name);
+}
+
+int MtpBackend::moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    return LIBMTP_Move_Object(device, id, storageId, parentId);
+}
+
+int MtpBackend::copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    return LIBMTP_Copy_Object(device, id, storageId, parentId);
+}
+
+int MtpBackend::readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data)
+{
+    return LIBMTP_Read_Event_Async(device, callback, data);
+}
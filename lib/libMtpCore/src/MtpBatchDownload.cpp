@@ -0,0 +1,522 @@
+#include "MtpBatchDownload.h"
+#include "MtpDeviceManager.h"
+#include "MtpDevice.h"
+#include "MtpStorage.h"
+#include "MtpFile.h"
+#include "MtpDirectory.h"
+#include "MtpTransfer.h"
+#include "MtpHandle.h"
+#include <chrono>
+
+const uint32_t MtpBatchDownload::DEFAULT_RECONNECT_TIMEOUT;
+const uint32_t MtpBatchDownload::DEFAULT_DETECT_INTERVAL;
+const int MtpBatchDownload::MAX_ATTEMPTS_WITHOUT_PROGRESS;
+
+namespace {
+
+// Глубина вложенности, после которой цепочка родителей считается зацикленной
+const size_t MAX_FOLDER_DEPTH = 256;
+
+std::vector<std::string> splitPath(const std::string& path)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start < path.size()) {
+        size_t slash = path.find('/', start);
+        if (slash == std::string::npos) {
+            slash = path.size();
+        }
+        if (slash > start) {
+            parts.push_back(path.substr(start, slash - start));
+        }
+        start = slash + 1;
+    }
+    return parts;
+}
+
+} // namespace
+
+MtpBatchDownload::MtpBatchDownload(MtpDeviceManager& manager, const std::string& journalPath)
+    : m_manager(manager)
+    , m_journal(journalPath)
+    , m_reconnectTimeout(DEFAULT_RECONNECT_TIMEOUT)
+    , m_detectInterval(DEFAULT_DETECT_INTERVAL)
+    , m_readyCallbackId(0)
+    , m_ready(std::make_shared<ReadySignal>())
+{
+    std::shared_ptr<ReadySignal> ready = m_ready;
+    m_readyCallbackId = m_manager.registerDeviceReadyCallback([ready](std::shared_ptr<MtpDevice>) {
+        {
+            std::lock_guard<std::mutex> lock(ready->mutex);
+            ++ready->count;
+        }
+        ready->condition.notify_all();
+    });
+}
+
+MtpBatchDownload::~MtpBatchDownload()
+{
+    m_manager.unregisterDeviceReadyCallback(m_readyCallbackId);
+}
+
+bool MtpBatchDownload::load()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_journal.load()) {
+        m_lastError = m_journal.getLastError();
+        return false;
+    }
+    return true;
+}
+
+bool MtpBatchDownload::add(const std::shared_ptr<MtpFile>& file, const std::string& localPath)
+{
+    if (!file || file->isDirectory()) {
+        m_lastError = "Only files can be downloaded";
+        return false;
+    }
+
+    std::shared_ptr<MtpDevice> device = m_manager.getDevice(file->getDeviceHandle());
+    if (!device) {
+        m_lastError = MtpHandleTable::DISCONNECTED_ERROR;
+        return false;
+    }
+
+    std::string serialNumber = device->getSerialNumber();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_journal.getItems().empty() && m_journal.getSerialNumber() != serialNumber) {
+            m_lastError = "File belongs to another device";
+            return false;
+        }
+    }
+
+    std::shared_ptr<MtpStorage> storage;
+    for (const auto& candidate : device->getAllStorages()) {
+        if (candidate->getId() == file->getStorageId()) {
+            storage = candidate;
+        }
+    }
+
+    MtpJournalItem item;
+    if (!storage || !getFolderPath(storage, file->getParentId(), item.folderPath)) {
+        m_lastError = "Cannot determine location of " + file->getName();
+        return false;
+    }
+
+    item.storageId = file->getStorageId();
+    item.objectId = file->getId();
+    item.name = file->getName();
+    item.size = file->getSize();
+    item.localPath = localPath;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_journal.setSerialNumber(serialNumber);
+    m_journal.getItems().push_back(item);
+    return true;
+}
+
+bool MtpBatchDownload::run(std::shared_ptr<MtpTransfer> transfer)
+{
+    uint64_t totalBytes = 0;
+    uint64_t doneBytes = 0;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_journal.save()) {
+            m_lastError = m_journal.getLastError();
+            return false;
+        }
+
+        count = m_journal.getItems().size();
+        for (const auto& item : m_journal.getItems()) {
+            if (item.state == MtpJournalItemState::Failed) {
+                continue;
+            }
+            totalBytes += item.size;
+            // Уже записанные части незавершенных файлов тоже получены раньше
+            doneBytes += item.state == MtpJournalItemState::Completed ? item.size : item.offset;
+        }
+    }
+
+    // Полученное до продолжения не входит ни в скорость, ни в ее ограничение
+    if (transfer) {
+        transfer->begin(totalBytes, doneBytes);
+    }
+
+    // Завершает передачу и возвращает итог
+    auto finish = [&transfer](MtpTransferState state) {
+        if (transfer) {
+            transfer->finish(state);
+        }
+        return state == MtpTransferState::Completed;
+    };
+
+    std::shared_ptr<MtpDevice> device = findDevice();
+    bool allCompleted = true;
+
+    for (size_t i = 0; i < count; ++i) {
+        MtpJournalItem item;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            item = m_journal.getItems()[i];
+        }
+        if (item.state == MtpJournalItemState::Completed) {
+            continue;
+        }
+        if (item.state == MtpJournalItemState::Failed) {
+            allCompleted = false;
+            continue;
+        }
+
+        // Начало файла уже учтено в doneBytes
+        const uint64_t startOffset = item.offset;
+        int attemptsWithoutProgress = 0;
+        for (;;) {
+            if (!device) {
+                device = waitForDevice(nullptr, transfer);
+                if (!device) {
+                    bool cancelled = transfer && transfer->isCancelRequested();
+                    return finish(cancelled ? MtpTransferState::Cancelled : MtpTransferState::Failed);
+                }
+            }
+
+            uint64_t offsetBefore = item.offset;
+            AttemptResult result = download(device, item, transfer, doneBytes - startOffset);
+
+            if (result == AttemptResult::Completed) {
+                item.state = MtpJournalItemState::Completed;
+                item.error.clear();
+                doneBytes += item.size - startOffset;
+            } else if (result == AttemptResult::Failed) {
+                item.state = MtpJournalItemState::Failed;
+            } else if (result == AttemptResult::Interrupted) {
+                // Файл, который раз за разом обрывается на том же месте, не ждет вечно
+                attemptsWithoutProgress = item.offset > offsetBefore ? 0 : attemptsWithoutProgress + 1;
+                if (attemptsWithoutProgress >= MAX_ATTEMPTS_WITHOUT_PROGRESS) {
+                    item.state = MtpJournalItemState::Failed;
+                    item.error = m_lastError;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_journal.getItems()[i] = item;
+                if (!m_journal.save()) {
+                    m_lastError = m_journal.getLastError();
+                    return finish(MtpTransferState::Failed);
+                }
+            }
+
+            if (result == AttemptResult::Cancelled) {
+                m_lastError = "Transfer cancelled";
+                return finish(MtpTransferState::Cancelled);
+            }
+            if (result == AttemptResult::Fatal) {
+                return finish(MtpTransferState::Failed);
+            }
+            if (item.state != MtpJournalItemState::Pending) {
+                allCompleted = allCompleted && item.state == MtpJournalItemState::Completed;
+                break;
+            }
+
+            // Чтение оборвалось: ждем, пока устройство откроется заново
+            device = waitForDevice(std::move(device), transfer);
+        }
+    }
+
+    if (allCompleted) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_journal.remove();
+        m_lastError.clear();
+    } else {
+        m_lastError = "Some files could not be downloaded";
+    }
+
+    return finish(allCompleted ? MtpTransferState::Completed : MtpTransferState::Failed);
+}
+
+void MtpBatchDownload::setReconnectTimeout(uint32_t seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reconnectTimeout = seconds;
+}
+
+void MtpBatchDownload::setDetectInterval(uint32_t seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_detectInterval = seconds;
+}
+
+void MtpBatchDownload::setWriterOptions(const MtpFileWriterOptions& options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_writerOptions = options;
+}
+
+std::vector<MtpJournalItem> MtpBatchDownload::getItems() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_journal.getItems();
+}
+
+size_t MtpBatchDownload::getPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t count = 0;
+    for (const auto& item : m_journal.getItems()) {
+        if (item.state == MtpJournalItemState::Pending) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+std::string MtpBatchDownload::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+std::string MtpBatchDownload::getSerialNumber() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_journal.getSerialNumber();
+}
+
+std::shared_ptr<MtpDevice> MtpBatchDownload::findDevice() const
+{
+    std::string serialNumber = getSerialNumber();
+
+    for (const auto& device : m_manager.getAllDevices()) {
+        if (device->getSerialNumber() == serialNumber) {
+            return device;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<MtpDevice> MtpBatchDownload::waitForDevice(std::shared_ptr<MtpDevice> lost,
+                                                           const std::shared_ptr<MtpTransfer>& transfer)
+{
+    if (lost) {
+        // Чтение могло прерваться и без отключения: если устройство
+        // отвечает, повторяем попытку на нем
+        if (lost->updateStorages()) {
+            return lost;
+        }
+
+        // Отключившийся экземпляр держит интерфейс USB, поэтому
+        // освобождаем его до ожидания
+        m_manager.removeDevice(lost);
+        lost.reset();
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    uint32_t timeout;
+    uint32_t interval;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        timeout = m_reconnectTimeout;
+        interval = m_detectInterval;
+    }
+
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeout);
+    Clock::time_point nextDetect = Clock::now();
+
+    for (;;) {
+        // Счетчик берем до проверки, чтобы сигнал не пришел между проверкой и ожиданием
+        uint64_t seen;
+        {
+            std::lock_guard<std::mutex> lock(m_ready->mutex);
+            seen = m_ready->count;
+        }
+
+        // Устройство могло открыть и обнаружение, запущенное приложением
+        std::shared_ptr<MtpDevice> device = findDevice();
+        if (device) {
+            return device;
+        }
+
+        if (transfer && transfer->isCancelRequested()) {
+            m_lastError = "Transfer cancelled";
+            return nullptr;
+        }
+
+        Clock::time_point now = Clock::now();
+        if (now >= deadline) {
+            m_lastError = "Device did not reconnect";
+            return nullptr;
+        }
+
+        // Открываем только это устройство; остальные устройства менеджера не трогаем
+        if (interval > 0 && now >= nextDetect && !m_manager.isDetecting()) {
+            device = m_manager.reconnectDevice(getSerialNumber());
+            if (device) {
+                return device;
+            }
+            nextDetect = Clock::now() + std::chrono::seconds(interval);
+        }
+
+        std::unique_lock<std::mutex> lock(m_ready->mutex);
+        m_ready->condition.wait_for(lock, std::chrono::milliseconds(200), [this, seen]() {
+            return m_ready->count != seen;
+        });
+    }
+}
+
+std::shared_ptr<MtpFile> MtpBatchDownload::resolveFile(const std::shared_ptr<MtpDevice>& device,
+                                                       const MtpJournalItem& item)
+{
+    auto matches = [&item](const std::shared_ptr<MtpFile>& file) {
+        return file && !file->isDirectory() && file->getName() == item.name && file->getSize() == item.size;
+    };
+
+    // Хранилище из журнала проверяем первым
+    std::vector<std::shared_ptr<MtpStorage>> storages = device->getAllStorages();
+    for (size_t i = 0; i < storages.size(); ++i) {
+        if (storages[i]->getId() == item.storageId) {
+            std::swap(storages[0], storages[i]);
+
+            std::shared_ptr<MtpFile> file = storages[0]->getFileById(item.objectId);
+            if (matches(file)) {
+                return file;
+            }
+            break;
+        }
+    }
+
+    // ID объекта в новом сеансе сменился: ищем по пути
+    for (const auto& storage : storages) {
+        std::shared_ptr<MtpDirectory> directory = storage->getRootDirectory();
+        for (const auto& part : splitPath(item.folderPath)) {
+            std::shared_ptr<MtpFile> entry = directory->getFileByName(part);
+            if (!entry || !entry->isDirectory()) {
+                directory = nullptr;
+                break;
+            }
+            directory = std::static_pointer_cast<MtpDirectory>(entry);
+        }
+
+        if (!directory) {
+            continue;
+        }
+        for (const auto& file : directory->getContent()) {
+            if (matches(file)) {
+                return file;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+bool MtpBatchDownload::getFolderPath(const std::shared_ptr<MtpStorage>& storage, uint32_t folderId, std::string& path)
+{
+    // Поднимаемся до корня или до уже известной директории
+    std::vector<std::pair<uint32_t, std::string>> chain;
+    std::string base;
+    uint32_t current = folderId;
+    while (current != 0) {
+        auto known = m_folderPaths.find(std::make_pair(storage->getId(), current));
+        if (known != m_folderPaths.end()) {
+            base = known->second;
+            break;
+        }
+
+        std::shared_ptr<MtpFile> folder = chain.size() < MAX_FOLDER_DEPTH ? storage->getFileById(current) : nullptr;
+        if (!folder) {
+            return false;
+        }
+        chain.push_back(std::make_pair(current, folder->getName()));
+        current = folder->getParentId();
+    }
+
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        base = base.empty() ? it->second : base + "/" + it->second;
+        m_folderPaths[std::make_pair(storage->getId(), it->first)] = base;
+    }
+
+    path = base;
+    return true;
+}
+
+MtpBatchDownload::AttemptResult MtpBatchDownload::download(const std::shared_ptr<MtpDevice>& device,
+                                                           MtpJournalItem& item,
+                                                           const std::shared_ptr<MtpTransfer>& transfer,
+                                                           uint64_t baseBytes)
+{
+    std::shared_ptr<MtpFile> file = resolveFile(device, item);
+    if (!file) {
+        // Пропал объект или само устройство: устройство проверяем запросом хранилищ
+        if (!device->updateStorages()) {
+            m_lastError = MtpHandleTable::DISCONNECTED_ERROR;
+            return AttemptResult::Interrupted;
+        }
+        item.error = "File not found on device";
+        return AttemptResult::Failed;
+    }
+
+    MtpFileWriterOptions options;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        options = m_writerOptions;
+    }
+
+    MtpFileWriter writer(item.localPath, item.size, options);
+    bool opened = item.offset > 0 && writer.resume(item.offset);
+    if (!opened) {
+        // Временный файл пропал или укорочен: файл загружается заново
+        item.offset = 0;
+        opened = writer.open();
+    }
+    if (!opened) {
+        m_lastError = writer.getLastError();
+        return AttemptResult::Fatal;
+    }
+
+    bool writeFailed = false;
+    bool ok = file->readContent([&](const unsigned char* data, size_t length) {
+        if (!writer.write(data, length)) {
+            writeFailed = true;
+            return false;
+        }
+        return !transfer || transfer->update(baseBytes + writer.getBytesWritten());
+    }, item.offset);
+
+    if (ok) {
+        if (!writer.commit()) {
+            m_lastError = writer.getLastError();
+            item.offset = 0;
+            return AttemptResult::Fatal;
+        }
+        item.offset = item.size;
+        return AttemptResult::Completed;
+    }
+
+    if (writeFailed) {
+        m_lastError = writer.getLastError();
+        writer.abort();
+        item.offset = 0;
+        return AttemptResult::Fatal;
+    }
+
+    // Принятое сохраняем на диск: следующая попытка начнется с этого байта
+    if (!writer.suspend()) {
+        m_lastError = writer.getLastError();
+        item.offset = 0;
+        return AttemptResult::Fatal;
+    }
+    item.offset = writer.getBytesWritten();
+
+    if (transfer && transfer->isCancelRequested()) {
+        return AttemptResult::Cancelled;
+    }
+
+    m_lastError = file->getLastError();
+    return AttemptResult::Interrupted;
+}
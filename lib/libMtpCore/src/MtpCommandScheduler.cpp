@@ -0,0 +1,114 @@
+#include "MtpCommandScheduler.h"
+
+const uint32_t MtpCommandScheduler::DEFAULT_CHUNK_SIZE;
+
+MtpCommandScheduler::MtpCommandScheduler()
+    : m_chunkSize(DEFAULT_CHUNK_SIZE)
+    , m_stopping(false)
+{
+    m_worker = std::thread(&MtpCommandScheduler::run, this);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_workerId = m_worker.get_id();
+}
+
+MtpCommandScheduler::~MtpCommandScheduler()
+{
+    stop();
+}
+
+bool MtpCommandScheduler::post(MtpCommandPriority priority, Command command)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            return false;
+        }
+        m_queues[static_cast<int>(priority)].push_back(std::move(command));
+    }
+    m_condition.notify_one();
+    return true;
+}
+
+bool MtpCommandScheduler::isWorkerThread() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::this_thread::get_id() == m_workerId;
+}
+
+size_t MtpCommandScheduler::getPendingCount(MtpCommandPriority priority) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queues[static_cast<int>(priority)].size();
+}
+
+void MtpCommandScheduler::setChunkSize(uint32_t chunkSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_chunkSize = chunkSize ? chunkSize : DEFAULT_CHUNK_SIZE;
+}
+
+uint32_t MtpCommandScheduler::getChunkSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_chunkSize;
+}
+
+void MtpCommandScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    if (m_worker.joinable() && std::this_thread::get_id() != m_worker.get_id()) {
+        m_worker.join();
+    }
+}
+
+void MtpCommandScheduler::run()
+{
+    for (;;) {
+        Command command;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() {
+                return m_stopping || !m_queues[0].empty() || !m_queues[1].empty() || !m_queues[2].empty();
+            });
+
+            if (m_stopping) {
+                break;
+            }
+
+            // Берем команду из самой приоритетной непустой очереди
+            for (auto& queue : m_queues) {
+                if (!queue.empty()) {
+                    command = std::move(queue.front());
+                    queue.pop_front();
+                    break;
+                }
+            }
+        }
+
+        command();
+    }
+
+    // Оставшиеся команды выполняем, а не отбрасываем, чтобы ожидающие
+    // получили результат, а не broken_promise. Устройство к этому
+    // моменту уже снято с учета, и команды сразу завершаются ошибкой
+    std::deque<Command> remaining;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& queue : m_queues) {
+            for (auto& command : queue) {
+                remaining.push_back(std::move(command));
+            }
+            queue.clear();
+        }
+    }
+
+    for (auto& command : remaining) {
+        command();
+    }
+}
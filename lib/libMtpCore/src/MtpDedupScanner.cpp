@@ -0,0 +1,437 @@
+#include "MtpDedupScanner.h"
+#include "MtpFile.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const size_t READ_BUFFER_SIZE = 256 * 1024;
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+uint32_t rotateRight(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+// Хеш SHA-256 (FIPS 180-4), считаемый по мере поступления данных
+class Sha256 {
+public:
+    Sha256()
+        : m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+        , m_length(0)
+        , m_buffered(0)
+    {
+    }
+
+    void update(const unsigned char* data, size_t length)
+    {
+        m_length += length;
+        while (length > 0) {
+            size_t part = std::min(length, sizeof(m_buffer) - m_buffered);
+            memcpy(m_buffer + m_buffered, data, part);
+            m_buffered += part;
+            data += part;
+            length -= part;
+
+            if (m_buffered == sizeof(m_buffer)) {
+                processBlock(m_buffer);
+                m_buffered = 0;
+            }
+        }
+    }
+
+    std::array<unsigned char, 32> finish()
+    {
+        uint64_t bits = m_length * 8;
+
+        unsigned char padding[72] = {0x80};
+        size_t padLength = (m_buffered < 56 ? 56 : 120) - m_buffered;
+        update(padding, padLength);
+
+        unsigned char lengthBytes[8];
+        for (int i = 0; i < 8; ++i) {
+            lengthBytes[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        }
+        update(lengthBytes, sizeof(lengthBytes));
+
+        std::array<unsigned char, 32> digest;
+        for (int i = 0; i < 8; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                digest[i * 4 + j] = static_cast<unsigned char>(m_state[i] >> (24 - 8 * j));
+            }
+        }
+        return digest;
+    }
+
+private:
+    void processBlock(const unsigned char* block)
+    {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+                   (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+        uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+            uint32_t choice = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + choice + SHA256_K[i] + w[i];
+            uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+            uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + majority;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+        m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+    }
+
+    uint32_t m_state[8];
+    uint64_t m_length;
+    unsigned char m_buffer[64];
+    size_t m_buffered;
+};
+
+// Добавляет в хеш length байт локального файла, начиная с offset
+bool hashFileRange(FILE* file, uint64_t offset, uint64_t length, Sha256& sha)
+{
+    if (fseeko(file, static_cast<off_t>(offset), SEEK_SET) != 0) {
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(static_cast<size_t>(std::min<uint64_t>(length, READ_BUFFER_SIZE)));
+    while (length > 0) {
+        size_t part = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+        if (fread(buffer.data(), 1, part, file) != part) {
+            return false;
+        }
+        sha.update(buffer.data(), part);
+        length -= part;
+    }
+    return true;
+}
+
+} // namespace
+
+MtpDedupScanner::MtpDedupScanner(const MtpDedupOptions& options)
+    : m_options(options)
+    , m_bytesRead(0)
+{
+    if (m_options.sampleSize == 0) {
+        m_options.sampleSize = MtpDedupOptions().sampleSize;
+    }
+}
+
+bool MtpDedupScanner::addLocalDirectory(const std::string& path)
+{
+    DIR* directory = opendir(path.c_str());
+    if (!directory) {
+        m_lastError = "Cannot read directory: " + path;
+        return false;
+    }
+
+    bool ok = true;
+    while (dirent* entry = readdir(directory)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        std::string childPath = path + "/" + entry->d_name;
+        struct stat st;
+        if (stat(childPath.c_str(), &st) != 0) {
+            continue;
+        }
+
+        // Нечитаемая вложенная директория не мешает проиндексировать остальные
+        if (S_ISDIR(st.st_mode)) {
+            ok = addLocalDirectory(childPath) && ok;
+        } else if (S_ISREG(st.st_mode)) {
+            addLocalFile(childPath);
+        }
+    }
+
+    closedir(directory);
+    return ok;
+}
+
+bool MtpDedupScanner::addLocalFile(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        m_lastError = "Local file not found: " + path;
+        return false;
+    }
+
+    LocalFile local;
+    local.path = path;
+    size_t slash = path.find_last_of('/');
+    local.name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    local.size = static_cast<uint64_t>(st.st_size);
+    local.modificationDate = st.st_mtime;
+
+    m_bySize.emplace(local.size, m_locals.size());
+    m_locals.push_back(local);
+    return true;
+}
+
+size_t MtpDedupScanner::getLocalCount() const
+{
+    return m_locals.size();
+}
+
+MtpDedupResult MtpDedupScanner::check(const std::shared_ptr<MtpFile>& file)
+{
+    MtpDedupResult result;
+    result.file = file;
+    if (!file || file->isDirectory()) {
+        return result;
+    }
+
+    // Ступень 1: размер и метаданные, без обращения к устройству
+    uint64_t size = file->getSize();
+    std::vector<size_t> candidates;
+    auto range = m_bySize.equal_range(size);
+    for (auto it = range.first; it != range.second; ++it) {
+        const LocalFile& local = m_locals[it->second];
+        if (local.unreadable) {
+            continue;
+        }
+        if (m_options.matchName && local.name != file->getName()) {
+            continue;
+        }
+        if (m_options.matchModificationDate && local.modificationDate != file->getModificationDate()) {
+            continue;
+        }
+        candidates.push_back(it->second);
+    }
+
+    if (candidates.empty()) {
+        return result;
+    }
+
+    if (!isSampled(size)) {
+        result.localPath = matchContent(file, candidates);
+        return result;
+    }
+
+    // Ступень 2: начальный и конечный фрагменты
+    Digest sample;
+    if (!hashDeviceSample(file, sample)) {
+        // Без частичного чтения остается сравнение целиком
+        result.localPath = matchContent(file, candidates);
+        return result;
+    }
+
+    std::vector<size_t> matched;
+    for (size_t index : candidates) {
+        LocalFile& local = m_locals[index];
+        if (hashLocalSample(local) && local.sample == sample) {
+            matched.push_back(index);
+        }
+    }
+
+    if (matched.empty()) {
+        return result;
+    }
+
+    // Совпавшие локальные файлы могут быть копиями друг друга: тогда выбирать
+    // между ними не нужно, и полное чтение с устройства ничего не добавит
+    bool identical = true;
+    for (size_t i = 1; i < matched.size() && identical; ++i) {
+        LocalFile& first = m_locals[matched[0]];
+        LocalFile& other = m_locals[matched[i]];
+        identical = hashLocalContent(first) && hashLocalContent(other) && first.content == other.content;
+    }
+
+    // Ступень 3: файл целиком, только при неоднозначности
+    if (identical && !m_options.verifyContent) {
+        result.localPath = m_locals[matched[0]].path;
+    } else {
+        result.localPath = matchContent(file, matched);
+    }
+    return result;
+}
+
+std::vector<MtpDedupResult> MtpDedupScanner::scan(const std::vector<std::shared_ptr<MtpFile>>& files,
+                                                  ProgressCallback progress)
+{
+    std::vector<MtpDedupResult> results;
+    results.reserve(files.size());
+
+    uint64_t checked = 0;
+    for (const auto& file : files) {
+        if (progress && !progress(checked, files.size())) {
+            m_lastError = "Scan aborted";
+            break;
+        }
+
+        if (!file->isDirectory()) {
+            results.push_back(check(file));
+        }
+        ++checked;
+    }
+
+    if (progress && checked == files.size()) {
+        progress(checked, files.size());
+    }
+
+    return results;
+}
+
+uint64_t MtpDedupScanner::getBytesRead() const
+{
+    return m_bytesRead;
+}
+
+std::string MtpDedupScanner::getLastError() const
+{
+    return m_lastError;
+}
+
+bool MtpDedupScanner::isSampled(uint64_t size) const
+{
+    return size > 2 * static_cast<uint64_t>(m_options.sampleSize);
+}
+
+bool MtpDedupScanner::hashLocalSample(LocalFile& local)
+{
+    if (local.hasSample) {
+        return true;
+    }
+    if (local.unreadable) {
+        return false;
+    }
+
+    FILE* file = fopen(local.path.c_str(), "rb");
+    Sha256 sha;
+    bool ok = file &&
+              hashFileRange(file, 0, m_options.sampleSize, sha) &&
+              hashFileRange(file, local.size - m_options.sampleSize, m_options.sampleSize, sha);
+    if (file) {
+        fclose(file);
+    }
+
+    if (!ok) {
+        m_lastError = "Cannot read local file: " + local.path;
+        local.unreadable = true;
+        return false;
+    }
+
+    local.sample = sha.finish();
+    local.hasSample = true;
+    return true;
+}
+
+bool MtpDedupScanner::hashLocalContent(LocalFile& local)
+{
+    if (local.hasContent) {
+        return true;
+    }
+    if (local.unreadable) {
+        return false;
+    }
+
+    FILE* file = fopen(local.path.c_str(), "rb");
+    Sha256 sha;
+    bool ok = file && hashFileRange(file, 0, local.size, sha);
+    if (file) {
+        fclose(file);
+    }
+
+    if (!ok) {
+        m_lastError = "Cannot read local file: " + local.path;
+        local.unreadable = true;
+        return false;
+    }
+
+    local.content = sha.finish();
+    local.hasContent = true;
+    return true;
+}
+
+bool MtpDedupScanner::hashDeviceSample(const std::shared_ptr<MtpFile>& file, Digest& digest)
+{
+    std::vector<unsigned char> head;
+    std::vector<unsigned char> tail;
+    uint64_t size = file->getSize();
+
+    bool ok = file->readRange(0, m_options.sampleSize, head);
+    m_bytesRead += head.size();
+    ok = ok && file->readRange(size - m_options.sampleSize, m_options.sampleSize, tail);
+    m_bytesRead += tail.size();
+
+    if (!ok) {
+        m_lastError = file->getLastError();
+        return false;
+    }
+
+    Sha256 sha;
+    sha.update(head.data(), head.size());
+    sha.update(tail.data(), tail.size());
+    digest = sha.finish();
+    return true;
+}
+
+bool MtpDedupScanner::hashDeviceContent(const std::shared_ptr<MtpFile>& file, Digest& digest)
+{
+    Sha256 sha;
+    bool ok = file->readContent([&](const unsigned char* data, size_t length) {
+        sha.update(data, length);
+        m_bytesRead += length;
+        return true;
+    });
+
+    if (!ok) {
+        m_lastError = file->getLastError();
+        return false;
+    }
+
+    digest = sha.finish();
+    return true;
+}
+
+std::string MtpDedupScanner::matchContent(const std::shared_ptr<MtpFile>& file, const std::vector<size_t>& candidates)
+{
+    Digest digest;
+    if (!hashDeviceContent(file, digest)) {
+        return std::string();
+    }
+
+    for (size_t index : candidates) {
+        LocalFile& local = m_locals[index];
+        if (hashLocalContent(local) && local.content == digest) {
+            return local.path;
+        }
+    }
+    return std::string();
+}
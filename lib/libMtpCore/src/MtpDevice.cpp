@@ -1,27 +1,54 @@
 #include "MtpDevice.h"
+#include "MtpBackend.h"
 #include "MtpStorage.h"
+#include "MtpCommandScheduler.h"
+#include "MtpHandle.h"
+#include "MtpTypes.h"
 #include <algorithm>
 #include <iostream>
 
 MtpDevice::MtpDevice(LIBMTP_mtpdevice_t* device, LIBMTP_raw_device_t rawDevice)
     : m_device(device)
     , m_rawDevice(rawDevice)
+    , m_handle(MtpHandleTable::instance().add(device))
+    , m_scheduler(std::make_shared<MtpCommandScheduler>())
+    , m_nextCallbackId(1)
 {
+    MtpBackend::instance().deviceOpened(m_device, m_rawDevice);
+
     // Обновляем список хранилищ при создании объекта
     updateStorages();
+
+    m_eventListener.reset(new MtpEventListener(m_device, [this](const MtpDeviceEvent& event) {
+        handleEvent(event);
+    }));
+    startEventListener();
 }
 
 MtpDevice::~MtpDevice()
 {
+    // Сначала делаем недействительными ссылки на устройство, чтобы
+    // пережившие его файлы и хранилища получали ошибку, затем перестаем
+    // получать события, останавливаем планировщик и только после этого
+    // освобождаем устройство
+    MtpHandleTable::instance().remove(m_handle);
+    m_eventListener.reset();
+    m_scheduler->stop();
+
     if (m_device) {
-        LIBMTP_Release_Device(m_device);
+        // Запрос события мог остаться ожидающим, если устройство молчит;
+        // блокировка исключает только потоки слушателей
+        std::unique_lock<std::mutex> events = MtpEventListener::blockEvents();
+        MtpBackend::instance().releaseDevice(m_device);
         m_device = nullptr;
     }
 }
 
 std::string MtpDevice::getFriendlyName() const
 {
-    char* name = LIBMTP_Get_Friendlyname(m_device);
+    char* name = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        return MtpBackend::instance().getFriendlyname(m_device);
+    });
     if (name) {
         std::string result(name);
         free(name);
@@ -32,7 +59,9 @@ std::string MtpDevice::getFriendlyName() const
 
 std::string MtpDevice::getManufacturer() const
 {
-    char* manufacturer = LIBMTP_Get_Manufacturername(m_device);
+    char* manufacturer = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        return MtpBackend::instance().getManufacturername(m_device);
+    });
     if (manufacturer) {
         std::string result(manufacturer);
         free(manufacturer);
@@ -43,7 +72,9 @@ std::string MtpDevice::getManufacturer() const
 
 std::string MtpDevice::getModelName() const
 {
-    char* model = LIBMTP_Get_Modelname(m_device);
+    char* model = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        return MtpBackend::instance().getModelname(m_device);
+    });
     if (model) {
         std::string result(model);
         free(model);
@@ -54,7 +85,9 @@ std::string MtpDevice::getModelName() const
 
 std::string MtpDevice::getSerialNumber() const
 {
-    char* serial = LIBMTP_Get_Serialnumber(m_device);
+    char* serial = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        return MtpBackend::instance().getSerialnumber(m_device);
+    });
     if (serial) {
         std::string result(serial);
         free(serial);
@@ -65,7 +98,9 @@ std::string MtpDevice::getSerialNumber() const
 
 std::string MtpDevice::getDeviceVersion() const
 {
-    char* version = LIBMTP_Get_Deviceversion(m_device);
+    char* version = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        return MtpBackend::instance().getDeviceversion(m_device);
+    });
     if (version) {
         std::string result(version);
         free(version);
@@ -81,6 +116,11 @@ std::string MtpDevice::getMtpVersion() const
     return std::to_string(major) + "." + std::to_string(minor);
 }
 
+LIBMTP_raw_device_t MtpDevice::getRawDevice() const
+{
+    return m_rawDevice;
+}
+
 bool MtpDevice::updateStorages()
 {
     if (!m_device) {
@@ -88,37 +128,49 @@ bool MtpDevice::updateStorages()
         return false;
     }
 
-    // Очищаем текущий список хранилищ
-    m_storages.clear();
-
-    // Получаем список хранилищ с устройства
-    LIBMTP_devicestorage_t* storageList = LIBMTP_Get_Storage(m_device, LIBMTP_STORAGE_SORTBY_NOTSORTED);
-    
-    if (!storageList) {
-        m_lastError = "Failed to get storage list";
-        return false;
-    }
+    return runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        // LIBMTP_Get_Storage пересоздает список device->storage, поэтому
+        // указатели на его элементы нигде не сохраняются
+        if (MtpBackend::instance().getStorage(m_device, LIBMTP_STORAGE_SORTBY_NOTSORTED) != 0) {
+            MtpBackend::instance().clearErrorstack(m_device);
+            m_lastError = "Failed to get storage list";
+            return false;
+        }
 
-    // Итерируемся по списку хранилищ и создаем объекты MtpStorage
-    LIBMTP_devicestorage_t* current = storageList;
-    while (current) {
-        std::shared_ptr<MtpStorage> storage = std::make_shared<MtpStorage>(m_device, current);
-        m_storages.push_back(storage);
-        current = current->next;
-    }
+        std::vector<std::shared_ptr<MtpStorage>> previous = getAllStorages();
 
-    // Не освобождаем storageList, так как это будет сделано при освобождении устройства
+        // Существующие хранилища обновляются на месте и сохраняют индекс
+        // и подписчиков; для новых создаются объекты MtpStorage
+        std::vector<std::shared_ptr<MtpStorage>> storages;
+        for (LIBMTP_devicestorage_t* current = m_device->storage; current; current = current->next) {
+            auto it = std::find_if(previous.begin(), previous.end(),
+                                   [current](const std::shared_ptr<MtpStorage>& storage) {
+                                       return storage->getId() == current->id;
+                                   });
+            if (it != previous.end()) {
+                (*it)->update(current);
+                storages.push_back(*it);
+            } else {
+                storages.push_back(std::make_shared<MtpStorage>(m_handle, current, m_scheduler));
+            }
+        }
 
-    return !m_storages.empty();
+        // Список может обновляться из потока планировщика по событию устройства
+        std::lock_guard<std::mutex> lock(m_storagesMutex);
+        m_storages.swap(storages);
+        return !m_storages.empty();
+    });
 }
 
 size_t MtpDevice::getStorageCount() const
 {
+    std::lock_guard<std::mutex> lock(m_storagesMutex);
     return m_storages.size();
 }
 
 std::shared_ptr<MtpStorage> MtpDevice::getStorage(size_t index) const
 {
+    std::lock_guard<std::mutex> lock(m_storagesMutex);
     if (index >= m_storages.size()) {
         return nullptr;
     }
@@ -128,6 +180,7 @@ std::shared_ptr<MtpStorage> MtpDevice::getStorage(size_t index) const
 
 std::vector<std::shared_ptr<MtpStorage>> MtpDevice::getAllStorages() const
 {
+    std::lock_guard<std::mutex> lock(m_storagesMutex);
     return m_storages;
 }
 
@@ -139,4 +192,118 @@ std::string MtpDevice::getLastError() const
 LIBMTP_mtpdevice_t* MtpDevice::getLibMtpDevice() const
 {
     return m_device;
-}
\ No newline at end of file
+}
+
+MtpDeviceHandle MtpDevice::getHandle() const
+{
+    return m_handle;
+}
+
+std::shared_ptr<MtpCommandScheduler> MtpDevice::getScheduler() const
+{
+    return m_scheduler;
+}
+
+int MtpDevice::registerEventCallback(EventCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_callbackMutex);
+
+    int callbackId = m_nextCallbackId++;
+    m_eventCallbacks.push_back(std::make_pair(callbackId, callback));
+
+    return callbackId;
+}
+
+bool MtpDevice::unregisterEventCallback(int callbackId)
+{
+    std::lock_guard<std::mutex> lock(m_callbackMutex);
+
+    auto it = std::find_if(m_eventCallbacks.begin(), m_eventCallbacks.end(),
+                          [callbackId](const std::pair<int, EventCallback>& pair) {
+                              return pair.first == callbackId;
+                          });
+
+    if (it != m_eventCallbacks.end()) {
+        m_eventCallbacks.erase(it);
+        return true;
+    }
+
+    return false;
+}
+
+bool MtpDevice::startEventListener()
+{
+    return m_eventListener->start();
+}
+
+void MtpDevice::stopEventListener()
+{
+    m_eventListener->stop();
+}
+
+bool MtpDevice::isEventListenerRunning() const
+{
+    return m_eventListener->isRunning();
+}
+
+void MtpDevice::handleEvent(const MtpDeviceEvent& event)
+{
+    // Поток событий не должен ждать устройство: запросы к нему выполняет планировщик.
+    // Все события идут с одним приоритетом, поэтому их порядок сохраняется
+    m_scheduler->post(MtpCommandPriority::Interactive, [this, event]() {
+        dispatchEvent(event);
+    });
+}
+
+void MtpDevice::dispatchEvent(MtpDeviceEvent event)
+{
+    // Команда могла остаться в очереди после снятия устройства с учета
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_handle);
+    if (!device) {
+        return;
+    }
+
+    switch (event.type) {
+    case MtpDeviceEventType::ObjectAdded: {
+        LIBMTP_file_t* file = MtpBackend::instance().getFilemetadata(device, event.param);
+        if (!file) {
+            // Объект мог быть удален раньше, чем мы о нем спросили
+            MtpBackend::instance().clearErrorstack(device);
+            return;
+        }
+        event.info = makeObjectInfo(file, 0);
+        LIBMTP_destroy_file_t(file);
+
+        for (const auto& storage : getAllStorages()) {
+            if (storage->getId() == event.info.storageId) {
+                storage->notifyObjectChange(MtpObjectChangeType::Added, event.info);
+            }
+        }
+        break;
+    }
+    case MtpDeviceEventType::ObjectRemoved:
+        // Хранилище удаленного объекта уже не узнать; ID уникальны в пределах устройства
+        for (const auto& storage : getAllStorages()) {
+            storage->notifyObjectChange(MtpObjectChangeType::Removed, event.info);
+        }
+        break;
+    case MtpDeviceEventType::StoreAdded:
+    case MtpDeviceEventType::StoreRemoved:
+        updateStorages();
+        break;
+    case MtpDeviceEventType::DevicePropertyChanged:
+        break;
+    }
+
+    std::vector<EventCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_callbackMutex);
+        for (const auto& pair : m_eventCallbacks) {
+            callbacks.push_back(pair.second);
+        }
+    }
+
+    for (const auto& callback : callbacks) {
+        callback(event);
+    }
+}
@@ -0,0 +1,284 @@
+#include "MtpDeviceCopy.h"
+#include "MtpFile.h"
+#include "MtpDirectory.h"
+#include "MtpTransfer.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+/**
+ * @brief Ограниченный кольцевой буфер между потоком чтения и потоком записи
+ */
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity)
+        : m_buffer(capacity)
+        , m_head(0)
+        , m_size(0)
+        , m_closed(false)
+        , m_aborted(false)
+    {
+    }
+
+    // Записывает данные; ждет, пока в буфере появится место
+    bool write(const unsigned char* data, size_t length)
+    {
+        while (length > 0) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this]() { return m_aborted || m_size < m_buffer.size(); });
+            if (m_aborted) {
+                return false;
+            }
+
+            size_t tail = (m_head + m_size) % m_buffer.size();
+            size_t count = std::min(length, std::min(m_buffer.size() - m_size, m_buffer.size() - tail));
+            memcpy(&m_buffer[tail], data, count);
+            m_size += count;
+            data += count;
+            length -= count;
+
+            lock.unlock();
+            m_notEmpty.notify_one();
+        }
+        return true;
+    }
+
+    // Читает до length байт; 0 означает конец данных или прерывание
+    size_t read(unsigned char* data, size_t length)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return m_aborted || m_closed || m_size > 0; });
+        if (m_aborted) {
+            return 0;
+        }
+
+        size_t count = std::min(length, std::min(m_size, m_buffer.size() - m_head));
+        memcpy(data, &m_buffer[m_head], count);
+        m_head = (m_head + count) % m_buffer.size();
+        m_size -= count;
+
+        lock.unlock();
+        m_notFull.notify_one();
+        return count;
+    }
+
+    // Сообщает, что данных больше не будет
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_notEmpty.notify_all();
+    }
+
+    // Ждет окончания записи; true если данные переданы полностью
+    bool waitClosed()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return m_aborted || m_closed; });
+        return !m_aborted;
+    }
+
+    // Прерывает обмен с обеих сторон
+    void abort()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_aborted = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    std::vector<unsigned char> m_buffer;
+    size_t m_head;
+    size_t m_size;
+    bool m_closed;
+    bool m_aborted;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+} // namespace
+
+const size_t MtpDeviceCopy::DEFAULT_BUFFER_SIZE;
+
+MtpDeviceCopy::MtpDeviceCopy(size_t bufferSize)
+    : m_bufferSize(bufferSize ? bufferSize : DEFAULT_BUFFER_SIZE)
+{
+}
+
+uint32_t MtpDeviceCopy::copyFile(const std::shared_ptr<MtpFile>& source, const std::shared_ptr<MtpDirectory>& target,
+                                 std::shared_ptr<MtpTransfer> transfer)
+{
+    if (transfer) {
+        transfer->begin(source->getSize());
+    }
+
+    uint32_t newFileId = streamFile(source, target, 0, transfer.get());
+
+    if (transfer) {
+        if (newFileId == 0 && transfer->isCancelRequested()) {
+            transfer->finish(MtpTransferState::Cancelled);
+        } else {
+            transfer->finish(newFileId ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    return newFileId;
+}
+
+bool MtpDeviceCopy::copyTree(const std::shared_ptr<MtpDirectory>& source, const std::shared_ptr<MtpDirectory>& target,
+                             std::shared_ptr<MtpTransfer> transfer)
+{
+    std::vector<PendingCopy> files;
+    uint64_t totalBytes = 0;
+
+    if (!collectTree(source, target, files, totalBytes)) {
+        return false;
+    }
+
+    if (transfer) {
+        transfer->begin(totalBytes);
+    }
+
+    bool ok = true;
+    uint64_t copied = 0;
+    for (const auto& file : files) {
+        if (streamFile(file.source, file.target, copied, transfer.get()) == 0) {
+            ok = false;
+            break;
+        }
+        copied += file.source->getSize();
+    }
+
+    if (transfer) {
+        if (!ok && transfer->isCancelRequested()) {
+            transfer->finish(MtpTransferState::Cancelled);
+        } else {
+            transfer->finish(ok ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    return ok;
+}
+
+std::string MtpDeviceCopy::getLastError() const
+{
+    return m_lastError;
+}
+
+uint32_t MtpDeviceCopy::streamFile(const std::shared_ptr<MtpFile>& source, const std::shared_ptr<MtpDirectory>& target,
+                                   uint64_t baseOffset, MtpTransfer* transfer)
+{
+    // Оба потока заняли бы один и тот же сеанс MTP и ждали бы друг друга
+    if (source->isOnSameDevice(*target)) {
+        m_lastError = "Source and target are on the same device";
+        return 0;
+    }
+
+    RingBuffer ring(m_bufferSize);
+    const uint64_t size = source->getSize();
+    bool readOk = false;
+    bool tooLong = false;
+    uint64_t received = 0;
+    std::string readError;
+
+    // Чтение с исходного устройства идет параллельно с отправкой на целевое
+    // Темп выдерживает поток чтения: отправка идет одной командой
+    // целевого устройства, и ее рабочий поток ждать не должен
+    std::thread reader([&]() {
+        readOk = source->readContent([&](const unsigned char* data, size_t length) {
+            // Размер объекта уже объявлен целевому устройству
+            if (received + length > size) {
+                tooLong = true;
+                return false;
+            }
+            if (!ring.write(data, length)) {
+                return false;
+            }
+            received += length;
+            if (transfer) {
+                transfer->pace(baseOffset + received);
+            }
+            return true;
+        });
+
+        if (readOk && received == size) {
+            ring.close();
+        } else {
+            if (!readOk) {
+                readError = source->getLastError();
+            }
+            ring.abort();
+        }
+    });
+
+    bool cancelled = false;
+    uint64_t sent = 0;
+    uint32_t newFileId = target->sendData(source->getName(), size,
+        [&](unsigned char* buffer, size_t length) -> size_t {
+            size_t count = ring.read(buffer, length);
+            sent += count;
+            if (transfer && !transfer->report(baseOffset + sent)) {
+                cancelled = true;
+                ring.abort();
+                return 0;
+            }
+            // Последнюю часть отдаем, только когда источник закончился
+            // ровно на объявленном размере, иначе объект останется обрезанным
+            if (count > 0 && sent == size && !ring.waitClosed()) {
+                return 0;
+            }
+            return count;
+        }, source->getModificationDate(), transfer);
+
+    // Поток чтения может ждать места в буфере, если отправка прервалась
+    // раньше или источник отдает больше байт, чем было объявлено
+    ring.abort();
+    reader.join();
+
+    if (newFileId == 0) {
+        if (cancelled) {
+            m_lastError = "Transfer cancelled";
+        } else if (tooLong || (readOk && received != size)) {
+            m_lastError = "File size changed during copy: " + source->getName();
+        } else if (!readOk && !readError.empty()) {
+            m_lastError = "Failed to read " + source->getName() + ": " + readError;
+        } else {
+            m_lastError = "Failed to write " + source->getName() + ": " + target->getLastError();
+        }
+    }
+
+    return newFileId;
+}
+
+bool MtpDeviceCopy::collectTree(const std::shared_ptr<MtpDirectory>& source, const std::shared_ptr<MtpDirectory>& target,
+                                std::vector<PendingCopy>& files, uint64_t& totalBytes)
+{
+    std::shared_ptr<MtpDirectory> copy = target->createSubdirectory(source->getName());
+    if (!copy) {
+        m_lastError = "Failed to create directory " + source->getName() + ": " + target->getLastError();
+        return false;
+    }
+
+    for (const auto& entry : source->getContent()) {
+        if (entry->isDirectory()) {
+            if (!collectTree(std::static_pointer_cast<MtpDirectory>(entry), copy, files, totalBytes)) {
+                return false;
+            }
+        } else {
+            files.push_back({entry, copy});
+            totalBytes += entry->getSize();
+        }
+    }
+
+    return true;
+}
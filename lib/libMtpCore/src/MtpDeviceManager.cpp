@@ -8,6 +8,10 @@ MtpDeviceManager::MtpDeviceManager()
     , m_rawDevices(nullptr)
     , m_rawDeviceCount(0)
     , m_nextCallbackId(1)
+    , m_generation(0)
+    , m_detecting(false)
+    , m_detectionRunning(false)
+    , m_rescanRequested(false)
 {
 }
 
@@ -18,22 +22,30 @@ MtpDeviceManager::~MtpDeviceManager()
 
 bool MtpDeviceManager::initialize()
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    
-    if (m_initialized) {
-        return true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_initialized) {
+            return true;
+        }
+
+        // Инициализируем библиотеку libmtp
+        LIBMTP_Init();
+        m_initialized = true;
     }
-    
-    // Инициализируем библиотеку libmtp
-    LIBMTP_Init();
-    m_initialized = true;
-    
-    // Попробуем сразу обнаружить устройства
-    return detectDevices();
+
+    // Обнаруживаем устройства в фоне; о готовности сообщат функции обратного вызова
+    detectDevicesAsync();
+
+    return true;
 }
 
 void MtpDeviceManager::shutdown()
 {
+    // Дожидаемся фонового обнаружения до захвата мьютекса,
+    // так как рабочие потоки публикуют устройства под ним
+    waitForDetection();
+
     std::lock_guard<std::mutex> lock(m_mutex);
     
     if (!m_initialized) {
@@ -55,67 +67,208 @@ void MtpDeviceManager::shutdown()
 
 bool MtpDeviceManager::detectDevices()
 {
+    std::vector<LIBMTP_raw_device_t> rawDevices;
+    uint64_t generation = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_initialized) {
+            m_lastError = "MTP library not initialized";
+            return false;
+        }
+
+        // Очищаем текущий список устройств
+        clearDevices();
+
+        // Освобождаем предыдущий список сырых устройств, если он существует
+        if (m_rawDevices) {
+            free(m_rawDevices);
+            m_rawDevices = nullptr;
+            m_rawDeviceCount = 0;
+        }
+
+        // Получаем список сырых устройств
+        int ret = LIBMTP_Detect_Raw_Devices(&m_rawDevices, &m_rawDeviceCount);
+
+        if (ret != LIBMTP_ERROR_NONE) {
+            switch (ret) {
+                case LIBMTP_ERROR_NO_DEVICE_ATTACHED:
+                    m_lastError = "No devices found";
+                    return false;
+                case LIBMTP_ERROR_CONNECTING:
+                    m_lastError = "Error connecting to device";
+                    return false;
+                case LIBMTP_ERROR_MEMORY_ALLOCATION:
+                    m_lastError = "Memory allocation error";
+                    return false;
+                default:
+                    m_lastError = "Unknown error: " + std::to_string(ret);
+                    return false;
+            }
+        }
+
+        // Проверяем, есть ли устройства
+        if (m_rawDeviceCount <= 0) {
+            m_lastError = "No devices found";
+            return false;
+        }
+
+        // Рабочие потоки получают копии структур, так как m_rawDevices
+        // может быть освобожден следующим проходом обнаружения
+        rawDevices.assign(m_rawDevices, m_rawDevices + m_rawDeviceCount);
+        generation = ++m_generation;
+        m_detecting = true;
+    }
+
+    // Уведомляем об очистке списка устройств
+    notifyDeviceChange();
+
+    // Открываем устройства параллельно: время до появления первого
+    // устройства определяется самым быстрым установлением сеанса
+    std::vector<std::thread> workers;
+    workers.reserve(rawDevices.size());
+    for (const auto& rawDevice : rawDevices) {
+        workers.emplace_back(&MtpDeviceManager::openDevice, this, rawDevice, generation);
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
     std::lock_guard<std::mutex> lock(m_mutex);
-    
-    if (!m_initialized) {
-        m_lastError = "MTP library not initialized";
+
+    if (generation == m_generation) {
+        m_detecting = false;
+    }
+
+    if (m_devices.empty()) {
+        m_lastError = "Failed to open any device";
         return false;
     }
-    
-    // Очищаем текущий список устройств
-    clearDevices();
-    
-    // Освобождаем предыдущий список сырых устройств, если он существует
-    if (m_rawDevices) {
-        free(m_rawDevices);
-        m_rawDevices = nullptr;
-        m_rawDeviceCount = 0;
+
+    return true;
+}
+
+void MtpDeviceManager::detectDevicesAsync()
+{
+    std::lock_guard<std::mutex> lock(m_detectionMutex);
+
+    {
+        // Функции обратного вызова вызываются из потока обнаружения и его
+        // рабочих потоков, поэтому ждать его здесь нельзя: идущий проход
+        // сам повторит обнаружение после завершения
+        std::lock_guard<std::mutex> stateLock(m_mutex);
+        if (m_detectionRunning) {
+            m_rescanRequested = true;
+            return;
+        }
+        m_detectionRunning = true;
     }
-    
-    // Получаем список сырых устройств
-    int ret = LIBMTP_Detect_Raw_Devices(&m_rawDevices, &m_rawDeviceCount);
-    
-    if (ret != LIBMTP_ERROR_NONE) {
-        switch (ret) {
-            case LIBMTP_ERROR_NO_DEVICE_ATTACHED:
-                m_lastError = "No devices found";
-                return false;
-            case LIBMTP_ERROR_CONNECTING:
-                m_lastError = "Error connecting to device";
-                return false;
-            case LIBMTP_ERROR_MEMORY_ALLOCATION:
-                m_lastError = "Memory allocation error";
-                return false;
-            default:
-                m_lastError = "Unknown error: " + std::to_string(ret);
-                return false;
+
+    // Предыдущий поток уже вышел из цикла обнаружения и не вызывает
+    // функции обратного вызова, поэтому join не блокируется
+    if (m_detectionThread.joinable()) {
+        m_detectionThread.join();
+    }
+
+    m_detectionThread = std::thread([this]() {
+        for (;;) {
+            detectDevices();
+
+            std::lock_guard<std::mutex> stateLock(m_mutex);
+            if (!m_rescanRequested) {
+                m_detectionRunning = false;
+                return;
+            }
+            m_rescanRequested = false;
         }
+    });
+}
+
+bool MtpDeviceManager::isDetecting() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_detecting;
+}
+
+void MtpDeviceManager::waitForDetection()
+{
+    std::lock_guard<std::mutex> lock(m_detectionMutex);
+
+    if (m_detectionThread.joinable() && m_detectionThread.get_id() != std::this_thread::get_id()) {
+        m_detectionThread.join();
     }
-    
-    // Проверяем, есть ли устройства
-    if (m_rawDeviceCount <= 0) {
-        m_lastError = "No devices found";
-        return false;
+}
+
+std::shared_ptr<MtpDevice> MtpDeviceManager::reconnectDevice(const std::string& serialNumber)
+{
+    std::vector<LIBMTP_raw_device_t> candidates;
+    uint64_t generation = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_initialized) {
+            m_lastError = "MTP library not initialized";
+            return nullptr;
+        }
+
+        LIBMTP_raw_device_t* rawDevices = nullptr;
+        int rawDeviceCount = 0;
+        if (LIBMTP_Detect_Raw_Devices(&rawDevices, &rawDeviceCount) != LIBMTP_ERROR_NONE) {
+            m_lastError = "Device not found";
+            return nullptr;
+        }
+
+        // Открытые устройства держат свой интерфейс USB; повторно
+        // открываются только сырые устройства, которых нет в списке
+        for (int i = 0; i < rawDeviceCount; ++i) {
+            const LIBMTP_raw_device_t& rawDevice = rawDevices[i];
+            bool known = std::any_of(m_devices.begin(), m_devices.end(),
+                                     [&rawDevice](const std::shared_ptr<MtpDevice>& device) {
+                                         LIBMTP_raw_device_t opened = device->getRawDevice();
+                                         return opened.bus_location == rawDevice.bus_location
+                                             && opened.devnum == rawDevice.devnum;
+                                     });
+            if (!known) {
+                candidates.push_back(rawDevice);
+            }
+        }
+        free(rawDevices);
+
+        generation = m_generation;
     }
-    
-    // Создаем объекты устройств на основе сырых устройств
-    for (int i = 0; i < m_rawDeviceCount; i++) {
-        // Открываем устройство с помощью libmtp
-        LIBMTP_mtpdevice_t* mtpDevice = LIBMTP_Open_Raw_Device_Uncached(&m_rawDevices[i]);
-        
-        if (mtpDevice) {
-            // Создаем объект MtpDevice и добавляем его в список
-            std::shared_ptr<MtpDevice> device = std::make_shared<MtpDevice>(mtpDevice, m_rawDevices[i]);
-            m_devices.push_back(device);
-        } else {
-            std::cerr << "Failed to open device at index " << i << std::endl;
+
+    std::shared_ptr<MtpDevice> result;
+    for (const auto& rawDevice : candidates) {
+        std::shared_ptr<MtpDevice> device = openDevice(rawDevice, generation);
+        if (device && device->getSerialNumber() == serialNumber) {
+            result = device;
         }
     }
-    
-    // Уведомляем об изменении списка устройств
+
+    if (!result) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = "Device not found";
+    }
+    return result;
+}
+
+bool MtpDeviceManager::removeDevice(const std::shared_ptr<MtpDevice>& device)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = std::find(m_devices.begin(), m_devices.end(), device);
+        if (it == m_devices.end()) {
+            return false;
+        }
+        m_devices.erase(it);
+    }
+
     notifyDeviceChange();
-    
-    return !m_devices.empty();
+    return true;
 }
 
 size_t MtpDeviceManager::getDeviceCount() const
@@ -135,6 +288,18 @@ std::shared_ptr<MtpDevice> MtpDeviceManager::getDevice(size_t index) const
     return m_devices[index];
 }
 
+std::shared_ptr<MtpDevice> MtpDeviceManager::getDevice(MtpDeviceHandle handle) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_devices.begin(), m_devices.end(),
+                           [handle](const std::shared_ptr<MtpDevice>& device) {
+                               return device->getHandle() == handle;
+                           });
+
+    return it != m_devices.end() ? *it : nullptr;
+}
+
 std::vector<std::shared_ptr<MtpDevice>> MtpDeviceManager::getAllDevices() const
 {
     std::lock_guard<std::mutex> lock(m_mutex);
@@ -173,6 +338,33 @@ bool MtpDeviceManager::unregisterDeviceChangeCallback(int callbackId)
     return false;
 }
 
+int MtpDeviceManager::registerDeviceReadyCallback(DeviceReadyCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    int callbackId = m_nextCallbackId++;
+    m_readyCallbacks.push_back(std::make_pair(callbackId, callback));
+
+    return callbackId;
+}
+
+bool MtpDeviceManager::unregisterDeviceReadyCallback(int callbackId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_readyCallbacks.begin(), m_readyCallbacks.end(),
+                          [callbackId](const std::pair<int, DeviceReadyCallback>& pair) {
+                              return pair.first == callbackId;
+                          });
+
+    if (it != m_readyCallbacks.end()) {
+        m_readyCallbacks.erase(it);
+        return true;
+    }
+
+    return false;
+}
+
 std::string MtpDeviceManager::getLastError() const
 {
     std::lock_guard<std::mutex> lock(m_mutex);
@@ -187,6 +379,51 @@ void MtpDeviceManager::clearDevices()
     // Устройства libmtp будут освобождены деструкторами MtpDevice
 }
 
+std::shared_ptr<MtpDevice> MtpDeviceManager::openDevice(LIBMTP_raw_device_t rawDevice, uint64_t generation)
+{
+    // Открываем устройство с помощью libmtp (установление сеанса)
+    LIBMTP_mtpdevice_t* mtpDevice = LIBMTP_Open_Raw_Device_Uncached(&rawDevice);
+
+    if (!mtpDevice) {
+        std::cerr << "Failed to open device " << rawDevice.bus_location
+                  << ":" << static_cast<int>(rawDevice.devnum) << std::endl;
+        return nullptr;
+    }
+
+    // Конструктор запрашивает список хранилищ, поэтому тоже выполняется в рабочем потоке
+    std::shared_ptr<MtpDevice> device = std::make_shared<MtpDevice>(mtpDevice, rawDevice);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Пока устройство открывалось, мог начаться новый проход обнаружения
+        if (generation != m_generation || !m_initialized) {
+            return nullptr;
+        }
+
+        m_devices.push_back(device);
+    }
+
+    notifyDeviceChange();
+    notifyDeviceReady(device);
+    return device;
+}
+
+void MtpDeviceManager::notifyDeviceReady(const std::shared_ptr<MtpDevice>& device)
+{
+    std::vector<DeviceReadyCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& pair : m_readyCallbacks) {
+            callbacks.push_back(pair.second);
+        }
+    }
+
+    for (const auto& callback : callbacks) {
+        callback(device);
+    }
+}
+
 void MtpDeviceManager::notifyDeviceChange()
 {
     // Создаем локальную копию списка функций обратного вызова,
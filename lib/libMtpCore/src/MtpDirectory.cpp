@@ -0,0 +1,284 @@
+#include "MtpDirectory.h"
+#include "MtpBackend.h"
+#include "MtpObjectNotifier.h"
+#include "MtpCommandScheduler.h"
+#include "MtpListingCache.h"
+#include "MtpTransfer.h"
+#include <sys/stat.h>
+#include <cstring>
+#include <iostream>
+
+MtpDirectory::MtpDirectory(MtpDeviceHandle device, uint32_t id, uint32_t storageId,
+                           const std::string& name, uint32_t parentId,
+                           std::shared_ptr<MtpObjectNotifier> notifier,
+                           std::shared_ptr<MtpCommandScheduler> scheduler,
+                           std::shared_ptr<MtpListingCache> listings)
+    : MtpFile(device, id, storageId, name, parentId, notifier, scheduler, listings)
+{
+}
+
+MtpDirectory::MtpDirectory(MtpDeviceHandle device, const MtpObjectInfo& info,
+                           std::shared_ptr<MtpObjectNotifier> notifier,
+                           std::shared_ptr<MtpCommandScheduler> scheduler,
+                           std::shared_ptr<MtpListingCache> listings)
+    : MtpFile(device, info, notifier, scheduler, listings)
+{
+    m_type = LIBMTP_FILETYPE_FOLDER;
+}
+
+MtpDirectory::~MtpDirectory()
+{
+}
+
+bool MtpDirectory::isDirectory() const
+{
+    return true;
+}
+
+std::vector<std::shared_ptr<MtpFile>> MtpDirectory::getContent()
+{
+    std::vector<std::shared_ptr<MtpFile>> content;
+    std::vector<MtpObjectInfo> listing;
+
+    if (m_listings && m_listings->get(m_id, listing)) {
+        if (listing.empty()) {
+            m_lastError = "Directory is empty";
+        }
+    } else {
+        // Версию берем до запроса: изменение во время запроса не даст сохранить устаревший список
+        uint64_t version = m_listings ? m_listings->getVersion() : 0;
+        bool cached = false;
+
+        LIBMTP_file_t* fileList = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [&]() -> LIBMTP_file_t* {
+            // Список мог загрузить фоновый запрос, который выполнялся, пока команда ждала очереди
+            if (m_listings && m_listings->get(m_id, listing)) {
+                cached = true;
+                return nullptr;
+            }
+
+            LIBMTP_mtpdevice_t* device = resolveDevice();
+            if (!device) {
+                return nullptr;
+            }
+
+            LIBMTP_file_t* list = MtpBackend::instance().getFilesAndFolders(device, m_storageId, m_id);
+            if (!list) {
+                captureError("Directory is empty");
+            }
+            return list;
+        });
+
+        if (!fileList && !cached) {
+            return content;
+        }
+
+        // Итерируемся по списку файлов, освобождая каждый элемент
+        LIBMTP_file_t* current = fileList;
+        while (current) {
+            listing.push_back(makeObjectInfo(current, m_storageId));
+            LIBMTP_file_t* next = current->next;
+            LIBMTP_destroy_file_t(current);
+            current = next;
+        }
+
+        if (m_listings && !cached) {
+            m_listings->put(m_id, listing, version);
+        }
+    }
+
+    content.reserve(listing.size());
+    for (const auto& info : listing) {
+        content.push_back(MtpFile::create(m_device, info, m_notifier, m_scheduler, m_listings));
+    }
+
+    // Следующий переход почти всегда - в поддиректорию или к родителю
+    if (m_listings) {
+        m_listings->prefetch(m_id, m_parentId, listing);
+    }
+
+    return content;
+}
+
+uint32_t MtpDirectory::createDirectory(const std::string& name)
+{
+    std::string folderName(name);
+    uint32_t newFolderId = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [&]() -> uint32_t {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return 0;
+        }
+
+        uint32_t id = MtpBackend::instance().createFolder(device, &folderName[0], m_id, m_storageId);
+        if (id == 0) {
+            captureError("Failed to create directory");
+        }
+        return id;
+    });
+
+    if (newFolderId == 0) {
+        return 0;
+    }
+
+    if (m_notifier) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Added;
+        change.info.id = newFolderId;
+        change.info.parentId = m_id;
+        change.info.storageId = m_storageId;
+        change.info.name = folderName;
+        change.info.type = LIBMTP_FILETYPE_FOLDER;
+        change.info.modificationDate = time(nullptr);
+        m_notifier->notify(change);
+    }
+
+    return newFolderId;
+}
+
+std::shared_ptr<MtpFile> MtpDirectory::getFileByName(const std::string& name)
+{
+    for (const auto& file : getContent()) {
+        if (file->getName() == name) {
+            return file;
+        }
+    }
+
+    m_lastError = "File not found";
+    return nullptr;
+}
+
+uint32_t MtpDirectory::sendFile(const std::string& localPath, const std::string& remoteName,
+                                std::shared_ptr<MtpTransfer> transfer)
+{
+    struct stat st;
+    if (stat(localPath.c_str(), &st) != 0) {
+        m_lastError = "Local file not found: " + localPath;
+        return 0;
+    }
+
+    std::string name = remoteName;
+    if (name.empty()) {
+        size_t slash = localPath.find_last_of('/');
+        name = (slash == std::string::npos) ? localPath : localPath.substr(slash + 1);
+    }
+
+    LIBMTP_file_t* fileData = LIBMTP_new_file_t();
+    fileData->filename = strdup(name.c_str());
+    fileData->filesize = static_cast<uint64_t>(st.st_size);
+    fileData->filetype = fileTypeFromName(name);
+    fileData->parent_id = m_id;
+    fileData->storage_id = m_storageId;
+    fileData->modificationdate = st.st_mtime;
+
+    if (transfer) {
+        transfer->begin(fileData->filesize);
+    }
+
+    // Отправка не делится на части: SendObject нельзя прервать другими командами.
+    // Команда только обновляет счетчик, ход сообщается из этого потока
+    bool sent = runTransferOnDevice(m_scheduler, MtpCommandPriority::Bulk, transfer.get(), [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        if (MtpBackend::instance().sendFileFromFile(device, localPath.c_str(), fileData,
+                                       transfer ? MtpTransfer::libmtpProgress : nullptr,
+                                       transfer.get()) != 0) {
+            captureError("Failed to send file");
+            return false;
+        }
+        return true;
+    });
+
+    if (transfer) {
+        if (!sent && transfer->isCancelRequested()) {
+            m_lastError = "Transfer cancelled";
+            transfer->finish(MtpTransferState::Cancelled);
+        } else {
+            transfer->finish(sent ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    uint32_t newFileId = 0;
+    if (sent) {
+        // libmtp записывает в структуру ID созданного объекта
+        newFileId = fileData->item_id;
+        notifyFileAdded(fileData);
+    }
+
+    LIBMTP_destroy_file_t(fileData);
+
+    return newFileId;
+}
+
+uint32_t MtpDirectory::sendData(const std::string& name, uint64_t size, const DataSource& source,
+                                time_t modificationDate, MtpTransfer* transfer)
+{
+    LIBMTP_file_t* fileData = LIBMTP_new_file_t();
+    fileData->filename = strdup(name.c_str());
+    fileData->filesize = size;
+    fileData->filetype = fileTypeFromName(name);
+    fileData->parent_id = m_id;
+    fileData->storage_id = m_storageId;
+    fileData->modificationdate = modificationDate ? modificationDate : time(nullptr);
+
+    bool sent = runTransferOnDevice(m_scheduler, MtpCommandPriority::Bulk, transfer, [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        if (MtpBackend::instance().sendFileFromHandler(device, getFromSource, const_cast<DataSource*>(&source),
+                                          fileData, nullptr, nullptr) != 0) {
+            captureError("Failed to send data");
+            return false;
+        }
+        return true;
+    });
+
+    uint32_t newFileId = 0;
+    if (sent) {
+        newFileId = fileData->item_id;
+        notifyFileAdded(fileData);
+    }
+
+    LIBMTP_destroy_file_t(fileData);
+
+    return newFileId;
+}
+
+std::shared_ptr<MtpDirectory> MtpDirectory::createSubdirectory(const std::string& name)
+{
+    uint32_t newFolderId = createDirectory(name);
+    if (newFolderId == 0) {
+        return nullptr;
+    }
+
+    return std::make_shared<MtpDirectory>(m_device, newFolderId, m_storageId, name, m_id,
+                                          m_notifier, m_scheduler, m_listings);
+}
+
+void MtpDirectory::notifyFileAdded(const LIBMTP_file_t* fileData)
+{
+    if (m_notifier) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Added;
+        change.info = makeObjectInfo(fileData, m_storageId);
+        m_notifier->notify(change);
+    }
+}
+
+uint16_t MtpDirectory::getFromSource(void* params, void* priv, uint32_t wantlen, unsigned char* data, uint32_t* gotlen)
+{
+    (void)params;
+    const DataSource* source = static_cast<const DataSource*>(priv);
+
+    size_t length = (*source)(data, wantlen);
+    if (length == 0) {
+        // libmtp запрашивает только оставшиеся байты, поэтому 0 означает обрыв источника
+        return LIBMTP_HANDLER_RETURN_ERROR;
+    }
+
+    *gotlen = static_cast<uint32_t>(length);
+    return LIBMTP_HANDLER_RETURN_OK;
+}
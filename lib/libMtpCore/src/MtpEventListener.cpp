@@ -0,0 +1,186 @@
+#include "MtpEventListener.h"
+#include "MtpBackend.h"
+#include <sys/time.h>
+#include <unordered_map>
+
+namespace {
+
+// Как часто поток проверяет запрос на остановку
+const long POLL_INTERVAL_US = 200 * 1000;
+
+// Сколько ждать ответа на отправленный запрос при удалении слушателя
+const int DRAIN_ATTEMPTS = 5;
+const long DRAIN_INTERVAL_US = 20 * 1000;
+
+// События libusb обрабатываются для всех устройств сразу, поэтому ответ
+// на запрос одного слушателя может прийти в потоке другого, в том числе
+// после удаления первого. libmtp получает ключ, а не указатель, и
+// обратный вызов находит слушателя только если тот еще жив.
+std::mutex g_registryMutex;
+std::unordered_map<uintptr_t, MtpEventListener*> g_listeners;
+uintptr_t g_nextToken = 1;
+
+// Обработка событий libusb в потоках слушателей и освобождение устройств
+// взаимно исключаются: ответ на запрос события обращается к состоянию
+// устройства libmtp. Синхронные передачи других устройств тоже
+// обрабатывают события libusb, и этот мьютекс их не останавливает, а
+// отменить запрос libmtp не позволяет. Поэтому ожидающий запрос сначала
+// пытаемся завершить в drain(), а мьютекс лишь сужает оставшееся окно
+std::mutex g_eventsMutex;
+
+} // namespace
+
+MtpEventListener::MtpEventListener(LIBMTP_mtpdevice_t* device, EventHandler handler)
+    : m_device(device)
+    , m_handler(handler)
+    , m_running(false)
+    , m_stopping(false)
+    , m_armed(false)
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    m_token = g_nextToken++;
+    g_listeners[m_token] = this;
+}
+
+MtpEventListener::~MtpEventListener()
+{
+    stop();
+    drain();
+
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+    g_listeners.erase(m_token);
+}
+
+bool MtpEventListener::start()
+{
+    if (m_running) {
+        return true;
+    }
+
+    // Поток мог завершиться сам после ошибки
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    m_stopping = false;
+    m_running = true;
+    m_thread = std::thread(&MtpEventListener::run, this);
+    return true;
+}
+
+void MtpEventListener::stop()
+{
+    m_stopping = true;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+std::unique_lock<std::mutex> MtpEventListener::blockEvents()
+{
+    return std::unique_lock<std::mutex>(g_eventsMutex);
+}
+
+bool MtpEventListener::isRunning() const
+{
+    return m_running;
+}
+
+std::string MtpEventListener::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+void MtpEventListener::run()
+{
+    while (!m_stopping) {
+        // Запрос действует до первого события; после него отправляем новый.
+        // После stop() запрос остается ожидающим, и повторный start() его не дублирует
+        if (!m_armed) {
+            if (MtpBackend::instance().readEventAsync(m_device, eventCallback, reinterpret_cast<void*>(m_token)) != 0) {
+                setError("Failed to request device events");
+                break;
+            }
+            m_armed = true;
+        }
+
+        struct timeval timeout = {0, POLL_INTERVAL_US};
+        int completed = 0;
+        std::lock_guard<std::mutex> lock(g_eventsMutex);
+        LIBMTP_Handle_Events_Timeout_Completed(&timeout, &completed);
+    }
+
+    m_running = false;
+}
+
+void MtpEventListener::drain()
+{
+    // Отключенное устройство отвечает на запрос ошибкой почти сразу.
+    // Подключенное может молчать; тогда запрос остается ожидающим, и
+    // устройство освобождается под blockEvents() без гарантии, что ответ
+    // не придет в синхронной передаче другого устройства
+    for (int attempt = 0; m_armed && attempt < DRAIN_ATTEMPTS; ++attempt) {
+        struct timeval timeout = {0, DRAIN_INTERVAL_US};
+        int completed = 0;
+        std::lock_guard<std::mutex> lock(g_eventsMutex);
+        LIBMTP_Handle_Events_Timeout_Completed(&timeout, &completed);
+    }
+}
+
+void MtpEventListener::eventCallback(int ret, LIBMTP_event_t event, uint32_t param, void* data)
+{
+    std::lock_guard<std::mutex> lock(g_registryMutex);
+
+    auto it = g_listeners.find(reinterpret_cast<uintptr_t>(data));
+    if (it != g_listeners.end()) {
+        it->second->handleEvent(ret, event, param);
+    }
+}
+
+void MtpEventListener::handleEvent(int ret, LIBMTP_event_t event, uint32_t param)
+{
+    m_armed = false;
+
+    if (ret != LIBMTP_HANDLER_RETURN_OK) {
+        // Обычно это означает, что устройство отключено
+        setError("Failed to read device event");
+        m_stopping = true;
+        return;
+    }
+
+    MtpDeviceEvent deviceEvent;
+    deviceEvent.param = param;
+
+    switch (event) {
+    case LIBMTP_EVENT_STORE_ADDED:
+        deviceEvent.type = MtpDeviceEventType::StoreAdded;
+        break;
+    case LIBMTP_EVENT_STORE_REMOVED:
+        deviceEvent.type = MtpDeviceEventType::StoreRemoved;
+        break;
+    case LIBMTP_EVENT_OBJECT_ADDED:
+        deviceEvent.type = MtpDeviceEventType::ObjectAdded;
+        deviceEvent.info.id = param;
+        break;
+    case LIBMTP_EVENT_OBJECT_REMOVED:
+        deviceEvent.type = MtpDeviceEventType::ObjectRemoved;
+        deviceEvent.info.id = param;
+        break;
+    case LIBMTP_EVENT_DEVICE_PROPERTY_CHANGED:
+        deviceEvent.type = MtpDeviceEventType::DevicePropertyChanged;
+        break;
+    default:
+        return;
+    }
+
+    if (m_handler) {
+        m_handler(deviceEvent);
+    }
+}
+
+void MtpEventListener::setError(const std::string& error)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lastError = error;
+}
@@ -1,13 +1,204 @@
 #include "MtpFile.h"
+#include "MtpBackend.h"
+#include "MtpDirectory.h"
+#include "MtpObjectNotifier.h"
+#include "MtpCommandScheduler.h"
+#include "MtpListingCache.h"
+#include "MtpTransfer.h"
+#include "MtpFileWriter.h"
+#include "MtpHandle.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 
-MtpFile::MtpFile(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, uint32_t storageId)
+namespace {
+
+/**
+ * @brief Буфер между командой чтения и потоком, обрабатывающим данные
+ *
+ * Команда кладет данные, не дожидаясь получателя: сначала в память,
+ * после MEMORY_LIMIT - во временный файл. Начав запись в файл, буфер
+ * пишет туда все последующие данные, поэтому порядок сохраняется.
+ */
+class ContentSpool {
+public:
+    static const size_t MEMORY_LIMIT = 16 * 1024 * 1024;
+    static const size_t READ_BLOCK = 1024 * 1024;
+
+    ContentSpool()
+        : m_memory(0)
+        , m_file(nullptr)
+        , m_fileSize(0)
+        , m_fileRead(0)
+        , m_finished(false)
+        , m_aborted(false)
+        , m_failed(false)
+    {
+    }
+
+    ~ContentSpool()
+    {
+        if (m_file) {
+            fclose(m_file);
+        }
+    }
+
+    // Добавляет данные; false если получатель отказался или буфер не записан
+    bool push(const unsigned char* data, size_t length)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_aborted || m_failed) {
+                return false;
+            }
+
+            if (!m_file && m_memory + length <= MEMORY_LIMIT) {
+                m_blocks.emplace_back(data, data + length);
+                m_memory += length;
+            } else {
+                if (!m_file) {
+                    m_file = tmpfile();
+                }
+                if (!m_file || fseeko(m_file, static_cast<off_t>(m_fileSize), SEEK_SET) != 0 ||
+                    fwrite(data, 1, length, m_file) != length) {
+                    m_failed = true;
+                } else {
+                    m_fileSize += length;
+                }
+            }
+        }
+        m_condition.notify_one();
+        return !m_failed;
+    }
+
+    // Сообщает, что данных больше не будет
+    void finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_condition.notify_one();
+    }
+
+    // Отказ получателя: следующий push вернет false
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_aborted = true;
+    }
+
+    // Забирает следующий блок: 1 - блок получен, 0 - данные кончились, -1 - ошибка буфера
+    int pop(std::vector<unsigned char>& block)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() {
+            return m_failed || m_finished || !m_blocks.empty() || m_fileRead < m_fileSize;
+        });
+        if (m_failed) {
+            return -1;
+        }
+
+        if (!m_blocks.empty()) {
+            block = std::move(m_blocks.front());
+            m_blocks.pop_front();
+            m_memory -= block.size();
+            return 1;
+        }
+
+        if (m_fileRead < m_fileSize) {
+            block.resize(static_cast<size_t>(std::min<uint64_t>(READ_BLOCK, m_fileSize - m_fileRead)));
+            if (fseeko(m_file, static_cast<off_t>(m_fileRead), SEEK_SET) != 0 ||
+                fread(block.data(), 1, block.size(), m_file) != block.size()) {
+                m_failed = true;
+                return -1;
+            }
+            m_fileRead += block.size();
+            return 1;
+        }
+
+        return 0;
+    }
+
+private:
+    std::deque<std::vector<unsigned char>> m_blocks;
+    size_t m_memory;
+    FILE* m_file;
+    uint64_t m_fileSize;
+    uint64_t m_fileRead;
+    bool m_finished;
+    bool m_aborted;
+    bool m_failed;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+};
+
+const size_t ContentSpool::MEMORY_LIMIT;
+const size_t ContentSpool::READ_BLOCK;
+
+uint16_t putToSpool(void* params, void* priv, uint32_t sendlen, unsigned char* data, uint32_t* putlen)
+{
+    (void)params;
+    ContentSpool* spool = static_cast<ContentSpool*>(priv);
+
+    if (!spool->push(data, sendlen)) {
+        return LIBMTP_HANDLER_RETURN_CANCEL;
+    }
+
+    *putlen = sendlen;
+    return LIBMTP_HANDLER_RETURN_OK;
+}
+
+} // namespace
+
+MtpFile::MtpFile(MtpDeviceHandle device, LIBMTP_file_t* file, uint32_t storageId,
+                 std::shared_ptr<MtpObjectNotifier> notifier,
+                 std::shared_ptr<MtpCommandScheduler> scheduler)
+    : MtpFile(device, makeObjectInfo(file, storageId), notifier, scheduler)
+{
+}
+
+MtpFile::MtpFile(MtpDeviceHandle device, const MtpObjectInfo& info,
+                 std::shared_ptr<MtpObjectNotifier> notifier,
+                 std::shared_ptr<MtpCommandScheduler> scheduler,
+                 std::shared_ptr<MtpListingCache> listings)
     : m_device(device)
-    , m_id(file->item_id)
-    , m_parentId(file->parent_id)
+    , m_id(info.id)
+    , m_parentId(info.parentId)
+    , m_storageId(info.storageId)
+    , m_name(info.name)
+    , m_size(info.size)
+    , m_type(info.type)
+    , m_modificationDate(info.modificationDate)
+    , m_notifier(notifier)
+    , m_scheduler(scheduler)
+    , m_listings(listings)
+{
+}
+
+MtpFile::MtpFile(MtpDeviceHandle device, uint32_t id, uint32_t storageId,
+                 const std::string& name, uint32_t parentId,
+                 std::shared_ptr<MtpObjectNotifier> notifier,
+                 std::shared_ptr<MtpCommandScheduler> scheduler,
+                 std::shared_ptr<MtpListingCache> listings)
+    : m_device(device)
+    , m_id(id)
+    , m_parentId(parentId)
     , m_storageId(storageId)
-    , m_name(file->filename ? file->filename : "")
-    , m_size(file->filesize)
+    , m_name(name)
+    , m_size(0)
+    , m_type(LIBMTP_FILETYPE_FOLDER)
+    , m_modificationDate(0)
+    , m_notifier(notifier)
+    , m_scheduler(scheduler)
+    , m_listings(listings)
 {
 }
 
@@ -15,6 +206,17 @@ MtpFile::~MtpFile()
 {
 }
 
+std::shared_ptr<MtpFile> MtpFile::create(MtpDeviceHandle device, const MtpObjectInfo& info,
+                                         std::shared_ptr<MtpObjectNotifier> notifier,
+                                         std::shared_ptr<MtpCommandScheduler> scheduler,
+                                         std::shared_ptr<MtpListingCache> listings)
+{
+    if (info.isDirectory()) {
+        return std::make_shared<MtpDirectory>(device, info, notifier, scheduler, listings);
+    }
+    return std::make_shared<MtpFile>(device, info, notifier, scheduler, listings);
+}
+
 uint32_t MtpFile::getId() const
 {
     return m_id;
@@ -40,50 +242,763 @@ uint64_t MtpFile::getSize() const
     return m_size;
 }
 
+LIBMTP_filetype_t MtpFile::getType() const
+{
+    return m_type;
+}
+
+time_t MtpFile::getModificationDate() const
+{
+    return m_modificationDate;
+}
+
+std::string MtpFile::getExtension() const
+{
+    return fileExtension(m_name);
+}
+
+MtpObjectInfo MtpFile::getInfo() const
+{
+    MtpObjectInfo info;
+    info.id = m_id;
+    info.parentId = m_parentId;
+    info.storageId = m_storageId;
+    info.name = m_name;
+    info.size = m_size;
+    info.type = m_type;
+    info.modificationDate = m_modificationDate;
+    return info;
+}
+
 bool MtpFile::isDirectory() const
 {
     return false;
 }
 
-bool MtpFile::downloadFile(const std::string& path)
+bool MtpFile::isOnSameDevice(const MtpFile& other) const
 {
-    int ret = LIBMTP_Get_File_To_File(m_device, m_id, path.c_str(), nullptr, nullptr);
-    
-    if (ret != 0) {
-        // Проверяем на ошибки
-        LIBMTP_error_t* error = LIBMTP_Get_Errorstack(m_device);
-        if (error) {
-            m_lastError = error->error_text;
-            LIBMTP_Clear_Errorstack(m_device);
+    return m_device == other.m_device;
+}
+
+MtpDeviceHandle MtpFile::getDeviceHandle() const
+{
+    return m_device;
+}
+
+bool MtpFile::isValid() const
+{
+    return MtpHandleTable::instance().isValid(m_device);
+}
+
+bool MtpFile::downloadFile(const std::string& path, std::shared_ptr<MtpTransfer> transfer,
+                           const MtpFileWriterOptions& options)
+{
+    if (transfer) {
+        transfer->begin(m_size);
+    }
+
+    // Файл пишется во временный и появляется под своим именем только целиком
+    MtpFileWriter writer(path, m_size, options);
+    bool ok = writer.open();
+    bool writeFailed = !ok;
+
+    if (ok) {
+        ok = readContent([&](const unsigned char* data, size_t length) {
+            if (!writer.write(data, length)) {
+                writeFailed = true;
+                return false;
+            }
+            return !transfer || transfer->update(writer.getBytesWritten());
+        });
+
+        if (ok && !writer.commit()) {
+            writeFailed = true;
+            ok = false;
+        }
+        if (!ok) {
+            writer.abort();
+        }
+    }
+
+    if (writeFailed) {
+        m_lastError = writer.getLastError();
+    }
+
+    if (transfer) {
+        if (!ok && transfer->isCancelRequested()) {
+            m_lastError = "Transfer cancelled";
+            transfer->finish(MtpTransferState::Cancelled);
         } else {
-            m_lastError = "Failed to download file";
+            transfer->finish(ok ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    return ok;
+}
+
+bool MtpFile::readContent(const DataSink& sink, uint64_t offset)
+{
+    if (offset >= m_size && offset > 0) {
+        return true;
+    }
+
+    bool chunked = m_scheduler && (m_size > m_scheduler->getChunkSize() || offset > 0) &&
+        runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+            LIBMTP_mtpdevice_t* device = resolveDevice();
+            return device && MtpBackend::instance().checkCapability(device, LIBMTP_DEVICECAP_GetPartialObject) != 0;
+        });
+    if (chunked) {
+        return readInChunks(sink, offset);
+    }
+
+    // Без частичного чтения пропускаем уже полученное начало файла
+    uint64_t skip = offset;
+    DataSink skipping = [&sink, &skip](const unsigned char* data, size_t length) {
+        if (skip >= length) {
+            skip -= length;
+            return true;
+        }
+        size_t start = static_cast<size_t>(skip);
+        skip = 0;
+        return sink(data + start, length - start);
+    };
+    const DataSink& target = offset > 0 ? skipping : sink;
+
+    // Команда только складывает данные в буфер: получатель может писать
+    // на диск или ждать, и занимать этим рабочий поток устройства нельзя
+    ContentSpool spool;
+    auto command = [this, &spool]() {
+        bool read = false;
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (device) {
+            read = MtpBackend::instance().getFileToHandler(device, m_id, putToSpool, &spool, nullptr, nullptr) == 0;
+            if (!read) {
+                captureError("Failed to read file");
+            }
+        }
+        spool.finish();
+        return read;
+    };
+
+    std::future<bool> pending;
+    bool read = false;
+    if (m_scheduler) {
+        pending = m_scheduler->submit(MtpCommandPriority::Bulk, command);
+    } else {
+        read = command();
+    }
+
+    bool accepted = true;
+    int state = 0;
+    std::vector<unsigned char> block;
+    while ((state = spool.pop(block)) > 0) {
+        if (!target(block.data(), block.size())) {
+            accepted = false;
+            spool.abort();
+            break;
         }
+    }
+
+    if (pending.valid()) {
+        read = pending.get();
+    }
+
+    if (!accepted) {
+        m_lastError = "Reading aborted by receiver";
         return false;
     }
-    
-    return true;
+    if (state < 0) {
+        m_lastError = "Cannot buffer file content";
+        return false;
+    }
+    return read;
+}
+
+bool MtpFile::readRange(uint64_t offset, uint32_t length, std::vector<unsigned char>& data)
+{
+    data.clear();
+    if (offset >= m_size) {
+        return true;
+    }
+    uint64_t end = std::min<uint64_t>(m_size, offset + length);
+
+    return runOnDevice(m_scheduler, MtpCommandPriority::Bulk, [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        if (MtpBackend::instance().checkCapability(device, LIBMTP_DEVICECAP_GetPartialObject) == 0) {
+            m_lastError = "Device does not support partial reads";
+            return false;
+        }
+
+        data.reserve(static_cast<size_t>(end - offset));
+
+        // Устройство может вернуть меньше запрошенного: дочитываем остаток
+        uint64_t position = offset;
+        while (position < end) {
+            unsigned char* part = nullptr;
+            unsigned int size = 0;
+            int ret = MtpBackend::instance().getPartialObject(device, m_id, position,
+                                                              static_cast<uint32_t>(end - position), &part, &size);
+            if (ret != 0 || !part || size == 0) {
+                free(part);
+                captureError("Failed to read part of file");
+                return false;
+            }
+
+            size = static_cast<unsigned int>(std::min<uint64_t>(size, end - position));
+            data.insert(data.end(), part, part + size);
+            free(part);
+            position += size;
+        }
+        return true;
+    });
+}
+
+bool MtpFile::readInChunks(const DataSink& sink, uint64_t offset)
+{
+    // Результат чтения одной части
+    struct Chunk {
+        unsigned char* data = nullptr;
+        unsigned int size = 0;
+        std::string error;
+    };
+
+    std::shared_ptr<MtpCommandScheduler> scheduler = m_scheduler;
+    const uint32_t chunkSize = scheduler->getChunkSize();
+    auto requestChunk = [this, scheduler, chunkSize](uint64_t position) {
+        return scheduler->submit(MtpCommandPriority::Bulk, [this, position, chunkSize]() {
+            Chunk chunk;
+            LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+            if (!device) {
+                chunk.error = MtpHandleTable::DISCONNECTED_ERROR;
+                return chunk;
+            }
+
+            int ret = MtpBackend::instance().getPartialObject(device, m_id, position, chunkSize, &chunk.data, &chunk.size);
+            if (ret != 0 || !chunk.data || chunk.size == 0) {
+                LIBMTP_error_t* error = MtpBackend::instance().getErrorstack(device);
+                chunk.error = error ? error->error_text : "Failed to read part of file";
+                MtpBackend::instance().clearErrorstack(device);
+            }
+            return chunk;
+        });
+    };
+
+    bool ok = true;
+    uint64_t position = offset;
+    std::future<Chunk> pending = requestChunk(position);
+
+    while (pending.valid()) {
+        Chunk chunk = pending.get();
+        if (!chunk.error.empty()) {
+            free(chunk.data);
+            m_lastError = chunk.error;
+            ok = false;
+            break;
+        }
+
+        position += chunk.size;
+
+        // Запрашиваем следующую часть до обработки текущей, чтобы устройство не простаивало
+        if (position < m_size) {
+            pending = requestChunk(position);
+        }
+
+        bool accepted = sink(chunk.data, chunk.size);
+        free(chunk.data);
+
+        if (!accepted) {
+            m_lastError = "Reading aborted by receiver";
+            ok = false;
+            break;
+        }
+    }
+
+    // Дожидаемся уже запрошенной части, чтобы не оставить ее в очереди
+    if (pending.valid()) {
+        Chunk chunk = pending.get();
+        free(chunk.data);
+    }
+
+    return ok;
 }
 
 bool MtpFile::deleteFile()
 {
-    int ret = LIBMTP_Delete_Object(m_device, m_id);
+    bool deleted = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        if (MtpBackend::instance().deleteObject(device, m_id) != 0) {
+            captureError("Failed to delete file");
+            return false;
+        }
+        return true;
+    });
+
+    if (!deleted) {
+        return false;
+    }
+
+    // Сообщаем подписчикам (индексам, кэшам) об удалении
+    if (m_notifier) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Removed;
+        change.info = getInfo();
+        m_notifier->notify(change);
+    }
     
-    if (ret != 0) {
-        // Проверяем на ошибки
-        LIBMTP_error_t* error = LIBMTP_Get_Errorstack(m_device);
-        if (error) {
-            m_lastError = error->error_text;
-            LIBMTP_Clear_Errorstack(m_device);
+    return true;
+}
+
+bool MtpFile::rename(const std::string& name)
+{
+    if (name.empty() || name.find('/') != std::string::npos) {
+        m_lastError = "Invalid name";
+        return false;
+    }
+    if (m_id == 0) {
+        m_lastError = "Cannot rename the root directory";
+        return false;
+    }
+
+    std::string newName;
+    bool renamed = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        // libmtp берет из структуры только ID и тип объекта, поэтому
+        // метаданные с устройства не запрашиваются
+        LIBMTP_file_t* file = LIBMTP_new_file_t();
+        file->item_id = m_id;
+        file->parent_id = m_parentId;
+        file->storage_id = m_storageId;
+        file->filetype = m_type;
+        file->filename = strdup(m_name.c_str());
+
+        int ret = MtpBackend::instance().setFileName(device, file, name.c_str());
+        if (ret != 0) {
+            captureError("Failed to rename object");
         } else {
-            m_lastError = "Failed to delete file";
+            newName = file->filename ? file->filename : name;
         }
+
+        LIBMTP_destroy_file_t(file);
+        return ret == 0;
+    });
+
+    if (!renamed) {
         return false;
     }
-    
+
+    m_name = newName;
+
+    if (m_notifier) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Changed;
+        change.info = getInfo();
+        m_notifier->notify(change);
+    }
+
     return true;
 }
 
+bool MtpFile::moveTo(const std::shared_ptr<MtpDirectory>& target, std::shared_ptr<MtpTransfer> transfer)
+{
+    if (!target || !isOnSameDevice(*target)) {
+        m_lastError = "Target directory is on another device";
+        return false;
+    }
+    if (m_id == 0) {
+        m_lastError = "Cannot move the root directory";
+        return false;
+    }
+    if (target->getId() == m_parentId && target->getStorageId() == m_storageId) {
+        return true;
+    }
+    if (isDirectory() && containsObject(*target)) {
+        m_lastError = "Cannot move a directory into itself";
+        return false;
+    }
+
+    if (!hasCapability(LIBMTP_DEVICECAP_MoveObject)) {
+        // Без MoveObject: копия и удаление исходного объекта. Подписчики
+        // уже получили уведомления о создании копии и об удалении
+        uint32_t copyId = copyTo(target, transfer);
+        if (copyId == 0) {
+            return false;
+        }
+        if (!deleteFile()) {
+            m_lastError = "Copied, but failed to delete the original: " + m_lastError;
+            return false;
+        }
+
+        m_id = copyId;
+        m_parentId = target->getId();
+        m_storageId = target->getStorageId();
+        m_notifier = target->m_notifier;
+        m_listings = target->m_listings;
+        return true;
+    }
+
+    if (transfer) {
+        transfer->begin(0);
+    }
+
+    bool moved = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        if (MtpBackend::instance().moveObject(device, m_id, target->getStorageId(), target->getId()) != 0) {
+            captureError("Failed to move object");
+            return false;
+        }
+        return true;
+    });
+
+    if (transfer) {
+        transfer->finish(moved ? MtpTransferState::Completed : MtpTransferState::Failed);
+    }
+    if (!moved) {
+        return false;
+    }
+
+    MtpObjectInfo previous = getInfo();
+    m_parentId = target->getId();
+    m_storageId = target->getStorageId();
+
+    // Внутри хранилища объект меняет только родителя; между хранилищами
+    // он исчезает из одного и появляется в другом
+    if (target->m_notifier == m_notifier) {
+        if (m_notifier) {
+            MtpObjectChange change;
+            change.type = MtpObjectChangeType::Changed;
+            change.info = getInfo();
+            m_notifier->notify(change);
+        }
+    } else {
+        if (m_notifier) {
+            MtpObjectChange change;
+            change.type = MtpObjectChangeType::Removed;
+            change.info = previous;
+            m_notifier->notify(change);
+        }
+        if (target->m_notifier) {
+            MtpObjectChange change;
+            change.type = MtpObjectChangeType::Added;
+            change.info = getInfo();
+            target->m_notifier->notify(change);
+        }
+        m_notifier = target->m_notifier;
+        m_listings = target->m_listings;
+
+        // Удаление директории источник снимает вместе с содержимым,
+        // а в целевом хранилище о содержимом нужно сообщить отдельно
+        notifyContentAdded();
+    }
+
+    return true;
+}
+
+uint32_t MtpFile::copyTo(const std::shared_ptr<MtpDirectory>& target, std::shared_ptr<MtpTransfer> transfer)
+{
+    if (!target || !isOnSameDevice(*target)) {
+        m_lastError = "Target directory is on another device";
+        return 0;
+    }
+    if (isDirectory() && containsObject(*target)) {
+        m_lastError = "Cannot copy a directory into itself";
+        return 0;
+    }
+
+    bool onDevice = hasCapability(LIBMTP_DEVICECAP_CopyObject);
+
+    // Без CopyObject каждый байт проходит по USB дважды: чтение и отправка
+    if (transfer) {
+        uint64_t total = getTreeSize();
+        transfer->begin(onDevice ? total : 2 * total);
+    }
+
+    uint64_t doneBytes = 0;
+    uint32_t copyId = copyRecursive(target, onDevice, doneBytes, transfer.get());
+
+    if (transfer) {
+        if (copyId == 0 && transfer->isCancelRequested()) {
+            m_lastError = "Transfer cancelled";
+            transfer->finish(MtpTransferState::Cancelled);
+        } else {
+            transfer->finish(copyId != 0 ? MtpTransferState::Completed : MtpTransferState::Failed);
+        }
+    }
+
+    return copyId;
+}
+
 std::string MtpFile::getLastError() const
 {
     return m_lastError;
+}
+
+LIBMTP_mtpdevice_t* MtpFile::resolveDevice()
+{
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+    if (!device) {
+        m_lastError = MtpHandleTable::DISCONNECTED_ERROR;
+    }
+    return device;
+}
+
+bool MtpFile::hasCapability(LIBMTP_devicecap_t capability)
+{
+    return runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this, capability]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        return device && MtpBackend::instance().checkCapability(device, capability) != 0;
+    });
+}
+
+bool MtpFile::containsObject(const MtpFile& other)
+{
+    if (other.m_storageId != m_storageId) {
+        return false;
+    }
+    if (m_id == 0) {
+        return true;
+    }
+
+    return runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this, &other]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        // Поднимаемся от объекта к корню; глубина ограничена на случай цикла
+        uint32_t id = other.m_id;
+        for (int depth = 0; id != 0 && depth < 256; ++depth) {
+            if (id == m_id) {
+                return true;
+            }
+
+            LIBMTP_file_t* file = MtpBackend::instance().getFilemetadata(device, id);
+            if (!file) {
+                MtpBackend::instance().clearErrorstack(device);
+                break;
+            }
+            id = file->parent_id;
+            LIBMTP_destroy_file_t(file);
+        }
+        return false;
+    });
+}
+
+uint64_t MtpFile::getTreeSize()
+{
+    MtpDirectory* directory = dynamic_cast<MtpDirectory*>(this);
+    if (!directory) {
+        return m_size;
+    }
+
+    uint64_t total = 0;
+    for (const auto& child : directory->getContent()) {
+        total += child->getTreeSize();
+    }
+    return total;
+}
+
+void MtpFile::notifyContentAdded()
+{
+    MtpDirectory* directory = dynamic_cast<MtpDirectory*>(this);
+    if (!directory || !m_notifier) {
+        return;
+    }
+
+    for (const auto& child : directory->getContent()) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Added;
+        change.info = child->getInfo();
+        m_notifier->notify(change);
+
+        child->notifyContentAdded();
+    }
+}
+
+uint32_t MtpFile::copyRecursive(const std::shared_ptr<MtpDirectory>& target, bool onDevice,
+                                uint64_t& doneBytes, MtpTransfer* transfer)
+{
+    if (transfer && transfer->isCancelRequested()) {
+        m_lastError = "Transfer cancelled";
+        return 0;
+    }
+
+    MtpDirectory* directory = dynamic_cast<MtpDirectory*>(this);
+    if (!directory) {
+        if (!onDevice) {
+            return streamCopy(target, doneBytes, transfer);
+        }
+
+        uint32_t copyId = copyOnDevice(target);
+        doneBytes += m_size;
+        if (copyId != 0 && transfer) {
+            transfer->update(doneBytes);
+        }
+        return copyId;
+    }
+
+    std::vector<std::shared_ptr<MtpFile>> children = directory->getContent();
+    std::shared_ptr<MtpDirectory> copy = target->createSubdirectory(m_name);
+    if (!copy) {
+        m_lastError = target->getLastError();
+        return 0;
+    }
+
+    for (const auto& child : children) {
+        if (child->copyRecursive(copy, onDevice, doneBytes, transfer) == 0) {
+            m_lastError = child->getLastError();
+            return 0;
+        }
+    }
+
+    return copy->getId();
+}
+
+uint32_t MtpFile::copyOnDevice(const std::shared_ptr<MtpDirectory>& target)
+{
+    MtpObjectInfo copy;
+    bool copied = runOnDevice(m_scheduler, MtpCommandPriority::Bulk, [&]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
+        }
+
+        MtpBackend& backend = MtpBackend::instance();
+
+        // libmtp не возвращает ID копии, поэтому запоминаем объекты целевой
+        // директории до копирования: копия - единственный новый объект
+        // с тем же именем и размером
+        std::unordered_set<uint32_t> existing;
+        LIBMTP_file_t* list = backend.getFilesAndFolders(device, target->getStorageId(), target->getId());
+        if (!list && backend.getErrorstack(device)) {
+            captureError("Failed to list target directory");
+            return false;
+        }
+        while (list) {
+            LIBMTP_file_t* next = list->next;
+            existing.insert(list->item_id);
+            LIBMTP_destroy_file_t(list);
+            list = next;
+        }
+
+        if (backend.copyObject(device, m_id, target->getStorageId(), target->getId()) != 0) {
+            captureError("Failed to copy object");
+            return false;
+        }
+
+        size_t matches = 0;
+        list = backend.getFilesAndFolders(device, target->getStorageId(), target->getId());
+        while (list) {
+            LIBMTP_file_t* next = list->next;
+            if (!existing.count(list->item_id) && list->filename &&
+                m_name == list->filename && list->filesize == m_size) {
+                copy = makeObjectInfo(list, target->getStorageId());
+                ++matches;
+            }
+            LIBMTP_destroy_file_t(list);
+            list = next;
+        }
+
+        if (matches == 0) {
+            backend.clearErrorstack(device);
+            m_lastError = "Copy not found in target directory";
+            return false;
+        }
+        if (matches > 1) {
+            // Одноименный объект того же размера появился одновременно с копией
+            m_lastError = "Cannot tell the copy from other new objects in target directory";
+            return false;
+        }
+        return true;
+    });
+
+    if (!copied) {
+        return 0;
+    }
+
+    if (target->m_notifier) {
+        MtpObjectChange change;
+        change.type = MtpObjectChangeType::Added;
+        change.info = copy;
+        target->m_notifier->notify(change);
+    }
+
+    return copy.id;
+}
+
+uint32_t MtpFile::streamCopy(const std::shared_ptr<MtpDirectory>& target, uint64_t& doneBytes, MtpTransfer* transfer)
+{
+    // Устройство выполняет одну команду за раз, поэтому файл сначала
+    // читается целиком во временный файл и только затем отправляется
+    FILE* temp = tmpfile();
+    if (!temp) {
+        m_lastError = std::string("Cannot create temporary file: ") + strerror(errno);
+        return 0;
+    }
+
+    bool writeFailed = false;
+    bool ok = readContent([&](const unsigned char* data, size_t length) {
+        if (fwrite(data, 1, length, temp) != length) {
+            writeFailed = true;
+            return false;
+        }
+        doneBytes += length;
+        return !transfer || transfer->update(doneBytes);
+    });
+
+    if (ok && (fflush(temp) != 0 || fseek(temp, 0, SEEK_SET) != 0)) {
+        writeFailed = true;
+        ok = false;
+    }
+    if (writeFailed) {
+        m_lastError = std::string("Cannot write temporary file: ") + strerror(errno);
+    }
+    if (!ok) {
+        fclose(temp);
+        return 0;
+    }
+
+    uint32_t copyId = target->sendData(m_name, m_size, [&](unsigned char* buffer, size_t length) -> size_t {
+        size_t count = fread(buffer, 1, length, temp);
+        doneBytes += count;
+        if (transfer && !transfer->report(doneBytes)) {
+            return 0;
+        }
+        return count;
+    }, m_modificationDate, transfer);
+
+    fclose(temp);
+
+    if (copyId == 0) {
+        m_lastError = target->getLastError();
+    }
+    return copyId;
+}
+
+void MtpFile::captureError(const std::string& fallback)
+{
+    // Проверяем на ошибки
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+    LIBMTP_error_t* error = device ? MtpBackend::instance().getErrorstack(device) : nullptr;
+    if (error) {
+        m_lastError = error->error_text;
+        MtpBackend::instance().clearErrorstack(device);
+    } else {
+        m_lastError = fallback;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,438 @@
+#include "MtpFileWriter.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Выравнивание буферов и блоков: размер страницы и сектора большинства дисков
+const size_t ALIGNMENT = 4096;
+
+// Сколько свободных буферов пул держит про запас
+const size_t MAX_POOLED_BUFFERS = 8;
+
+/**
+ * @brief Общий пул выровненных буферов
+ *
+ * Буферы по несколько мегабайт переиспользуются между загрузками,
+ * а не выделяются заново для каждого файла.
+ */
+class BufferPool {
+public:
+    ~BufferPool()
+    {
+        for (const auto& buffer : m_free) {
+            free(buffer.second);
+        }
+    }
+
+    unsigned char* acquire(size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+                if (it->first == size) {
+                    unsigned char* buffer = it->second;
+                    m_free.erase(it);
+                    return buffer;
+                }
+            }
+        }
+
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, ALIGNMENT, size) != 0) {
+            return nullptr;
+        }
+        return static_cast<unsigned char*>(buffer);
+    }
+
+    void release(unsigned char* buffer, size_t size)
+    {
+        if (!buffer) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.size() < MAX_POOLED_BUFFERS) {
+            m_free.push_back(std::make_pair(size, buffer));
+        } else {
+            free(buffer);
+        }
+    }
+
+private:
+    std::vector<std::pair<size_t, unsigned char*>> m_free;
+    std::mutex m_mutex;
+};
+
+BufferPool& bufferPool()
+{
+    static BufferPool pool;
+    return pool;
+}
+
+// Резервирует место под файл; false только если места на диске не хватает
+bool reserveSpace(int fd, uint64_t size, bool& reserved)
+{
+#ifdef __linux__
+    // В отличие от posix_fallocate, fallocate не заполняет файл нулями
+    // на файловых системах без поддержки резервирования
+    int rc = fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0 ? 0 : errno;
+#else
+    int rc = posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+    reserved = (rc == 0);
+    errno = rc;
+    return rc != ENOSPC;
+}
+
+std::string parentDirectory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+} // namespace
+
+MtpFileWriter::MtpFileWriter(const std::string& path, uint64_t expectedSize, const MtpFileWriterOptions& options)
+    : m_path(path)
+    , m_tempPath(path + ".part")
+    , m_expectedSize(expectedSize)
+    , m_options(options)
+    , m_fd(-1)
+    , m_preallocated(false)
+    , m_bytesWritten(0)
+    , m_flushedUpTo(0)
+    , m_closing(false)
+    , m_discard(false)
+    , m_failed(false)
+{
+    // Блоки пишутся по выровненным смещениям
+    m_options.blockSize = std::max(ALIGNMENT, (m_options.blockSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+    m_options.queueDepth = std::max<size_t>(1, m_options.queueDepth);
+}
+
+MtpFileWriter::~MtpFileWriter()
+{
+    if (m_fd >= 0) {
+        abort();
+    }
+}
+
+bool MtpFileWriter::open()
+{
+    return start(O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0);
+}
+
+bool MtpFileWriter::resume(uint64_t offset)
+{
+    return start(O_WRONLY | O_CLOEXEC, offset);
+}
+
+bool MtpFileWriter::start(int flags, uint64_t offset)
+{
+    m_fd = ::open(m_tempPath.c_str(), flags, 0666);
+    if (m_fd < 0) {
+        setError((flags & O_CREAT ? "Failed to create " : "Failed to reopen ") + m_tempPath);
+        return false;
+    }
+
+    if (offset > 0) {
+        // Зарезервированный файл длиннее записанного, поэтому размер
+        // проверяет только то, что файл не укорачивали после suspend()
+        struct stat st;
+        if (fstat(m_fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < offset ||
+            ftruncate(m_fd, static_cast<off_t>(offset)) != 0) {
+            setError("Partial file is shorter than expected: " + m_tempPath);
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+    }
+
+    if (m_options.preallocate && m_expectedSize > offset &&
+        !reserveSpace(m_fd, m_expectedSize, m_preallocated)) {
+        setError("Not enough space for " + m_path);
+        if (offset > 0) {
+            // Уже принятые данные сохраняем: продолжить можно, когда место
+            // освободится, а лишний хвост отбросит следующий resume()
+            close(m_fd);
+            m_fd = -1;
+        } else {
+            abort();
+        }
+        return false;
+    }
+
+    m_bytesWritten = offset;
+    m_flushedUpTo = offset;
+    m_closing = false;
+    m_discard = false;
+    m_failed = false;
+    m_thread = std::thread(&MtpFileWriter::run, this);
+    return true;
+}
+
+bool MtpFileWriter::write(const unsigned char* data, size_t length)
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    while (length > 0) {
+        if (m_failed) {
+            return false;
+        }
+
+        if (!m_current.data) {
+            m_current.data = bufferPool().acquire(m_options.blockSize);
+            if (!m_current.data) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_lastError = "Out of memory";
+                return false;
+            }
+            m_current.length = 0;
+            m_current.offset = m_bytesWritten;
+        }
+
+        // После resume() с невыровненного смещения первый блок короче:
+        // он заканчивается на границе, и следующие блоки выровнены
+        size_t capacity = m_options.blockSize - static_cast<size_t>(m_current.offset % ALIGNMENT);
+        size_t count = std::min(length, capacity - m_current.length);
+        memcpy(m_current.data + m_current.length, data, count);
+        m_current.length += count;
+        m_bytesWritten += count;
+        data += count;
+        length -= count;
+
+        if (m_current.length == capacity && !submitCurrent()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MtpFileWriter::commit()
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    if (m_current.data && m_current.length > 0 && !submitCurrent()) {
+        abort();
+        return false;
+    }
+    stopThread(false);
+
+    if (m_failed) {
+        abort();
+        return false;
+    }
+
+    // Зарезервированный хвост обрезаем по фактическому размеру
+    if (m_preallocated && ftruncate(m_fd, static_cast<off_t>(m_bytesWritten)) != 0) {
+        setError("Failed to truncate " + m_tempPath);
+        abort();
+        return false;
+    }
+
+    if (m_options.syncMode == MtpSyncMode::Durable && fdatasync(m_fd) != 0) {
+        setError("Failed to flush " + m_tempPath);
+        abort();
+        return false;
+    }
+
+    int fd = m_fd;
+    m_fd = -1;
+    if (close(fd) != 0) {
+        setError("Failed to close " + m_tempPath);
+        unlink(m_tempPath.c_str());
+        return false;
+    }
+
+    if (rename(m_tempPath.c_str(), m_path.c_str()) != 0) {
+        setError("Failed to rename " + m_tempPath + " to " + m_path);
+        unlink(m_tempPath.c_str());
+        return false;
+    }
+
+    // Переименование становится надежным только после сброса директории
+    if (m_options.syncMode == MtpSyncMode::Durable) {
+        int directory = ::open(parentDirectory(m_path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory >= 0) {
+            fsync(directory);
+            close(directory);
+        }
+    }
+
+    return true;
+}
+
+bool MtpFileWriter::suspend()
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    if (m_current.data && m_current.length > 0 && !submitCurrent()) {
+        abort();
+        return false;
+    }
+    stopThread(false);
+
+    if (m_failed) {
+        abort();
+        return false;
+    }
+
+    // Смещение продолжения сохраняется в журнале, поэтому данные до него
+    // должны быть на диске независимо от режима сброса
+    if (fdatasync(m_fd) != 0) {
+        setError("Failed to flush " + m_tempPath);
+        abort();
+        return false;
+    }
+
+    close(m_fd);
+    m_fd = -1;
+    return true;
+}
+
+void MtpFileWriter::abort()
+{
+    stopThread(true);
+
+    bufferPool().release(m_current.data, m_options.blockSize);
+    m_current = Block();
+
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+        unlink(m_tempPath.c_str());
+    }
+}
+
+uint64_t MtpFileWriter::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+std::string MtpFileWriter::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+void MtpFileWriter::run()
+{
+    for (;;) {
+        Block block;
+        bool discard;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this]() { return !m_queue.empty() || m_closing; });
+            if (m_queue.empty()) {
+                break;
+            }
+            block = m_queue.front();
+            m_queue.pop_front();
+            discard = m_discard;
+        }
+        m_notFull.notify_one();
+
+        if (!discard && !m_failed && !writeBlock(block)) {
+            m_failed = true;
+            m_notFull.notify_all();
+        }
+        bufferPool().release(block.data, m_options.blockSize);
+    }
+}
+
+bool MtpFileWriter::writeBlock(const Block& block)
+{
+    size_t done = 0;
+    while (done < block.length) {
+        ssize_t count = pwrite(m_fd, block.data + done, block.length - done,
+                               static_cast<off_t>(block.offset + done));
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError("Failed to write " + m_tempPath);
+            return false;
+        }
+        done += static_cast<size_t>(count);
+    }
+
+#ifdef __linux__
+    if (m_options.syncMode != MtpSyncMode::None) {
+        // Запускаем запись этого блока, а предыдущие дожидаемся и убираем
+        // из кэша страниц: так диск пишет равномерно, без больших сбросов
+        sync_file_range(m_fd, static_cast<off_t>(block.offset), static_cast<off_t>(block.length),
+                        SYNC_FILE_RANGE_WRITE);
+
+        if (block.offset > m_flushedUpTo) {
+            off_t start = static_cast<off_t>(m_flushedUpTo);
+            off_t length = static_cast<off_t>(block.offset - m_flushedUpTo);
+            sync_file_range(m_fd, start, length,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(m_fd, start, length, POSIX_FADV_DONTNEED);
+            m_flushedUpTo = block.offset;
+        }
+    }
+#endif
+
+    return true;
+}
+
+bool MtpFileWriter::submitCurrent()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]() { return m_queue.size() < m_options.queueDepth || m_failed; });
+        if (!m_failed) {
+            m_queue.push_back(m_current);
+            m_current = Block();
+        }
+    }
+
+    if (m_failed) {
+        return false;
+    }
+
+    m_notEmpty.notify_one();
+    return true;
+}
+
+void MtpFileWriter::stopThread(bool discard)
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+        m_discard = m_discard || discard;
+    }
+    m_notEmpty.notify_all();
+    m_thread.join();
+}
+
+void MtpFileWriter::setError(const std::string& message)
+{
+    std::string error = message + ": " + strerror(errno);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lastError = error;
+}
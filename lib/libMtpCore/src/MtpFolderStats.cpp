@@ -0,0 +1,227 @@
+#include "MtpFolderStats.h"
+
+namespace {
+
+void addSize(MtpFolderSize& target, const MtpFolderSize& delta)
+{
+    target.totalSize += delta.totalSize;
+    target.fileCount += delta.fileCount;
+    target.folderCount += delta.folderCount;
+}
+
+void subtractSize(MtpFolderSize& target, const MtpFolderSize& delta)
+{
+    target.totalSize -= delta.totalSize;
+    target.fileCount -= delta.fileCount;
+    target.folderCount -= delta.folderCount;
+}
+
+} // namespace
+
+MtpFolderStats::MtpFolderStats()
+    : m_ready(false)
+{
+}
+
+void MtpFolderStats::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_nodes.clear();
+    m_children.clear();
+    m_root = MtpFolderSize();
+    m_ready = false;
+}
+
+void MtpFolderStats::reserve(size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nodes.reserve(count);
+}
+
+void MtpFolderStats::add(const MtpObjectInfo& info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_nodes.find(info.id);
+    if (it != m_nodes.end()) {
+        // Объект изменился или переместился: снимаем старый вклад у прежних предков.
+        // Содержимое директории остается при ней
+        Node& node = it->second;
+        if (m_ready) {
+            applyToAncestorsLocked(node.parentId, contributionOf(node), false);
+        }
+        if (node.parentId != info.parentId) {
+            detachLocked(node.parentId, info.id);
+            m_children[info.parentId].insert(info.id);
+        }
+        node.parentId = info.parentId;
+        node.size = node.isDirectory ? 0 : info.size;
+        if (m_ready) {
+            applyToAncestorsLocked(node.parentId, contributionOf(node), true);
+        }
+        return;
+    }
+
+    Node node;
+    node.parentId = info.parentId;
+    node.isDirectory = info.type == LIBMTP_FILETYPE_FOLDER;
+    node.size = node.isDirectory ? 0 : info.size;
+    m_nodes[info.id] = node;
+    m_children[info.parentId].insert(info.id);
+
+    if (m_ready) {
+        applyToAncestorsLocked(node.parentId, contributionOf(node), true);
+    }
+}
+
+bool MtpFolderStats::remove(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_nodes.find(id);
+    if (it == m_nodes.end()) {
+        return false;
+    }
+
+    // Суммы предков меняются на вклад объекта целиком, включая содержимое директории
+    if (m_ready) {
+        applyToAncestorsLocked(it->second.parentId, contributionOf(it->second), false);
+    }
+    detachLocked(it->second.parentId, id);
+
+    // Содержимое удаленной директории забываем
+    std::vector<uint32_t> pending = {id};
+    while (!pending.empty()) {
+        uint32_t current = pending.back();
+        pending.pop_back();
+        m_nodes.erase(current);
+
+        auto children = m_children.find(current);
+        if (children != m_children.end()) {
+            pending.insert(pending.end(), children->second.begin(), children->second.end());
+            m_children.erase(children);
+        }
+    }
+
+    return true;
+}
+
+void MtpFolderStats::applyChange(const MtpObjectChange& change)
+{
+    switch (change.type) {
+        case MtpObjectChangeType::Added:
+        case MtpObjectChangeType::Changed:
+            add(change.info);
+            break;
+        case MtpObjectChangeType::Removed:
+            remove(change.info.id);
+            break;
+    }
+}
+
+void MtpFolderStats::recalculate()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Обход в ширину от объектов, чьи родители неизвестны (лежат в корне хранилища)
+    std::vector<uint32_t> order;
+    order.reserve(m_nodes.size());
+    for (auto& pair : m_nodes) {
+        pair.second.total = MtpFolderSize();
+        if (m_nodes.find(pair.second.parentId) == m_nodes.end()) {
+            order.push_back(pair.first);
+        }
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto children = m_children.find(order[i]);
+        if (children != m_children.end()) {
+            order.insert(order.end(), children->second.begin(), children->second.end());
+        }
+    }
+
+    // В обратном порядке обхода дети обрабатываются раньше родителей
+    m_root = MtpFolderSize();
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        const Node& node = m_nodes[*it];
+        auto parent = m_nodes.find(node.parentId);
+        addSize(parent != m_nodes.end() ? parent->second.total : m_root, contributionOf(node));
+    }
+
+    m_ready = true;
+}
+
+bool MtpFolderStats::getFolderSize(uint32_t folderId, MtpFolderSize& result) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_ready) {
+        return false;
+    }
+
+    if (folderId == 0) {
+        result = m_root;
+        return true;
+    }
+
+    auto it = m_nodes.find(folderId);
+    if (it == m_nodes.end() || !it->second.isDirectory) {
+        return false;
+    }
+
+    result = it->second.total;
+    return true;
+}
+
+size_t MtpFolderStats::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nodes.size();
+}
+
+MtpFolderSize MtpFolderStats::contributionOf(const Node& node)
+{
+    MtpFolderSize result;
+    if (node.isDirectory) {
+        result = node.total;
+        result.folderCount += 1;
+    } else {
+        result.totalSize = node.size;
+        result.fileCount = 1;
+    }
+    return result;
+}
+
+void MtpFolderStats::applyToAncestorsLocked(uint32_t parentId, const MtpFolderSize& delta, bool add)
+{
+    // Глубина ограничена количеством объектов на случай циклов в данных устройства
+    size_t depth = 0;
+    auto it = m_nodes.find(parentId);
+    while (it != m_nodes.end() && depth++ <= m_nodes.size()) {
+        if (add) {
+            addSize(it->second.total, delta);
+        } else {
+            subtractSize(it->second.total, delta);
+        }
+        it = m_nodes.find(it->second.parentId);
+    }
+
+    if (add) {
+        addSize(m_root, delta);
+    } else {
+        subtractSize(m_root, delta);
+    }
+}
+
+void MtpFolderStats::detachLocked(uint32_t parentId, uint32_t id)
+{
+    auto children = m_children.find(parentId);
+    if (children == m_children.end()) {
+        return;
+    }
+
+    children->second.erase(id);
+    if (children->second.empty()) {
+        m_children.erase(children);
+    }
+}
@@ -0,0 +1,81 @@
+#include "MtpHandle.h"
+
+const uint32_t MtpHandleTable::CAPACITY;
+
+MtpHandleTable& MtpHandleTable::instance()
+{
+    static MtpHandleTable table;
+    return table;
+}
+
+MtpHandleTable::MtpHandleTable()
+{
+    for (auto& slot : m_slots) {
+        slot.generation.store(1, std::memory_order_relaxed);
+        slot.device.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+MtpDeviceHandle MtpHandleTable::add(LIBMTP_mtpdevice_t* device)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    MtpDeviceHandle handle;
+    for (uint32_t i = 0; i < CAPACITY; ++i) {
+        Slot& slot = m_slots[i];
+        if (slot.device.load(std::memory_order_relaxed) == nullptr) {
+            slot.device.store(device, std::memory_order_release);
+            handle.index = i;
+            handle.generation = slot.generation.load(std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    return handle;
+}
+
+void MtpHandleTable::remove(MtpDeviceHandle handle)
+{
+    if (handle.isNull() || handle.index >= CAPACITY) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Slot& slot = m_slots[handle.index];
+    if (slot.generation.load(std::memory_order_relaxed) != handle.generation) {
+        return;
+    }
+
+    slot.device.store(nullptr, std::memory_order_release);
+
+    // Ноль зарезервирован за пустой ссылкой
+    uint32_t next = handle.generation + 1;
+    slot.generation.store(next ? next : 1, std::memory_order_release);
+}
+
+LIBMTP_mtpdevice_t* MtpHandleTable::resolve(MtpDeviceHandle handle) const
+{
+    if (handle.isNull() || handle.index >= CAPACITY) {
+        return nullptr;
+    }
+
+    const Slot& slot = m_slots[handle.index];
+
+    // Поколение проверяется до и после чтения указателя: если между
+    // проверками ячейку освободили и заняли снова, указатель чужой
+    if (slot.generation.load(std::memory_order_acquire) != handle.generation) {
+        return nullptr;
+    }
+    LIBMTP_mtpdevice_t* device = slot.device.load(std::memory_order_acquire);
+    if (slot.generation.load(std::memory_order_acquire) != handle.generation) {
+        return nullptr;
+    }
+
+    return device;
+}
+
+bool MtpHandleTable::isValid(MtpDeviceHandle handle) const
+{
+    return resolve(handle) != nullptr;
+}
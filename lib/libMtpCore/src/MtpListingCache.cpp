@@ -0,0 +1,285 @@
+#include "MtpListingCache.h"
+#include "MtpBackend.h"
+#include "MtpCommandScheduler.h"
+#include <iterator>
+
+const size_t MtpListingCache::DEFAULT_MAX_ENTRIES;
+const size_t MtpListingCache::DEFAULT_PREFETCH_LIMIT;
+const uint32_t MtpListingCache::DEFAULT_MAX_AGE;
+
+MtpListingCache::MtpListingCache(MtpDeviceHandle device, uint32_t storageId,
+                                 std::shared_ptr<MtpCommandScheduler> scheduler)
+    : m_device(device)
+    , m_storageId(storageId)
+    , m_scheduler(scheduler)
+    , m_version(0)
+    , m_generation(0)
+    , m_budget(0)
+    , m_maxAge(DEFAULT_MAX_AGE)
+    , m_prefetchLimit(DEFAULT_PREFETCH_LIMIT)
+    , m_hitCount(0)
+    , m_prefetchCount(0)
+{
+}
+
+bool MtpListingCache::get(uint32_t folderId, std::vector<MtpObjectInfo>& listing)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!isFreshLocked(folderId)) {
+        return false;
+    }
+
+    listing = m_entries[folderId].listing;
+    ++m_hitCount;
+    return true;
+}
+
+uint64_t MtpListingCache::getVersion() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_version;
+}
+
+void MtpListingCache::put(uint32_t folderId, const std::vector<MtpObjectInfo>& listing, uint64_t version)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Пока шел запрос, хранилище изменилось: список мог устареть
+    if (version != m_version || m_maxAge.count() == 0) {
+        return;
+    }
+
+    if (m_entries.size() >= DEFAULT_MAX_ENTRIES && m_entries.find(folderId) == m_entries.end()) {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->second.fetchTime < oldest->second.fetchTime) {
+                oldest = it;
+            }
+        }
+        m_entries.erase(oldest);
+    }
+
+    Entry& entry = m_entries[folderId];
+    entry.listing = listing;
+    entry.fetchTime = std::chrono::steady_clock::now();
+
+    // Родители поддиректорий нужны, чтобы подниматься по цепочке без GetObjectInfo
+    for (const auto& info : listing) {
+        if (info.isDirectory()) {
+            m_parents[info.id] = folderId;
+        }
+    }
+}
+
+void MtpListingCache::prefetch(uint32_t folderId, uint32_t parentId, const std::vector<MtpObjectInfo>& listing)
+{
+    uint64_t generation;
+    std::vector<uint32_t> folders;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Новый переход отменяет команды предыдущего: они еще в очереди,
+        // но завершатся сразу, не обращаясь к устройству
+        generation = ++m_generation;
+        m_budget = m_prefetchLimit;
+
+        if (!m_scheduler || m_budget == 0 || m_maxAge.count() == 0) {
+            return;
+        }
+
+        if (folderId != 0) {
+            m_parents[folderId] = parentId;
+        }
+        for (const auto& info : listing) {
+            if (info.isDirectory() && !isFreshLocked(info.id)) {
+                folders.push_back(info.id);
+            }
+        }
+    }
+
+    // Родитель первым: он один, а поддиректорий может быть больше лимита
+    if (folderId != 0) {
+        schedule(generation, parentId, true);
+    }
+    for (uint32_t id : folders) {
+        if (!schedule(generation, id, false)) {
+            break;
+        }
+    }
+}
+
+void MtpListingCache::applyChange(const MtpObjectChange& change)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    ++m_version;
+    invalidateLocked(change.info.id);
+    m_entries.erase(change.info.parentId);
+
+    if (change.type == MtpObjectChangeType::Removed) {
+        m_parents.erase(change.info.id);
+    } else if (change.info.isDirectory()) {
+        m_parents[change.info.id] = change.info.parentId;
+    }
+}
+
+void MtpListingCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries.clear();
+    m_parents.clear();
+    ++m_version;
+    ++m_generation;
+}
+
+void MtpListingCache::setMaxAge(uint32_t seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_maxAge = std::chrono::seconds(seconds);
+    if (seconds == 0) {
+        m_entries.clear();
+    }
+}
+
+void MtpListingCache::setPrefetchLimit(size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_prefetchLimit = count;
+}
+
+uint64_t MtpListingCache::getHitCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hitCount;
+}
+
+uint64_t MtpListingCache::getPrefetchCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_prefetchCount;
+}
+
+bool MtpListingCache::schedule(uint64_t generation, uint32_t folderId, bool followParents)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (generation != m_generation || m_budget == 0) {
+            return false;
+        }
+        --m_budget;
+    }
+
+    std::weak_ptr<MtpListingCache> weakCache = shared_from_this();
+    return m_scheduler->post(MtpCommandPriority::Idle, [weakCache, generation, folderId, followParents]() {
+        if (std::shared_ptr<MtpListingCache> cache = weakCache.lock()) {
+            cache->fetchOnDevice(generation, folderId, followParents);
+        }
+    });
+}
+
+void MtpListingCache::fetchOnDevice(uint64_t generation, uint32_t folderId, bool followParents)
+{
+    bool fresh;
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (generation != m_generation) {
+            return;
+        }
+        fresh = isFreshLocked(folderId);
+        version = m_version;
+    }
+
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+    if (!device) {
+        return;
+    }
+
+    MtpBackend& backend = MtpBackend::instance();
+
+    if (!fresh) {
+        LIBMTP_file_t* fileList = backend.getFilesAndFolders(device, m_storageId, folderId);
+
+        // Пустой список без ошибки - пустая директория, ее тоже запоминаем.
+        // Ошибку убираем из стека, чтобы она не досталась команде пользователя
+        if (!fileList && backend.getErrorstack(device)) {
+            backend.clearErrorstack(device);
+            return;
+        }
+
+        std::vector<MtpObjectInfo> listing;
+        LIBMTP_file_t* current = fileList;
+        while (current) {
+            listing.push_back(makeObjectInfo(current, m_storageId));
+            LIBMTP_file_t* next = current->next;
+            LIBMTP_destroy_file_t(current);
+            current = next;
+        }
+
+        put(folderId, listing, version);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_prefetchCount;
+    }
+
+    if (!followParents || folderId == 0) {
+        return;
+    }
+
+    uint32_t parentId = 0;
+    bool known = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_parents.find(folderId);
+        if (it != m_parents.end()) {
+            parentId = it->second;
+            known = true;
+        }
+    }
+
+    if (!known) {
+        LIBMTP_file_t* file = backend.getFilemetadata(device, folderId);
+        if (!file) {
+            if (backend.getErrorstack(device)) {
+                backend.clearErrorstack(device);
+            }
+            return;
+        }
+        parentId = file->parent_id;
+        LIBMTP_destroy_file_t(file);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_parents[folderId] = parentId;
+    }
+
+    // Следующий уровень - отдельной командой, чтобы между уровнями
+    // успевали выполняться команды пользователя
+    schedule(generation, parentId, true);
+}
+
+bool MtpListingCache::isFreshLocked(uint32_t folderId) const
+{
+    auto it = m_entries.find(folderId);
+    return it != m_entries.end() &&
+           std::chrono::steady_clock::now() - it->second.fetchTime < m_maxAge;
+}
+
+void MtpListingCache::invalidateLocked(uint32_t id)
+{
+    m_entries.erase(id);
+
+    // Старый родитель перемещенного объекта неизвестен: ищем объект в списках
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        bool contains = false;
+        for (const auto& info : it->second.listing) {
+            if (info.id == id) {
+                contains = true;
+                break;
+            }
+        }
+        it = contains ? m_entries.erase(it) : std::next(it);
+    }
+}
@@ -0,0 +1,50 @@
+#include "MtpObjectNotifier.h"
+#include <algorithm>
+
+MtpObjectNotifier::MtpObjectNotifier()
+    : m_nextCallbackId(1)
+{
+}
+
+int MtpObjectNotifier::registerCallback(ObjectChangeCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    int callbackId = m_nextCallbackId++;
+    m_callbacks.push_back(std::make_pair(callbackId, callback));
+
+    return callbackId;
+}
+
+bool MtpObjectNotifier::unregisterCallback(int callbackId)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = std::find_if(m_callbacks.begin(), m_callbacks.end(),
+                          [callbackId](const std::pair<int, ObjectChangeCallback>& pair) {
+                              return pair.first == callbackId;
+                          });
+
+    if (it != m_callbacks.end()) {
+        m_callbacks.erase(it);
+        return true;
+    }
+
+    return false;
+}
+
+void MtpObjectNotifier::notify(const MtpObjectChange& change) const
+{
+    // Копируем список, чтобы не держать мьютекс во время вызова
+    std::vector<ObjectChangeCallback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& pair : m_callbacks) {
+            callbacks.push_back(pair.second);
+        }
+    }
+
+    for (const auto& callback : callbacks) {
+        callback(change);
+    }
+}
@@ -0,0 +1,422 @@
+#include "MtpSearchIndex.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+// Минимальное количество удаленных строк, после которого имеет смысл уплотнение
+const size_t COMPACT_THRESHOLD = 4096;
+
+uint32_t trigramKey(const char* text)
+{
+    return (static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16)
+         | (static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8)
+         |  static_cast<uint32_t>(static_cast<unsigned char>(text[2]));
+}
+
+// Сопоставление с шаблоном; имя и шаблон уже в нижнем регистре
+bool matchClass(const char*& pattern, const char* patternEnd, char c)
+{
+    // pattern указывает на символ после '['
+    bool negate = false;
+    if (pattern < patternEnd && (*pattern == '!' || *pattern == '^')) {
+        negate = true;
+        ++pattern;
+    }
+
+    bool matched = false;
+    bool first = true;
+    while (pattern < patternEnd && (*pattern != ']' || first)) {
+        char low = *pattern++;
+        char high = low;
+        if (pattern + 1 < patternEnd && *pattern == '-' && pattern[1] != ']') {
+            high = pattern[1];
+            pattern += 2;
+        }
+        if (c >= low && c <= high) {
+            matched = true;
+        }
+        first = false;
+    }
+    if (pattern < patternEnd) {
+        ++pattern; // пропускаем ']'
+    }
+
+    return matched != negate;
+}
+
+bool globMatch(const char* pattern, const char* patternEnd, const char* text, const char* textEnd)
+{
+    const char* starPattern = nullptr;
+    const char* starText = nullptr;
+
+    while (text < textEnd) {
+        if (pattern < patternEnd && *pattern == '*') {
+            starPattern = ++pattern;
+            starText = text;
+            continue;
+        }
+
+        if (pattern < patternEnd) {
+            const char* next = pattern;
+            bool matched = false;
+            if (*next == '?') {
+                matched = true;
+                ++next;
+            } else if (*next == '[') {
+                ++next;
+                matched = matchClass(next, patternEnd, *text);
+            } else {
+                matched = (*next == *text);
+                ++next;
+            }
+            if (matched) {
+                pattern = next;
+                ++text;
+                continue;
+            }
+        }
+
+        // Откатываемся к последней звездочке
+        if (!starPattern) {
+            return false;
+        }
+        pattern = starPattern;
+        text = ++starText;
+    }
+
+    while (pattern < patternEnd && *pattern == '*') {
+        ++pattern;
+    }
+    return pattern == patternEnd;
+}
+
+// Самый длинный фрагмент шаблона без спецсимволов
+std::string longestGlobLiteral(const std::string& glob)
+{
+    std::string best;
+    std::string current;
+    for (size_t i = 0; i < glob.size(); ++i) {
+        char c = glob[i];
+        if (c == '*' || c == '?' || c == '[') {
+            if (current.size() > best.size()) {
+                best = current;
+            }
+            current.clear();
+            if (c == '[') {
+                size_t close = glob.find(']', i + 2);
+                i = (close == std::string::npos) ? glob.size() : close;
+            }
+        } else {
+            current.push_back(c);
+        }
+    }
+    return current.size() > best.size() ? current : best;
+}
+
+} // namespace
+
+MtpSearchIndex::MtpSearchIndex()
+    : m_deadRows(0)
+{
+}
+
+void MtpSearchIndex::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_names.clear();
+    m_lowerNames.clear();
+    m_nameOffsets.clear();
+    m_nameLengths.clear();
+    m_ids.clear();
+    m_parentIds.clear();
+    m_storageIds.clear();
+    m_sizes.clear();
+    m_types.clear();
+    m_dates.clear();
+    m_alive.clear();
+    m_rowById.clear();
+    m_trigrams.clear();
+    m_deadRows = 0;
+}
+
+void MtpSearchIndex::reserve(size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // В среднем имя файла на телефоне занимает около 24 байт
+    m_names.reserve(count * 24);
+    m_lowerNames.reserve(count * 24);
+    m_nameOffsets.reserve(count);
+    m_nameLengths.reserve(count);
+    m_ids.reserve(count);
+    m_parentIds.reserve(count);
+    m_storageIds.reserve(count);
+    m_sizes.reserve(count);
+    m_types.reserve(count);
+    m_dates.reserve(count);
+    m_alive.reserve(count);
+    m_rowById.reserve(count);
+}
+
+void MtpSearchIndex::add(const MtpObjectInfo& info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    addLocked(info);
+}
+
+bool MtpSearchIndex::remove(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_rowById.find(id);
+    if (it == m_rowById.end()) {
+        return false;
+    }
+
+    bool isDirectory = m_types[it->second] == LIBMTP_FILETYPE_FOLDER;
+    removeRowLocked(it->second);
+
+    // Для директории удаляем все вложенные объекты. Строки обычно
+    // идут в порядке обхода (родитель раньше потомков), поэтому
+    // чаще всего хватает одного прохода.
+    if (isDirectory) {
+        std::unordered_set<uint32_t> removed = {id};
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (uint32_t row = 0; row < m_ids.size(); ++row) {
+                if (m_alive[row] && removed.count(m_parentIds[row])) {
+                    removed.insert(m_ids[row]);
+                    removeRowLocked(row);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (m_deadRows >= COMPACT_THRESHOLD && m_deadRows > m_rowById.size()) {
+        compactLocked();
+    }
+
+    return true;
+}
+
+void MtpSearchIndex::applyChange(const MtpObjectChange& change)
+{
+    switch (change.type) {
+        case MtpObjectChangeType::Added:
+        case MtpObjectChangeType::Changed:
+            add(change.info);
+            break;
+        case MtpObjectChangeType::Removed:
+            remove(change.info.id);
+            break;
+    }
+}
+
+std::vector<MtpObjectInfo> MtpSearchIndex::search(const MtpSearchQuery& query) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<MtpObjectInfo> results;
+    std::string substring = toLowerUtf8(query.substring);
+    std::string glob = toLowerUtf8(query.glob);
+
+    // Выбираем кандидатов по триграммам самого длинного известного фрагмента имени
+    std::string globLiteral = longestGlobLiteral(glob);
+    const std::string& literal = substring.size() >= globLiteral.size() ? substring : globLiteral;
+
+    std::vector<uint32_t> candidates;
+    bool useCandidates = candidatesForLocked(literal, candidates);
+    size_t total = useCandidates ? candidates.size() : m_ids.size();
+
+    for (size_t i = 0; i < total; ++i) {
+        uint32_t row = useCandidates ? candidates[i] : static_cast<uint32_t>(i);
+
+        if (!m_alive[row] || !matchesAttributesLocked(row, query)) {
+            continue;
+        }
+
+        const char* name = m_lowerNames.data() + m_nameOffsets[row];
+        const char* nameEnd = name + m_nameLengths[row];
+
+        if (!substring.empty() &&
+            std::search(name, nameEnd, substring.begin(), substring.end()) == nameEnd) {
+            continue;
+        }
+
+        if (!glob.empty() && !globMatch(glob.data(), glob.data() + glob.size(), name, nameEnd)) {
+            continue;
+        }
+
+        if (!query.extensions.empty() && !query.matchesExtension(std::string(name, nameEnd))) {
+            continue;
+        }
+
+        results.push_back(rowInfoLocked(row));
+        if (query.limit && results.size() >= query.limit) {
+            break;
+        }
+    }
+
+    return results;
+}
+
+size_t MtpSearchIndex::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rowById.size();
+}
+
+void MtpSearchIndex::addLocked(const MtpObjectInfo& info)
+{
+    auto existing = m_rowById.find(info.id);
+    if (existing != m_rowById.end()) {
+        removeRowLocked(existing->second);
+    }
+
+    uint32_t row = static_cast<uint32_t>(m_ids.size());
+    uint32_t offset = static_cast<uint32_t>(m_names.size());
+    std::string lowerName = toLowerUtf8(info.name);
+
+    m_names.append(info.name);
+    m_lowerNames.append(lowerName);
+    m_nameOffsets.push_back(offset);
+    m_nameLengths.push_back(static_cast<uint32_t>(info.name.size()));
+    m_ids.push_back(info.id);
+    m_parentIds.push_back(info.parentId);
+    m_storageIds.push_back(info.storageId);
+    m_sizes.push_back(info.size);
+    m_types.push_back(info.type);
+    m_dates.push_back(info.modificationDate);
+    m_alive.push_back(1);
+    m_rowById[info.id] = row;
+
+    // Строки добавляются по возрастанию, поэтому списки остаются отсортированными
+    for (size_t i = 0; i + 3 <= lowerName.size(); ++i) {
+        std::vector<uint32_t>& rows = m_trigrams[trigramKey(lowerName.data() + i)];
+        if (rows.empty() || rows.back() != row) {
+            rows.push_back(row);
+        }
+    }
+}
+
+bool MtpSearchIndex::removeRowLocked(uint32_t row)
+{
+    if (!m_alive[row]) {
+        return false;
+    }
+
+    m_alive[row] = 0;
+    m_rowById.erase(m_ids[row]);
+    ++m_deadRows;
+    return true;
+}
+
+void MtpSearchIndex::compactLocked()
+{
+    std::vector<MtpObjectInfo> alive;
+    alive.reserve(m_rowById.size());
+    for (uint32_t row = 0; row < m_ids.size(); ++row) {
+        if (m_alive[row]) {
+            alive.push_back(rowInfoLocked(row));
+        }
+    }
+
+    m_names.clear();
+    m_lowerNames.clear();
+    m_nameOffsets.clear();
+    m_nameLengths.clear();
+    m_ids.clear();
+    m_parentIds.clear();
+    m_storageIds.clear();
+    m_sizes.clear();
+    m_types.clear();
+    m_dates.clear();
+    m_alive.clear();
+    m_rowById.clear();
+    m_trigrams.clear();
+    m_deadRows = 0;
+
+    for (const auto& info : alive) {
+        addLocked(info);
+    }
+}
+
+MtpObjectInfo MtpSearchIndex::rowInfoLocked(uint32_t row) const
+{
+    MtpObjectInfo info;
+    info.id = m_ids[row];
+    info.parentId = m_parentIds[row];
+    info.storageId = m_storageIds[row];
+    info.name.assign(m_names, m_nameOffsets[row], m_nameLengths[row]);
+    info.size = m_sizes[row];
+    info.type = m_types[row];
+    info.modificationDate = m_dates[row];
+    return info;
+}
+
+bool MtpSearchIndex::matchesAttributesLocked(uint32_t row, const MtpSearchQuery& query) const
+{
+    bool isDirectory = m_types[row] == LIBMTP_FILETYPE_FOLDER;
+    if (isDirectory && !query.includeDirectories) {
+        return false;
+    }
+
+    // Ограничения по размеру к директориям не применяются
+    if (!isDirectory && (m_sizes[row] < query.minSize || m_sizes[row] > query.maxSize)) {
+        return false;
+    }
+
+    if (query.modifiedAfter && m_dates[row] < query.modifiedAfter) {
+        return false;
+    }
+    if (query.modifiedBefore && m_dates[row] > query.modifiedBefore) {
+        return false;
+    }
+
+    if (!query.types.empty() &&
+        std::find(query.types.begin(), query.types.end(), m_types[row]) == query.types.end()) {
+        return false;
+    }
+
+    return true;
+}
+
+bool MtpSearchIndex::candidatesForLocked(const std::string& literal, std::vector<uint32_t>& rows) const
+{
+    if (literal.size() < 3) {
+        return false;
+    }
+
+    // Собираем списки строк для всех триграмм фрагмента
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (size_t i = 0; i + 3 <= literal.size(); ++i) {
+        auto it = m_trigrams.find(trigramKey(literal.data() + i));
+        if (it == m_trigrams.end()) {
+            rows.clear();
+            return true;
+        }
+        lists.push_back(&it->second);
+    }
+
+    // Пересекаем, начиная с самого короткого списка
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) {
+                  return a->size() < b->size();
+              });
+
+    rows = *lists.front();
+    std::vector<uint32_t> intersection;
+    for (size_t i = 1; i < lists.size() && !rows.empty(); ++i) {
+        intersection.clear();
+        std::set_intersection(rows.begin(), rows.end(),
+                              lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(intersection));
+        rows.swap(intersection);
+    }
+
+    return true;
+}
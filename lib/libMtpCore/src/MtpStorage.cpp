@@ -1,65 +1,163 @@
 #include "MtpStorage.h"
+#include "MtpBackend.h"
 #include "MtpFile.h"
 #include "MtpDirectory.h"
-#include <iostream>
+#include "MtpObjectNotifier.h"
+#include "MtpSearchIndex.h"
+#include "MtpFolderStats.h"
+#include "MtpListingCache.h"
+#include "MtpCommandScheduler.h"
+#include "MtpHandle.h"
+#include <deque>
 
-MtpStorage::MtpStorage(LIBMTP_mtpdevice_t* device, LIBMTP_devicestorage_t* storage)
+namespace {
+
+// Состояние пакетного обхода, передаваемое в функцию хода libmtp
+struct EnumerationState {
+    const MtpStorage::EnumerationProgressCallback* progress;
+    bool cancelled;
+};
+
+// Переходник от функции хода обхода libmtp к EnumerationProgressCallback
+int enumerationProgress(uint64_t const sent, uint64_t const total, void const* const data)
+{
+    EnumerationState* state = static_cast<EnumerationState*>(const_cast<void*>(data));
+
+    // libmtp может не прервать получение списка, поэтому отмена
+    // запоминается и проверяется после возврата из libmtp
+    if (!state->cancelled && !(*state->progress)(sent, total)) {
+        state->cancelled = true;
+    }
+
+    // Ненулевое значение просит libmtp прервать операцию
+    return state->cancelled ? 1 : 0;
+}
+
+// Перечисляет директории дерева libmtp: родитель раньше потомков
+void visitFolders(LIBMTP_folder_t* folder, uint32_t storageId,
+                  const MtpStorage::ObjectVisitor& visitor, uint64_t& count)
+{
+    for (; folder; folder = folder->sibling) {
+        MtpObjectInfo info;
+        info.id = folder->folder_id;
+        info.parentId = folder->parent_id;
+        info.storageId = storageId;
+        info.name = folder->name ? folder->name : "";
+        info.type = LIBMTP_FILETYPE_FOLDER;
+        visitor(info);
+        ++count;
+
+        visitFolders(folder->child, storageId, visitor, count);
+    }
+}
+
+} // namespace
+
+MtpStorage::MtpStorage(MtpDeviceHandle device, const LIBMTP_devicestorage_t* storage,
+                       std::shared_ptr<MtpCommandScheduler> scheduler)
     : m_device(device)
-    , m_storage(storage)
+    , m_id(storage->id)
+    , m_maxCapacity(0)
+    , m_freeSpace(0)
+    , m_notifier(std::make_shared<MtpObjectNotifier>())
+    , m_scheduler(scheduler)
+    , m_searchIndexCallbackId(0)
+    , m_folderStatsCallbackId(0)
+    , m_listings(std::make_shared<MtpListingCache>(device, storage->id, scheduler))
+    , m_listingsCallbackId(0)
+    , m_enumerationMode(MtpEnumerationMode::Auto)
 {
+    update(storage);
+
+    std::weak_ptr<MtpListingCache> weakListings = m_listings;
+    m_listingsCallbackId = m_notifier->registerCallback([weakListings](const MtpObjectChange& change) {
+        if (std::shared_ptr<MtpListingCache> target = weakListings.lock()) {
+            target->applyChange(change);
+        }
+    });
 }
 
 MtpStorage::~MtpStorage()
 {
-    // Не освобождаем m_storage, так как он будет освобожден
-    // при освобождении устройства
+    if (m_searchIndexCallbackId) {
+        m_notifier->unregisterCallback(m_searchIndexCallbackId);
+    }
+    if (m_folderStatsCallbackId) {
+        m_notifier->unregisterCallback(m_folderStatsCallbackId);
+    }
+    m_notifier->unregisterCallback(m_listingsCallbackId);
 }
 
 uint32_t MtpStorage::getId() const
 {
-    return m_storage->id;
+    return m_id;
+}
+
+MtpDeviceHandle MtpStorage::getDeviceHandle() const
+{
+    return m_device;
+}
+
+bool MtpStorage::isValid() const
+{
+    return MtpHandleTable::instance().isValid(m_device);
 }
 
 std::string MtpStorage::getDescription() const
 {
-    if (m_storage->StorageDescription) {
-        return std::string(m_storage->StorageDescription);
-    }
-    return "Unknown Storage";
+    std::lock_guard<std::mutex> lock(m_propertiesMutex);
+    return m_description;
 }
 
 uint64_t MtpStorage::getMaxCapacity() const
 {
-    return m_storage->MaxCapacity;
+    std::lock_guard<std::mutex> lock(m_propertiesMutex);
+    return m_maxCapacity;
 }
 
 uint64_t MtpStorage::getFreeSpace() const
 {
-    return m_storage->FreeSpaceInBytes;
+    std::lock_guard<std::mutex> lock(m_propertiesMutex);
+    return m_freeSpace;
+}
+
+void MtpStorage::update(const LIBMTP_devicestorage_t* storage)
+{
+    // Свойства копируются: список хранилищ libmtp пересоздается при каждом обновлении
+    std::lock_guard<std::mutex> lock(m_propertiesMutex);
+    m_description = storage->StorageDescription ? storage->StorageDescription : "Unknown Storage";
+    m_maxCapacity = storage->MaxCapacity;
+    m_freeSpace = storage->FreeSpaceInBytes;
 }
 
 std::shared_ptr<MtpDirectory> MtpStorage::getRootDirectory()
 {
     // Создаем корневую директорию с ID 0
-    return std::make_shared<MtpDirectory>(m_device, 0, getId(), "Root");
+    return std::make_shared<MtpDirectory>(m_device, 0, getId(), "Root", 0, m_notifier, m_scheduler, m_listings);
 }
 
 std::shared_ptr<MtpFile> MtpStorage::getFileById(uint32_t fileId)
 {
-    LIBMTP_file_t* file = LIBMTP_Get_Filemetadata(m_device, fileId);
+    LIBMTP_file_t* file = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this, fileId]() -> LIBMTP_file_t* {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return nullptr;
+        }
+
+        LIBMTP_file_t* result = MtpBackend::instance().getFilemetadata(device, fileId);
+        if (!result) {
+            m_lastError = "File not found";
+        }
+        return result;
+    });
     
     if (!file) {
-        m_lastError = "File not found";
         return nullptr;
     }
     
     // Создаем объект MtpFile или MtpDirectory в зависимости от типа
-    std::shared_ptr<MtpFile> result;
-    if (file->filetype == LIBMTP_FILETYPE_FOLDER) {
-        result = std::make_shared<MtpDirectory>(m_device, fileId, getId(), file->filename);
-    } else {
-        result = std::make_shared<MtpFile>(m_device, file, getId());
-    }
+    std::shared_ptr<MtpFile> result = MtpFile::create(m_device, makeObjectInfo(file, getId()),
+                                                      m_notifier, m_scheduler, m_listings);
     
     // Освобождаем файловую структуру libmtp
     LIBMTP_destroy_file_t(file);
@@ -71,75 +169,495 @@ std::vector<std::shared_ptr<MtpFile>> MtpStorage::getFiles(uint32_t parentId)
 {
     std::vector<std::shared_ptr<MtpFile>> files;
     
-    LIBMTP_file_t* fileList = LIBMTP_Get_Files_And_Folders(m_device, getId(), parentId);
+    LIBMTP_file_t* fileList = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this, parentId]() -> LIBMTP_file_t* {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return nullptr;
+        }
+
+        LIBMTP_file_t* list = MtpBackend::instance().getFilesAndFolders(device, getId(), parentId);
+        if (!list) {
+            captureError("No files found");
+        }
+        return list;
+    });
     
     if (!fileList) {
-        // Проверяем на ошибки
-        LIBMTP_error_t* error = LIBMTP_Get_Errorstack(m_device);
-        if (error) {
-            m_lastError = error->error_text;
-            LIBMTP_Clear_Errorstack(m_device);
-        } else {
-            m_lastError = "No files found";
-        }
         return files;
     }
     
-    // Итерируемся по списку файлов
+    // Итерируемся по списку файлов, освобождая каждый элемент
     LIBMTP_file_t* current = fileList;
     while (current) {
-        if (current->filetype == LIBMTP_FILETYPE_FOLDER) {
-            files.push_back(std::make_shared<MtpDirectory>(m_device, current->item_id, getId(), current->filename));
-        } else {
-            files.push_back(std::make_shared<MtpFile>(m_device, current, getId()));
-        }
-        current = current->next;
+        files.push_back(MtpFile::create(m_device, makeObjectInfo(current, getId()), m_notifier, m_scheduler, m_listings));
+        LIBMTP_file_t* next = current->next;
+        LIBMTP_destroy_file_t(current);
+        current = next;
     }
     
-    // Освобождаем список файлов
-    LIBMTP_destroy_file_t(fileList);
-    
     return files;
 }
 
 uint32_t MtpStorage::createDirectory(const std::string& name, uint32_t parentId)
 {
-    uint32_t newFolderId = LIBMTP_Create_Folder(m_device, name.c_str(), parentId, getId());
+    std::string folderName(name);
+    uint32_t newFolderId = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [&]() -> uint32_t {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return 0;
+        }
+
+        uint32_t id = MtpBackend::instance().createFolder(device, &folderName[0], parentId, getId());
+        if (id == 0) {
+            captureError("Failed to create directory");
+        }
+        return id;
+    });
     
     if (newFolderId == 0) {
-        // Проверяем на ошибки
-        LIBMTP_error_t* error = LIBMTP_Get_Errorstack(m_device);
-        if (error) {
-            m_lastError = error->error_text;
-            LIBMTP_Clear_Errorstack(m_device);
-        } else {
-            m_lastError = "Failed to create directory";
-        }
+        return 0;
     }
+
+    MtpObjectInfo info;
+    info.id = newFolderId;
+    info.parentId = parentId;
+    info.storageId = getId();
+    info.name = folderName;
+    info.type = LIBMTP_FILETYPE_FOLDER;
+    info.modificationDate = time(nullptr);
+    notifyObjectChange(MtpObjectChangeType::Added, info);
     
     return newFolderId;
 }
 
 bool MtpStorage::deleteObject(uint32_t id)
 {
-    int ret = LIBMTP_Delete_Object(m_device, id);
-    
-    if (ret != 0) {
-        // Проверяем на ошибки
-        LIBMTP_error_t* error = LIBMTP_Get_Errorstack(m_device);
-        if (error) {
-            m_lastError = error->error_text;
-            LIBMTP_Clear_Errorstack(m_device);
-        } else {
-            m_lastError = "Failed to delete object";
+    bool deleted = runOnDevice(m_scheduler, MtpCommandPriority::Interactive, [this, id]() {
+        LIBMTP_mtpdevice_t* device = resolveDevice();
+        if (!device) {
+            return false;
         }
+
+        if (MtpBackend::instance().deleteObject(device, id) != 0) {
+            captureError("Failed to delete object");
+            return false;
+        }
+        return true;
+    });
+    
+    if (!deleted) {
         return false;
     }
+
+    MtpObjectInfo info;
+    info.id = id;
+    info.storageId = getId();
+    notifyObjectChange(MtpObjectChangeType::Removed, info);
     
     return true;
 }
 
+bool MtpStorage::renameObject(uint32_t id, const std::string& name)
+{
+    std::shared_ptr<MtpFile> object = getFileById(id);
+    if (!object) {
+        return false;
+    }
+
+    if (!object->rename(name)) {
+        m_lastError = object->getLastError();
+        return false;
+    }
+    return true;
+}
+
+bool MtpStorage::moveObject(uint32_t id, uint32_t parentId)
+{
+    std::shared_ptr<MtpFile> object = getFileById(id);
+    std::shared_ptr<MtpDirectory> target = object ? getDirectoryById(parentId) : nullptr;
+    if (!target) {
+        return false;
+    }
+
+    if (!object->moveTo(target)) {
+        m_lastError = object->getLastError();
+        return false;
+    }
+    return true;
+}
+
+uint32_t MtpStorage::copyObject(uint32_t id, uint32_t parentId)
+{
+    std::shared_ptr<MtpFile> object = getFileById(id);
+    std::shared_ptr<MtpDirectory> target = object ? getDirectoryById(parentId) : nullptr;
+    if (!target) {
+        return 0;
+    }
+
+    uint32_t copyId = object->copyTo(target);
+    if (copyId == 0) {
+        m_lastError = object->getLastError();
+    }
+    return copyId;
+}
+
+bool MtpStorage::enumerateObjects(const ObjectVisitor& visitor, uint32_t parentId)
+{
+    bool complete = true;
+
+    // Обход в ширину: очередь директорий, которые еще предстоит прочитать
+    std::deque<uint32_t> pending;
+    pending.push_back(parentId);
+
+    while (!pending.empty()) {
+        uint32_t folderId = pending.front();
+        pending.pop_front();
+
+        // Каждая директория - отдельная команда, чтобы между ними
+        // могли выполняться интерактивные запросы
+        bool failed = false;
+        LIBMTP_file_t* fileList = runOnDevice(m_scheduler, MtpCommandPriority::Bulk, [&]() -> LIBMTP_file_t* {
+            LIBMTP_mtpdevice_t* device = resolveDevice();
+            if (!device) {
+                failed = true;
+                return nullptr;
+            }
+
+            LIBMTP_file_t* list = MtpBackend::instance().getFilesAndFolders(device, getId(), folderId);
+            // Пустая директория тоже возвращает nullptr; ошибкой считаем только непустой стек ошибок
+            if (!list && MtpBackend::instance().getErrorstack(device)) {
+                captureError("Failed to list directory " + std::to_string(folderId));
+                failed = true;
+            }
+            return list;
+        });
+        if (!fileList) {
+            complete = complete && !failed;
+            continue;
+        }
+
+        LIBMTP_file_t* current = fileList;
+        while (current) {
+            MtpObjectInfo info = makeObjectInfo(current, getId());
+            if (info.isDirectory()) {
+                pending.push_back(info.id);
+            }
+            visitor(info);
+
+            LIBMTP_file_t* next = current->next;
+            LIBMTP_destroy_file_t(current);
+            current = next;
+        }
+    }
+
+    return complete;
+}
+
+void MtpStorage::setEnumerationMode(MtpEnumerationMode mode)
+{
+    m_enumerationMode = mode;
+}
+
+MtpEnumerationMode MtpStorage::getEnumerationMode() const
+{
+    return m_enumerationMode;
+}
+
+bool MtpStorage::enumerateAll(const ObjectVisitor& visitor, EnumerationProgressCallback progress)
+{
+    if (m_enumerationMode != MtpEnumerationMode::PerFolder) {
+        // Пакетный обход завершается неудачей до первого вызова посетителя,
+        // поэтому при откате на обход по директориям объекты не повторяются.
+        // Отмененный обход не повторяется
+        bool cancelled = false;
+        bool ok = enumerateBulk(visitor, progress, cancelled);
+        if (ok || cancelled || m_enumerationMode == MtpEnumerationMode::Bulk) {
+            return ok;
+        }
+
+        // Причина отката остается в m_lastError, если обход по директориям
+        // тоже не удастся, она будет заменена его ошибкой
+        m_lastError = "Bulk enumeration failed, falling back to per-folder listing: " + m_lastError;
+    }
+
+    uint64_t processed = 0;
+    bool cancelled = false;
+    bool complete = enumerateObjects([&](const MtpObjectInfo& info) {
+        if (cancelled) {
+            return;
+        }
+        visitor(info);
+        ++processed;
+        if (progress && !progress(processed, processed)) {
+            cancelled = true;
+        }
+    });
+
+    if (cancelled) {
+        m_lastError = "Enumeration cancelled";
+        return false;
+    }
+
+    return complete;
+}
+
+bool MtpStorage::enumerateBulk(const ObjectVisitor& visitor, const EnumerationProgressCallback& progress,
+                               bool& cancelled)
+{
+    return runOnDevice(m_scheduler, MtpCommandPriority::Bulk, [&]() {
+        return enumerateBulkOnDevice(visitor, progress, cancelled);
+    });
+}
+
+bool MtpStorage::enumerateBulkOnDevice(const ObjectVisitor& visitor, const EnumerationProgressCallback& progress,
+                                       bool& cancelled)
+{
+    // Список файлов всего устройства; libmtp заполняет им свой кэш объектов,
+    // из которого затем строится и дерево директорий без новых запросов
+    LIBMTP_mtpdevice_t* device = resolveDevice();
+    if (!device) {
+        return false;
+    }
+
+    EnumerationState state = { &progress, false };
+    LIBMTP_file_t* fileList = MtpBackend::instance().getFilelisting(
+        device, progress ? enumerationProgress : nullptr, progress ? &state : nullptr);
+
+    if (state.cancelled) {
+        while (fileList) {
+            LIBMTP_file_t* next = fileList->next;
+            LIBMTP_destroy_file_t(fileList);
+            fileList = next;
+        }
+        MtpBackend::instance().clearErrorstack(device);
+        cancelled = true;
+        m_lastError = "Enumeration cancelled";
+        return false;
+    }
+
+    if (!fileList && MtpBackend::instance().getErrorstack(device)) {
+        captureError("Bulk file listing failed");
+        return false;
+    }
+
+    uint64_t count = 0;
+    LIBMTP_folder_t* folders = MtpBackend::instance().getFolderList(device, getId());
+    if (folders) {
+        visitFolders(folders, getId(), visitor, count);
+        LIBMTP_destroy_folder_t(folders);
+    } else if (MtpBackend::instance().getErrorstack(device)) {
+        captureError("Bulk folder listing failed");
+        while (fileList) {
+            LIBMTP_file_t* next = fileList->next;
+            LIBMTP_destroy_file_t(fileList);
+            fileList = next;
+        }
+        return false;
+    }
+
+    // Оставляем только файлы этого хранилища; директории уже перечислены
+    LIBMTP_file_t* current = fileList;
+    while (current) {
+        if (current->storage_id == getId() && current->filetype != LIBMTP_FILETYPE_FOLDER) {
+            visitor(makeObjectInfo(current, getId()));
+            ++count;
+        }
+        LIBMTP_file_t* next = current->next;
+        LIBMTP_destroy_file_t(current);
+        current = next;
+    }
+
+    if (progress && !progress(count, count)) {
+        cancelled = true;
+        m_lastError = "Enumeration cancelled";
+        return false;
+    }
+
+    return true;
+}
+
+bool MtpStorage::queryObjects(const MtpObjectFilter& filter, const ObjectVisitor& visitor, uint32_t parentId)
+{
+    size_t found = 0;
+    auto matching = [&](const MtpObjectInfo& info) {
+        if (filter.limit && found >= filter.limit) {
+            return;
+        }
+        if (filter.matches(info)) {
+            ++found;
+            visitor(info);
+        }
+    };
+
+    if (parentId != 0) {
+        return enumerateObjects(matching, parentId);
+    }
+
+    // Прерываем обход, как только набран лимит; такое прерывание ошибкой не считается
+    bool complete = enumerateAll(matching, [&filter, &found](uint64_t, uint64_t) {
+        return !filter.limit || found < filter.limit;
+    });
+
+    return complete || (filter.limit && found >= filter.limit);
+}
+
+std::vector<std::shared_ptr<MtpFile>> MtpStorage::query(const MtpObjectFilter& filter, uint32_t parentId)
+{
+    std::vector<std::shared_ptr<MtpFile>> result;
+
+    queryObjects(filter, [&](const MtpObjectInfo& info) {
+        result.push_back(MtpFile::create(m_device, info, m_notifier, m_scheduler, m_listings));
+    }, parentId);
+
+    return result;
+}
+
+template <typename Target>
+bool MtpStorage::buildFromEnumeration(std::shared_ptr<Target>& installed, int& callbackId,
+                                      const EnumerationProgressCallback& progress,
+                                      const std::function<void(Target&)>& finish)
+{
+    std::shared_ptr<Target> target = std::make_shared<Target>();
+
+    // Подписываемся до обхода, чтобы не потерять изменения, сделанные во время обхода
+    std::weak_ptr<Target> weakTarget = target;
+    int newCallbackId = m_notifier->registerCallback([weakTarget](const MtpObjectChange& change) {
+        if (std::shared_ptr<Target> locked = weakTarget.lock()) {
+            locked->applyChange(change);
+        }
+    });
+
+    bool complete = enumerateAll([&target](const MtpObjectInfo& info) {
+        target->add(info);
+    }, progress);
+
+    // Неполные данные не устанавливаются: следующий запрос повторит обход.
+    // Причину сообщает enumerateAll через m_lastError
+    if (!complete) {
+        m_notifier->unregisterCallback(newCallbackId);
+        return false;
+    }
+
+    if (finish) {
+        finish(*target);
+    }
+
+    if (callbackId) {
+        m_notifier->unregisterCallback(callbackId);
+    }
+    callbackId = newCallbackId;
+    installed = target;
+    return true;
+}
+
+bool MtpStorage::buildSearchIndex(EnumerationProgressCallback progress)
+{
+    return buildFromEnumeration<MtpSearchIndex>(m_searchIndex, m_searchIndexCallbackId, progress, nullptr);
+}
+
+std::vector<MtpObjectInfo> MtpStorage::search(const MtpSearchQuery& query)
+{
+    if (!m_searchIndex && !buildSearchIndex()) {
+        return std::vector<MtpObjectInfo>();
+    }
+
+    return m_searchIndex->search(query);
+}
+
+std::shared_ptr<MtpSearchIndex> MtpStorage::getSearchIndex() const
+{
+    return m_searchIndex;
+}
+
+bool MtpStorage::buildFolderStats(EnumerationProgressCallback progress)
+{
+    return buildFromEnumeration<MtpFolderStats>(m_folderStats, m_folderStatsCallbackId, progress,
+                                                [](MtpFolderStats& stats) {
+                                                    stats.recalculate();
+                                                });
+}
+
+bool MtpStorage::getFolderSize(uint32_t folderId, MtpFolderSize& result)
+{
+    if (!m_folderStats && !buildFolderStats()) {
+        return false;
+    }
+
+    if (!m_folderStats->getFolderSize(folderId, result)) {
+        m_lastError = "Folder not found";
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<MtpFolderStats> MtpStorage::getFolderStats() const
+{
+    return m_folderStats;
+}
+
+std::shared_ptr<MtpListingCache> MtpStorage::getListingCache() const
+{
+    return m_listings;
+}
+
+int MtpStorage::registerObjectChangeCallback(ObjectChangeCallback callback)
+{
+    return m_notifier->registerCallback(callback);
+}
+
+bool MtpStorage::unregisterObjectChangeCallback(int callbackId)
+{
+    return m_notifier->unregisterCallback(callbackId);
+}
+
 std::string MtpStorage::getLastError() const
 {
     return m_lastError;
+}
+
+LIBMTP_mtpdevice_t* MtpStorage::resolveDevice()
+{
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+    if (!device) {
+        m_lastError = MtpHandleTable::DISCONNECTED_ERROR;
+    }
+    return device;
+}
+
+void MtpStorage::captureError(const std::string& fallback)
+{
+    // Проверяем на ошибки
+    LIBMTP_mtpdevice_t* device = MtpHandleTable::instance().resolve(m_device);
+    LIBMTP_error_t* error = device ? MtpBackend::instance().getErrorstack(device) : nullptr;
+    if (error) {
+        m_lastError = error->error_text;
+        MtpBackend::instance().clearErrorstack(device);
+    } else {
+        m_lastError = fallback;
+    }
+}
+
+std::shared_ptr<MtpDirectory> MtpStorage::getDirectoryById(uint32_t id)
+{
+    if (id == 0) {
+        return getRootDirectory();
+    }
+
+    std::shared_ptr<MtpFile> object = getFileById(id);
+    if (!object) {
+        return nullptr;
+    }
+    if (!object->isDirectory()) {
+        m_lastError = "Not a directory";
+        return nullptr;
+    }
+    return std::static_pointer_cast<MtpDirectory>(object);
+}
+
+void MtpStorage::notifyObjectChange(MtpObjectChangeType type, const MtpObjectInfo& info)
+{
+    MtpObjectChange change;
+    change.type = type;
+    change.info = info;
+    m_notifier->notify(change);
 }
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include "MtpTrace.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const char TRACE_MAGIC[8] = {'M', 'T', 'P', 'T', 'R', 'A', 'C', 'E'};
+const uint64_t TRACE_VERSION = 1;
+
+void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void putSigned(std::string& out, int64_t value)
+{
+    // zigzag: небольшие отрицательные коды ошибок занимают один байт
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void putString(std::string& out, const std::string& value)
+{
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+/**
+ * @brief Последовательное чтение закодированных полей
+ */
+class Cursor {
+public:
+    Cursor(const std::string& data, size_t position)
+        : m_data(data)
+        , m_position(position)
+        , m_failed(false)
+    {
+    }
+
+    bool atEnd() const { return m_position >= m_data.size(); }
+    bool failed() const { return m_failed; }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (atEnd()) {
+                break;
+            }
+            unsigned char byte = static_cast<unsigned char>(m_data[m_position++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        m_failed = true;
+        return 0;
+    }
+
+    int64_t signedVarint()
+    {
+        uint64_t value = varint();
+        return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    std::string string()
+    {
+        uint64_t length = varint();
+        if (m_failed || length > m_data.size() - m_position) {
+            m_failed = true;
+            return std::string();
+        }
+        std::string value = m_data.substr(m_position, length);
+        m_position += length;
+        return value;
+    }
+
+    // Счетчик элементов; каждый элемент занимает хотя бы байт
+    size_t count()
+    {
+        uint64_t value = varint();
+        if (value > m_data.size() - m_position) {
+            m_failed = true;
+            return 0;
+        }
+        return static_cast<size_t>(value);
+    }
+
+private:
+    const std::string& m_data;
+    size_t m_position;
+    bool m_failed;
+};
+
+void encodeRecord(std::string& out, const MtpTraceRecord& record)
+{
+    putVarint(out, static_cast<uint64_t>(record.op));
+    putVarint(out, record.device);
+    putVarint(out, record.startUs);
+    putVarint(out, record.durationUs);
+    putSigned(out, record.result);
+    putVarint(out, record.value);
+
+    putVarint(out, record.args.size());
+    for (uint64_t arg : record.args) {
+        putVarint(out, arg);
+    }
+
+    putVarint(out, record.strings.size());
+    for (const auto& value : record.strings) {
+        putString(out, value);
+    }
+
+    putString(out, record.error);
+
+    putVarint(out, record.entries.size());
+    for (const auto& entry : record.entries) {
+        putVarint(out, entry.id);
+        putVarint(out, entry.parentId);
+        putVarint(out, entry.storageId);
+        putVarint(out, entry.size);
+        putSigned(out, entry.modificationDate);
+        putVarint(out, entry.type);
+        putString(out, entry.name);
+    }
+
+    putVarint(out, record.storages.size());
+    for (const auto& storage : record.storages) {
+        putVarint(out, storage.id);
+        putVarint(out, storage.storageType);
+        putVarint(out, storage.filesystemType);
+        putVarint(out, storage.accessCapability);
+        putVarint(out, storage.maxCapacity);
+        putVarint(out, storage.freeSpace);
+        putVarint(out, storage.freeObjects);
+        putString(out, storage.description);
+        putString(out, storage.volumeIdentifier);
+    }
+
+    putVarint(out, record.payloadSize);
+    putVarint(out, record.hasPayload ? 1 : 0);
+    if (record.hasPayload) {
+        putString(out, record.payload);
+    }
+}
+
+bool decodeRecord(Cursor& in, MtpTraceRecord& record)
+{
+    record.op = static_cast<MtpTraceOp>(in.varint());
+    record.device = static_cast<uint32_t>(in.varint());
+    record.startUs = in.varint();
+    record.durationUs = in.varint();
+    record.result = in.signedVarint();
+    record.value = in.varint();
+
+    record.args.resize(in.count());
+    for (auto& arg : record.args) {
+        arg = in.varint();
+    }
+
+    record.strings.resize(in.count());
+    for (auto& value : record.strings) {
+        value = in.string();
+    }
+
+    record.error = in.string();
+
+    record.entries.resize(in.count());
+    for (auto& entry : record.entries) {
+        entry.id = static_cast<uint32_t>(in.varint());
+        entry.parentId = static_cast<uint32_t>(in.varint());
+        entry.storageId = static_cast<uint32_t>(in.varint());
+        entry.size = in.varint();
+        entry.modificationDate = in.signedVarint();
+        entry.type = static_cast<uint32_t>(in.varint());
+        entry.name = in.string();
+    }
+
+    record.storages.resize(in.count());
+    for (auto& storage : record.storages) {
+        storage.id = static_cast<uint32_t>(in.varint());
+        storage.storageType = static_cast<uint32_t>(in.varint());
+        storage.filesystemType = static_cast<uint32_t>(in.varint());
+        storage.accessCapability = static_cast<uint32_t>(in.varint());
+        storage.maxCapacity = in.varint();
+        storage.freeSpace = in.varint();
+        storage.freeObjects = in.varint();
+        storage.description = in.string();
+        storage.volumeIdentifier = in.string();
+    }
+
+    record.payloadSize = in.varint();
+    record.hasPayload = in.varint() != 0;
+    if (record.hasPayload) {
+        record.payload = in.string();
+    }
+
+    return !in.failed();
+}
+
+} // namespace
+
+MtpTraceWriter::MtpTraceWriter()
+    : m_file(nullptr)
+{
+}
+
+MtpTraceWriter::~MtpTraceWriter()
+{
+    close();
+}
+
+bool MtpTraceWriter::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_file) {
+        fclose(m_file);
+    }
+
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file) {
+        m_lastError = "Failed to create trace file " + path;
+        return false;
+    }
+
+    m_buffer.assign(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    putVarint(m_buffer, TRACE_VERSION);
+    if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        m_lastError = "Failed to write trace file " + path;
+        return false;
+    }
+    return true;
+}
+
+bool MtpTraceWriter::write(const MtpTraceRecord& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_file) {
+        return false;
+    }
+
+    m_buffer.clear();
+    encodeRecord(m_buffer, record);
+    if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        m_lastError = "Failed to write trace record";
+        return false;
+    }
+    return true;
+}
+
+bool MtpTraceWriter::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_file) {
+        return true;
+    }
+
+    bool ok = fclose(m_file) == 0;
+    m_file = nullptr;
+    if (!ok) {
+        m_lastError = "Failed to close trace file";
+    }
+    return ok;
+}
+
+std::string MtpTraceWriter::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+bool MtpTraceReader::read(const std::string& path, std::vector<MtpTraceRecord>& records)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        m_lastError = "Failed to open trace file " + path;
+        return false;
+    }
+
+    std::string data;
+    char buffer[64 * 1024];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.append(buffer, count);
+    }
+    fclose(file);
+
+    if (data.size() < sizeof(TRACE_MAGIC) || memcmp(data.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        m_lastError = "Not a trace file: " + path;
+        return false;
+    }
+
+    Cursor in(data, sizeof(TRACE_MAGIC));
+    if (in.varint() != TRACE_VERSION) {
+        m_lastError = "Unsupported trace version: " + path;
+        return false;
+    }
+
+    records.clear();
+    while (!in.atEnd()) {
+        MtpTraceRecord record;
+        if (!decodeRecord(in, record)) {
+            // Запись могла оборваться при аварийном завершении; предыдущие записи годны
+            m_lastError = "Truncated trace file: " + path;
+            break;
+        }
+        records.push_back(record);
+    }
+
+    return true;
+}
+
+std::string MtpTraceReader::getLastError() const
+{
+    return m_lastError;
+}
+
+std::vector<MtpTraceEntry> makeTraceEntries(const LIBMTP_file_t* files)
+{
+    std::vector<MtpTraceEntry> entries;
+    for (const LIBMTP_file_t* file = files; file; file = file->next) {
+        MtpTraceEntry entry;
+        entry.id = file->item_id;
+        entry.parentId = file->parent_id;
+        entry.storageId = file->storage_id;
+        entry.size = file->filesize;
+        entry.modificationDate = static_cast<int64_t>(file->modificationdate);
+        entry.type = static_cast<uint32_t>(file->filetype);
+        entry.name = file->filename ? file->filename : "";
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+LIBMTP_file_t* makeLibmtpFiles(const std::vector<MtpTraceEntry>& entries)
+{
+    LIBMTP_file_t* head = nullptr;
+    LIBMTP_file_t* tail = nullptr;
+
+    // Память выделяется так же, как в libmtp, чтобы список освобождался LIBMTP_destroy_file_t
+    for (const auto& entry : entries) {
+        LIBMTP_file_t* file = static_cast<LIBMTP_file_t*>(calloc(1, sizeof(LIBMTP_file_t)));
+        if (!file) {
+            break;
+        }
+        file->item_id = entry.id;
+        file->parent_id = entry.parentId;
+        file->storage_id = entry.storageId;
+        file->filesize = entry.size;
+        file->modificationdate = static_cast<time_t>(entry.modificationDate);
+        file->filetype = static_cast<LIBMTP_filetype_t>(entry.type);
+        file->filename = strdup(entry.name.c_str());
+
+        if (tail) {
+            tail->next = file;
+        } else {
+            head = file;
+        }
+        tail = file;
+    }
+
+    return head;
+}
@@ -0,0 +1,576 @@
+#include "MtpTraceRecorder.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Исходные обработчики данных и хода, счетчик переданных байт и время,
+// проведенное в обработчиках вызывающего: в длительность команды оно не входит
+struct HandlerContext {
+    MTPDataPutFunc put = nullptr;
+    MTPDataGetFunc get = nullptr;
+    void* priv = nullptr;
+    LIBMTP_progressfunc_t progress = nullptr;
+    const void* progressData = nullptr;
+    uint64_t bytes = 0;
+    uint64_t callbackUs = 0;
+    std::string* payload = nullptr;
+};
+
+uint64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint16_t recordingPut(void* params, void* priv, uint32_t sendlen, unsigned char* data, uint32_t* putlen)
+{
+    HandlerContext* context = static_cast<HandlerContext*>(priv);
+    uint64_t start = nowUs();
+    uint16_t ret = context->put(params, context->priv, sendlen, data, putlen);
+    context->callbackUs += nowUs() - start;
+    if (ret == LIBMTP_HANDLER_RETURN_OK) {
+        context->bytes += *putlen;
+        if (context->payload) {
+            context->payload->append(reinterpret_cast<const char*>(data), *putlen);
+        }
+    }
+    return ret;
+}
+
+uint16_t recordingGet(void* params, void* priv, uint32_t wantlen, unsigned char* data, uint32_t* gotlen)
+{
+    HandlerContext* context = static_cast<HandlerContext*>(priv);
+    uint64_t start = nowUs();
+    uint16_t ret = context->get(params, context->priv, wantlen, data, gotlen);
+    context->callbackUs += nowUs() - start;
+    if (ret == LIBMTP_HANDLER_RETURN_OK) {
+        context->bytes += *gotlen;
+    }
+    return ret;
+}
+
+int recordingProgress(uint64_t const sent, uint64_t const total, void const* const data)
+{
+    HandlerContext* context = static_cast<HandlerContext*>(const_cast<void*>(data));
+    uint64_t start = nowUs();
+    int ret = context->progress(sent, total, context->progressData);
+    context->callbackUs += nowUs() - start;
+    return ret;
+}
+
+void appendFolders(std::vector<MtpTraceEntry>& entries, const LIBMTP_folder_t* folder)
+{
+    // Дерево сохраняется плоским списком в прямом порядке обхода
+    for (; folder; folder = folder->sibling) {
+        MtpTraceEntry entry;
+        entry.id = folder->folder_id;
+        entry.parentId = folder->parent_id;
+        entry.storageId = folder->storage_id;
+        entry.type = LIBMTP_FILETYPE_FOLDER;
+        entry.name = folder->name ? folder->name : "";
+        entries.push_back(entry);
+
+        appendFolders(entries, folder->child);
+    }
+}
+
+} // namespace
+
+MtpTraceRecorder::MtpTraceRecorder(MtpBackend& next)
+    : m_next(&next)
+    , m_recording(false)
+    , m_nextDevice(0)
+{
+}
+
+MtpTraceRecorder::~MtpTraceRecorder()
+{
+    stop();
+}
+
+bool MtpTraceRecorder::start(const std::string& path, const MtpTraceOptions& options)
+{
+    stop();
+
+    if (!m_writer.open(path)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = m_writer.getLastError();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Устройства, открытые до начала записи, получат запись Open при первой команде
+        m_devices.clear();
+        m_nextDevice = 0;
+    }
+
+    m_options = options;
+    m_startTime = std::chrono::steady_clock::now();
+    m_recording = true;
+    return true;
+}
+
+bool MtpTraceRecorder::stop()
+{
+    if (!m_recording) {
+        return true;
+    }
+
+    m_recording = false;
+    if (!m_writer.close()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = m_writer.getLastError();
+        return false;
+    }
+    return true;
+}
+
+bool MtpTraceRecorder::isRecording() const
+{
+    return m_recording;
+}
+
+std::string MtpTraceRecorder::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+void MtpTraceRecorder::deviceOpened(LIBMTP_mtpdevice_t* device, const LIBMTP_raw_device_t& rawDevice)
+{
+    m_next->deviceOpened(device, rawDevice);
+    if (m_recording) {
+        deviceIndex(device, &rawDevice);
+    }
+}
+
+void MtpTraceRecorder::releaseDevice(LIBMTP_mtpdevice_t* device)
+{
+    m_next->releaseDevice(device);
+
+    // Освобожденный указатель может достаться следующему устройству
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_devices.erase(device);
+}
+
+char* MtpTraceRecorder::getFriendlyname(LIBMTP_mtpdevice_t* device)
+{
+    return recordString(device, MtpTraceOp::GetFriendlyName, &MtpBackend::getFriendlyname);
+}
+
+char* MtpTraceRecorder::getManufacturername(LIBMTP_mtpdevice_t* device)
+{
+    return recordString(device, MtpTraceOp::GetManufacturer, &MtpBackend::getManufacturername);
+}
+
+char* MtpTraceRecorder::getModelname(LIBMTP_mtpdevice_t* device)
+{
+    return recordString(device, MtpTraceOp::GetModelName, &MtpBackend::getModelname);
+}
+
+char* MtpTraceRecorder::getSerialnumber(LIBMTP_mtpdevice_t* device)
+{
+    return recordString(device, MtpTraceOp::GetSerialNumber, &MtpBackend::getSerialnumber);
+}
+
+char* MtpTraceRecorder::getDeviceversion(LIBMTP_mtpdevice_t* device)
+{
+    return recordString(device, MtpTraceOp::GetDeviceVersion, &MtpBackend::getDeviceversion);
+}
+
+int MtpTraceRecorder::getStorage(LIBMTP_mtpdevice_t* device, int sortBy)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetStorage, record)) {
+        return m_next->getStorage(device, sortBy);
+    }
+
+    int ret = m_next->getStorage(device, sortBy);
+    record.result = ret;
+    for (const LIBMTP_devicestorage_t* current = device->storage; ret == 0 && current; current = current->next) {
+        MtpTraceStorage storage;
+        storage.id = current->id;
+        storage.storageType = current->StorageType;
+        storage.filesystemType = current->FilesystemType;
+        storage.accessCapability = current->AccessCapability;
+        storage.maxCapacity = current->MaxCapacity;
+        storage.freeSpace = current->FreeSpaceInBytes;
+        storage.freeObjects = current->FreeSpaceInObjects;
+        storage.description = current->StorageDescription ? current->StorageDescription : "";
+        storage.volumeIdentifier = current->VolumeIdentifier ? current->VolumeIdentifier : "";
+        record.storages.push_back(storage);
+    }
+
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::CheckCapability, record)) {
+        return m_next->checkCapability(device, capability);
+    }
+
+    record.args.push_back(static_cast<uint64_t>(capability));
+    int ret = m_next->checkCapability(device, capability);
+    record.result = ret;
+    finish(device, record, false);
+    return ret;
+}
+
+LIBMTP_error_t* MtpTraceRecorder::getErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    // Тексты ошибок сохраняются вместе с командой, отдельно не записываются
+    return m_next->getErrorstack(device);
+}
+
+void MtpTraceRecorder::clearErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    m_next->clearErrorstack(device);
+}
+
+LIBMTP_file_t* MtpTraceRecorder::getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetFileMetadata, record)) {
+        return m_next->getFilemetadata(device, id);
+    }
+
+    record.args.push_back(id);
+    LIBMTP_file_t* file = m_next->getFilemetadata(device, id);
+    if (file) {
+        // Запрошен один объект, хвост списка не нужен
+        LIBMTP_file_t* next = file->next;
+        file->next = nullptr;
+        record.entries = makeTraceEntries(file);
+        file->next = next;
+    }
+    finish(device, record, !file);
+    return file;
+}
+
+LIBMTP_file_t* MtpTraceRecorder::getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId,
+                                                    uint32_t parentId)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetFilesAndFolders, record)) {
+        return m_next->getFilesAndFolders(device, storageId, parentId);
+    }
+
+    record.args.push_back(storageId);
+    record.args.push_back(parentId);
+    LIBMTP_file_t* files = m_next->getFilesAndFolders(device, storageId, parentId);
+    record.entries = makeTraceEntries(files);
+    // Пустая директория тоже возвращает nullptr; ошибкой считаем только непустой стек ошибок
+    finish(device, record, !files && m_next->getErrorstack(device));
+    return files;
+}
+
+LIBMTP_file_t* MtpTraceRecorder::getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                                const void* data)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetFileListing, record)) {
+        return m_next->getFilelisting(device, progress, data);
+    }
+
+    HandlerContext context;
+    context.progress = progress;
+    context.progressData = data;
+    LIBMTP_file_t* files = m_next->getFilelisting(device, progress ? recordingProgress : nullptr, &context);
+    record.entries = makeTraceEntries(files);
+    finish(device, record, !files && m_next->getErrorstack(device), context.callbackUs);
+    return files;
+}
+
+LIBMTP_folder_t* MtpTraceRecorder::getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetFolderList, record)) {
+        return m_next->getFolderList(device, storageId);
+    }
+
+    record.args.push_back(storageId);
+    LIBMTP_folder_t* folders = m_next->getFolderList(device, storageId);
+    appendFolders(record.entries, folders);
+    finish(device, record, !folders && m_next->getErrorstack(device));
+    return folders;
+}
+
+int MtpTraceRecorder::getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                                       LIBMTP_progressfunc_t progress, const void* data)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetFile, record)) {
+        return m_next->getFileToHandler(device, id, put, priv, progress, data);
+    }
+
+    HandlerContext context;
+    context.put = put;
+    context.priv = priv;
+    context.progress = progress;
+    context.progressData = data;
+    context.payload = m_options.recordPayloads ? &record.payload : nullptr;
+
+    record.args.push_back(id);
+    int ret = m_next->getFileToHandler(device, id, recordingPut, &context,
+                                       progress ? recordingProgress : nullptr, &context);
+    record.result = ret;
+    record.payloadSize = context.bytes;
+    record.hasPayload = m_options.recordPayloads;
+    finish(device, record, ret != 0, context.callbackUs);
+    return ret;
+}
+
+int MtpTraceRecorder::getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset,
+                                       uint32_t maxBytes, unsigned char** data, unsigned int* size)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::GetPartialObject, record)) {
+        return m_next->getPartialObject(device, id, offset, maxBytes, data, size);
+    }
+
+    record.args.push_back(id);
+    record.args.push_back(offset);
+    record.args.push_back(maxBytes);
+    int ret = m_next->getPartialObject(device, id, offset, maxBytes, data, size);
+    record.result = ret;
+    if (ret == 0 && *data) {
+        record.payloadSize = *size;
+        if (m_options.recordPayloads) {
+            record.hasPayload = true;
+            record.payload.assign(reinterpret_cast<const char*>(*data), *size);
+        }
+    }
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                                       LIBMTP_progressfunc_t progress, const void* data)
+{
+    return recordSend(device, metadata, [&](uint64_t& bytes, uint64_t& callbackUs) {
+        HandlerContext context;
+        context.progress = progress;
+        context.progressData = data;
+        int ret = m_next->sendFileFromFile(device, path, metadata, progress ? recordingProgress : nullptr, &context);
+        bytes = ret == 0 ? metadata->filesize : 0;
+        callbackUs = context.callbackUs;
+        return ret;
+    });
+}
+
+int MtpTraceRecorder::sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                                          LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress,
+                                          const void* data)
+{
+    return recordSend(device, metadata, [&](uint64_t& bytes, uint64_t& callbackUs) {
+        HandlerContext context;
+        context.get = get;
+        context.priv = priv;
+        context.progress = progress;
+        context.progressData = data;
+        int ret = m_next->sendFileFromHandler(device, recordingGet, &context, metadata,
+                                              progress ? recordingProgress : nullptr, &context);
+        bytes = context.bytes;
+        callbackUs = context.callbackUs;
+        return ret;
+    });
+}
+
+uint32_t MtpTraceRecorder::createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId,
+                                        uint32_t storageId)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::CreateFolder, record)) {
+        return m_next->createFolder(device, name, parentId, storageId);
+    }
+
+    // libmtp может поменять имя под ограничения устройства; сохраняем запрошенное
+    record.strings.push_back(name ? name : "");
+    record.args.push_back(parentId);
+    record.args.push_back(storageId);
+    uint32_t id = m_next->createFolder(device, name, parentId, storageId);
+    record.result = id;
+    finish(device, record, id == 0);
+    return id;
+}
+
+int MtpTraceRecorder::deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::DeleteObject, record)) {
+        return m_next->deleteObject(device, id);
+    }
+
+    record.args.push_back(id);
+    int ret = m_next->deleteObject(device, id);
+    record.result = ret;
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::SetFileName, record)) {
+        return m_next->setFileName(device, file, name);
+    }
+
+    // Как и в CreateFolder, сохраняем запрошенное имя, а не исправленное libmtp
+    record.strings.push_back(name ? name : "");
+    record.args.push_back(file->item_id);
+    int ret = m_next->setFileName(device, file, name);
+    record.result = ret;
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::MoveObject, record)) {
+        return m_next->moveObject(device, id, storageId, parentId);
+    }
+
+    record.args.push_back(id);
+    record.args.push_back(storageId);
+    record.args.push_back(parentId);
+    int ret = m_next->moveObject(device, id, storageId, parentId);
+    record.result = ret;
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    MtpTraceRecord record;
+    if (!begin(device, MtpTraceOp::CopyObject, record)) {
+        return m_next->copyObject(device, id, storageId, parentId);
+    }
+
+    record.args.push_back(id);
+    record.args.push_back(storageId);
+    record.args.push_back(parentId);
+    int ret = m_next->copyObject(device, id, storageId, parentId);
+    record.result = ret;
+    finish(device, record, ret != 0);
+    return ret;
+}
+
+int MtpTraceRecorder::readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data)
+{
+    // События приходят не в ответ на команды и в трассу не попадают
+    return m_next->readEventAsync(device, callback, data);
+}
+
+bool MtpTraceRecorder::begin(LIBMTP_mtpdevice_t* device, MtpTraceOp op, MtpTraceRecord& record)
+{
+    if (!m_recording) {
+        return false;
+    }
+
+    record.op = op;
+    record.device = deviceIndex(device, nullptr);
+    record.startUs = elapsedUs();
+    return true;
+}
+
+void MtpTraceRecorder::finish(LIBMTP_mtpdevice_t* device, MtpTraceRecord& record, bool failed,
+                              uint64_t callbackUs)
+{
+    record.durationUs = elapsedUs() - record.startUs;
+    record.durationUs -= std::min(callbackUs, record.durationUs);
+
+    if (failed) {
+        // Стек ошибок только читается; очищает его вызывающий, как и без записи
+        LIBMTP_error_t* error = m_next->getErrorstack(device);
+        if (error && error->error_text) {
+            record.error = error->error_text;
+        }
+    }
+
+    if (!m_writer.write(record)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = m_writer.getLastError();
+    }
+}
+
+uint32_t MtpTraceRecorder::deviceIndex(LIBMTP_mtpdevice_t* device, const LIBMTP_raw_device_t* rawDevice)
+{
+    MtpTraceRecord record;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_devices.find(device);
+        if (it != m_devices.end()) {
+            return it->second;
+        }
+
+        record.device = m_nextDevice++;
+        m_devices[device] = record.device;
+    }
+
+    record.op = MtpTraceOp::Open;
+    record.startUs = elapsedUs();
+    if (rawDevice) {
+        const LIBMTP_device_entry_t& entry = rawDevice->device_entry;
+        record.args = {entry.vendor_id, entry.product_id, entry.device_flags,
+                       rawDevice->bus_location, rawDevice->devnum, rawDevice->device_version};
+        record.strings.push_back(entry.vendor ? entry.vendor : "");
+        record.strings.push_back(entry.product ? entry.product : "");
+    }
+
+    if (!m_writer.write(record)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = m_writer.getLastError();
+    }
+    return record.device;
+}
+
+char* MtpTraceRecorder::recordString(LIBMTP_mtpdevice_t* device, MtpTraceOp op,
+                                     char* (MtpBackend::*method)(LIBMTP_mtpdevice_t*))
+{
+    MtpTraceRecord record;
+    if (!begin(device, op, record)) {
+        return (m_next->*method)(device);
+    }
+
+    char* value = (m_next->*method)(device);
+    record.result = value ? 0 : -1;
+    if (value) {
+        record.strings.push_back(value);
+    }
+    finish(device, record, !value);
+    return value;
+}
+
+template <typename Send>
+int MtpTraceRecorder::recordSend(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* metadata, Send send)
+{
+    MtpTraceRecord record;
+    uint64_t bytes = 0;
+    uint64_t callbackUs = 0;
+    if (!begin(device, MtpTraceOp::SendFile, record)) {
+        return send(bytes, callbackUs);
+    }
+
+    record.strings.push_back(metadata->filename ? metadata->filename : "");
+    record.args = {metadata->parent_id, metadata->storage_id, metadata->filesize,
+                   static_cast<uint64_t>(metadata->filetype)};
+    int ret = send(bytes, callbackUs);
+    record.result = ret;
+    record.value = ret == 0 ? metadata->item_id : 0;
+    record.payloadSize = bytes;
+    finish(device, record, ret != 0, callbackUs);
+    return ret;
+}
+
+uint64_t MtpTraceRecorder::elapsedUs() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_startTime).count();
+}
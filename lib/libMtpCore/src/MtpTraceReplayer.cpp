@@ -0,0 +1,854 @@
+#include "MtpTraceReplayer.h"
+#include "MtpDevice.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <thread>
+
+namespace {
+
+// Данные передаются обработчикам libmtp частями такого размера
+const uint64_t REPLAY_CHUNK_SIZE = 1024 * 1024;
+
+// Объекты, созданные при воспроизведении, получают ID из этого диапазона
+const uint32_t FIRST_REPLAY_OBJECT_ID = 0x7F000000;
+
+std::string makeKey(MtpTraceOp op, const std::vector<uint64_t>& args, const std::string& name)
+{
+    std::string key(1, static_cast<char>(op));
+    for (uint64_t arg : args) {
+        key += ':';
+        key += std::to_string(arg);
+    }
+    key += '/';
+    key += name;
+    return key;
+}
+
+char* duplicate(const std::string& value)
+{
+    return strdup(value.c_str());
+}
+
+void freeStorages(LIBMTP_devicestorage_t* storage)
+{
+    while (storage) {
+        LIBMTP_devicestorage_t* next = storage->next;
+        free(storage->StorageDescription);
+        free(storage->VolumeIdentifier);
+        free(storage);
+        storage = next;
+    }
+}
+
+LIBMTP_folder_t* makeFolders(const std::vector<MtpTraceEntry>& entries,
+                             const std::multimap<uint32_t, size_t>& children, uint32_t parentId)
+{
+    LIBMTP_folder_t* head = nullptr;
+    LIBMTP_folder_t* tail = nullptr;
+
+    auto range = children.equal_range(parentId);
+    for (auto it = range.first; it != range.second; ++it) {
+        const MtpTraceEntry& entry = entries[it->second];
+        LIBMTP_folder_t* folder = static_cast<LIBMTP_folder_t*>(calloc(1, sizeof(LIBMTP_folder_t)));
+        if (!folder) {
+            break;
+        }
+        folder->folder_id = entry.id;
+        folder->parent_id = entry.parentId;
+        folder->storage_id = entry.storageId;
+        folder->name = duplicate(entry.name);
+        folder->child = makeFolders(entries, children, entry.id);
+
+        if (tail) {
+            tail->sibling = folder;
+        } else {
+            head = folder;
+        }
+        tail = folder;
+    }
+
+    return head;
+}
+
+} // namespace
+
+MtpTraceReplayer::MtpTraceReplayer(MtpBackend& next)
+    : m_next(&next)
+    , m_rawDevice()
+    , m_readBytes(0)
+    , m_readUs(0)
+    , m_commandUs(0)
+    , m_nextObjectId(FIRST_REPLAY_OBJECT_ID)
+    , m_speed(1.0)
+    , m_missCount(0)
+{
+}
+
+MtpTraceReplayer::~MtpTraceReplayer()
+{
+}
+
+bool MtpTraceReplayer::load(const std::string& path, uint32_t device)
+{
+    std::vector<MtpTraceRecord> records;
+    MtpTraceReader reader;
+    if (!reader.read(path, records)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = reader.getLastError();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_records.clear();
+    m_responses.clear();
+    m_objects.clear();
+    m_rawDevice = LIBMTP_raw_device_t();
+    m_readBytes = 0;
+    m_readUs = 0;
+
+    uint64_t commandUs = 0;
+    uint64_t commandCount = 0;
+
+    for (auto& record : records) {
+        if (record.device != device) {
+            continue;
+        }
+
+        if (record.op == MtpTraceOp::Open) {
+            if (record.args.size() >= 6) {
+                m_rawDevice.device_entry.vendor_id = static_cast<uint16_t>(record.args[0]);
+                m_rawDevice.device_entry.product_id = static_cast<uint16_t>(record.args[1]);
+                m_rawDevice.device_entry.device_flags = static_cast<uint32_t>(record.args[2]);
+                m_rawDevice.bus_location = static_cast<uint32_t>(record.args[3]);
+                m_rawDevice.devnum = static_cast<uint8_t>(record.args[4]);
+                m_rawDevice.device_version = static_cast<uint16_t>(record.args[5]);
+            }
+            if (record.strings.size() >= 2) {
+                m_vendor = record.strings[0];
+                m_product = record.strings[1];
+            }
+            continue;
+        }
+
+        size_t index = m_records.size();
+        std::string name = record.strings.empty() ? std::string() : record.strings[0];
+        if (record.op >= MtpTraceOp::GetFriendlyName && record.op <= MtpTraceOp::GetDeviceVersion) {
+            // У этих команд строка - ответ, а не аргумент
+            name.clear();
+        }
+        m_responses[makeKey(record.op, record.args, name)].records.push_back(index);
+
+        for (const auto& entry : record.entries) {
+            m_objects[entry.id] = entry;
+        }
+
+        if ((record.op == MtpTraceOp::GetFile || record.op == MtpTraceOp::GetPartialObject) &&
+            record.result == 0) {
+            m_readBytes += record.payloadSize;
+            m_readUs += record.durationUs;
+        }
+        if (record.op == MtpTraceOp::GetFileMetadata || record.op == MtpTraceOp::CheckCapability) {
+            commandUs += record.durationUs;
+            ++commandCount;
+        }
+
+        m_records.push_back(std::move(record));
+    }
+
+    m_commandUs = commandCount ? commandUs / commandCount : 0;
+    m_rawDevice.device_entry.vendor = m_vendor.empty() ? nullptr : &m_vendor[0];
+    m_rawDevice.device_entry.product = m_product.empty() ? nullptr : &m_product[0];
+
+    if (m_records.empty()) {
+        m_lastError = "No records for device " + std::to_string(device) + " in " + path;
+        return false;
+    }
+    return true;
+}
+
+void MtpTraceReplayer::setSpeed(double speed)
+{
+    m_speed = speed;
+}
+
+std::shared_ptr<MtpDevice> MtpTraceReplayer::createDevice()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (&MtpBackend::instance() != this) {
+            m_lastError = "Trace replayer is not installed";
+            return nullptr;
+        }
+        if (m_records.empty()) {
+            m_lastError = "No trace loaded";
+            return nullptr;
+        }
+    }
+
+    // Структура выделяется как в libmtp: список хранилищ заполняет getStorage()
+    LIBMTP_mtpdevice_t* device = static_cast<LIBMTP_mtpdevice_t*>(calloc(1, sizeof(LIBMTP_mtpdevice_t)));
+    if (!device) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastError = "Out of memory";
+        return nullptr;
+    }
+
+    LIBMTP_raw_device_t rawDevice;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_devices[device];
+        rawDevice = m_rawDevice;
+    }
+
+    return std::make_shared<MtpDevice>(device, rawDevice);
+}
+
+uint64_t MtpTraceReplayer::getMissCount() const
+{
+    return m_missCount;
+}
+
+std::string MtpTraceReplayer::getLastError() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lastError;
+}
+
+void MtpTraceReplayer::releaseDevice(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        m_next->releaseDevice(device);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_devices.erase(device);
+    }
+
+    freeStorages(device->storage);
+    free(device);
+}
+
+char* MtpTraceReplayer::getFriendlyname(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFriendlyname(device);
+    }
+    return replayString(device, MtpTraceOp::GetFriendlyName);
+}
+
+char* MtpTraceReplayer::getManufacturername(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getManufacturername(device);
+    }
+    return replayString(device, MtpTraceOp::GetManufacturer);
+}
+
+char* MtpTraceReplayer::getModelname(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getModelname(device);
+    }
+    return replayString(device, MtpTraceOp::GetModelName);
+}
+
+char* MtpTraceReplayer::getSerialnumber(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getSerialnumber(device);
+    }
+    return replayString(device, MtpTraceOp::GetSerialNumber);
+}
+
+char* MtpTraceReplayer::getDeviceversion(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getDeviceversion(device);
+    }
+    return replayString(device, MtpTraceOp::GetDeviceVersion);
+}
+
+int MtpTraceReplayer::getStorage(LIBMTP_mtpdevice_t* device, int sortBy)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getStorage(device, sortBy);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::GetStorage, {});
+    if (!record) {
+        setError(device, NOT_IN_TRACE_ERROR);
+        return -1;
+    }
+
+    wait(record->durationUs);
+    if (record->result != 0) {
+        setError(device, record->error);
+        return static_cast<int>(record->result);
+    }
+
+    freeStorages(device->storage);
+    device->storage = nullptr;
+
+    LIBMTP_devicestorage_t* tail = nullptr;
+    for (const auto& storage : record->storages) {
+        LIBMTP_devicestorage_t* current =
+            static_cast<LIBMTP_devicestorage_t*>(calloc(1, sizeof(LIBMTP_devicestorage_t)));
+        if (!current) {
+            break;
+        }
+        current->id = storage.id;
+        current->StorageType = static_cast<uint16_t>(storage.storageType);
+        current->FilesystemType = static_cast<uint16_t>(storage.filesystemType);
+        current->AccessCapability = static_cast<uint16_t>(storage.accessCapability);
+        current->MaxCapacity = storage.maxCapacity;
+        current->FreeSpaceInBytes = storage.freeSpace;
+        current->FreeSpaceInObjects = storage.freeObjects;
+        current->StorageDescription = duplicate(storage.description);
+        current->VolumeIdentifier = duplicate(storage.volumeIdentifier);
+        current->prev = tail;
+
+        if (tail) {
+            tail->next = current;
+        } else {
+            device->storage = current;
+        }
+        tail = current;
+    }
+
+    return 0;
+}
+
+int MtpTraceReplayer::checkCapability(LIBMTP_mtpdevice_t* device, LIBMTP_devicecap_t capability)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->checkCapability(device, capability);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::CheckCapability, {static_cast<uint64_t>(capability)});
+    if (!record) {
+        return 0;
+    }
+
+    wait(record->durationUs);
+    return static_cast<int>(record->result);
+}
+
+LIBMTP_error_t* MtpTraceReplayer::getErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getErrorstack(device);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    DeviceState& state = m_devices[device];
+    return state.hasError ? &state.error : nullptr;
+}
+
+void MtpTraceReplayer::clearErrorstack(LIBMTP_mtpdevice_t* device)
+{
+    if (!isReplayDevice(device)) {
+        m_next->clearErrorstack(device);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_devices[device].hasError = false;
+}
+
+LIBMTP_file_t* MtpTraceReplayer::getFilemetadata(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFilemetadata(device, id);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::GetFileMetadata, {id});
+    if (record) {
+        return replayFiles(device, record);
+    }
+
+    // Метаданные объекта из любого записанного списка
+    MtpTraceEntry entry;
+    if (!findObject(id, entry)) {
+        return replayFiles(device, nullptr);
+    }
+
+    wait(m_commandUs);
+    return makeLibmtpFiles({entry});
+}
+
+LIBMTP_file_t* MtpTraceReplayer::getFilesAndFolders(LIBMTP_mtpdevice_t* device, uint32_t storageId,
+                                                    uint32_t parentId)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFilesAndFolders(device, storageId, parentId);
+    }
+    return replayFiles(device, find(MtpTraceOp::GetFilesAndFolders, {storageId, parentId}));
+}
+
+LIBMTP_file_t* MtpTraceReplayer::getFilelisting(LIBMTP_mtpdevice_t* device, LIBMTP_progressfunc_t progress,
+                                                const void* data)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFilelisting(device, progress, data);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::GetFileListing, {});
+    LIBMTP_file_t* files = replayFiles(device, record);
+    if (record && progress) {
+        progress(record->entries.size(), record->entries.size(), data);
+    }
+    return files;
+}
+
+LIBMTP_folder_t* MtpTraceReplayer::getFolderList(LIBMTP_mtpdevice_t* device, uint32_t storageId)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFolderList(device, storageId);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::GetFolderList, {storageId});
+    if (!record) {
+        setError(device, NOT_IN_TRACE_ERROR);
+        return nullptr;
+    }
+
+    wait(record->durationUs);
+    if (!record->error.empty()) {
+        setError(device, record->error);
+    }
+
+    // Дерево восстанавливается по ID родителей; корни - директории, чьих родителей нет в списке
+    std::set<uint32_t> ids;
+    for (const auto& entry : record->entries) {
+        ids.insert(entry.id);
+    }
+
+    const uint32_t ROOT = 0xFFFFFFFF;
+    std::multimap<uint32_t, size_t> children;
+    for (size_t i = 0; i < record->entries.size(); ++i) {
+        uint32_t parentId = record->entries[i].parentId;
+        children.emplace(ids.count(parentId) ? parentId : ROOT, i);
+    }
+
+    return makeFolders(record->entries, children, ROOT);
+}
+
+int MtpTraceReplayer::getFileToHandler(LIBMTP_mtpdevice_t* device, uint32_t id, MTPDataPutFunc put, void* priv,
+                                       LIBMTP_progressfunc_t progress, const void* data)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getFileToHandler(device, id, put, priv, progress, data);
+    }
+
+    uint64_t size = 0;
+    uint64_t durationUs = 0;
+    const std::string* payload = nullptr;
+    const MtpTraceRecord* record = find(MtpTraceOp::GetFile, {id});
+    if (record) {
+        size = record->payloadSize;
+        durationUs = record->durationUs;
+        payload = record->hasPayload ? &record->payload : nullptr;
+    } else {
+        MtpTraceEntry entry;
+        if (!findObject(id, entry)) {
+            setError(device, NOT_IN_TRACE_ERROR);
+            return -1;
+        }
+        size = entry.size;
+        durationUs = estimateTransferUs(size);
+    }
+
+    if (size == 0) {
+        wait(durationUs);
+    }
+
+    // Данные отдаются частями с той же скоростью, с какой их отдавало устройство
+    std::vector<unsigned char> buffer(static_cast<size_t>(std::min(size, REPLAY_CHUNK_SIZE)));
+    for (uint64_t done = 0; done < size;) {
+        uint32_t length = static_cast<uint32_t>(std::min(size - done, REPLAY_CHUNK_SIZE));
+        if (payload && done + length <= payload->size()) {
+            memcpy(buffer.data(), payload->data() + done, length);
+        }
+        wait(durationUs * length / size);
+
+        uint32_t putLength = 0;
+        if (put(nullptr, priv, length, buffer.data(), &putLength) != LIBMTP_HANDLER_RETURN_OK) {
+            setError(device, "Transfer cancelled");
+            return -1;
+        }
+        done += length;
+
+        if (progress && progress(done, size, data) != 0) {
+            setError(device, "Transfer cancelled");
+            return -1;
+        }
+    }
+
+    if (record && record->result != 0) {
+        setError(device, record->error);
+        return static_cast<int>(record->result);
+    }
+    return 0;
+}
+
+int MtpTraceReplayer::getPartialObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint64_t offset,
+                                       uint32_t maxBytes, unsigned char** data, unsigned int* size)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->getPartialObject(device, id, offset, maxBytes, data, size);
+    }
+
+    *data = nullptr;
+    *size = 0;
+
+    uint64_t length = 0;
+    const std::string* payload = nullptr;
+    const MtpTraceRecord* record = find(MtpTraceOp::GetPartialObject, {id, offset, maxBytes});
+    if (record) {
+        wait(record->durationUs);
+        if (record->result != 0) {
+            setError(device, record->error);
+            return static_cast<int>(record->result);
+        }
+        length = record->payloadSize;
+        payload = record->hasPayload ? &record->payload : nullptr;
+    } else {
+        // Части другого размера: команда стоит как короткая команда плюс передача данных
+        MtpTraceEntry entry;
+        if (!findObject(id, entry) || offset >= entry.size) {
+            setError(device, NOT_IN_TRACE_ERROR);
+            return -1;
+        }
+        length = std::min<uint64_t>(maxBytes, entry.size - offset);
+        wait(m_commandUs + estimateTransferUs(length));
+    }
+
+    // Память выделяется как в libmtp: вызывающий освобождает ее через free()
+    unsigned char* buffer = static_cast<unsigned char*>(calloc(1, std::max<size_t>(length, 1)));
+    if (!buffer) {
+        setError(device, "Out of memory");
+        return -1;
+    }
+    if (payload) {
+        memcpy(buffer, payload->data(), std::min<size_t>(length, payload->size()));
+    }
+
+    *data = buffer;
+    *size = static_cast<unsigned int>(length);
+    return 0;
+}
+
+int MtpTraceReplayer::sendFileFromFile(LIBMTP_mtpdevice_t* device, const char* path, LIBMTP_file_t* metadata,
+                                       LIBMTP_progressfunc_t progress, const void* data)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->sendFileFromFile(device, path, metadata, progress, data);
+    }
+    return replaySend(device, metadata, nullptr, nullptr);
+}
+
+int MtpTraceReplayer::sendFileFromHandler(LIBMTP_mtpdevice_t* device, MTPDataGetFunc get, void* priv,
+                                          LIBMTP_file_t* metadata, LIBMTP_progressfunc_t progress,
+                                          const void* data)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->sendFileFromHandler(device, get, priv, metadata, progress, data);
+    }
+    return replaySend(device, metadata, get, priv);
+}
+
+uint32_t MtpTraceReplayer::createFolder(LIBMTP_mtpdevice_t* device, char* name, uint32_t parentId,
+                                        uint32_t storageId)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->createFolder(device, name, parentId, storageId);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::CreateFolder, {parentId, storageId}, name ? name : "");
+    if (record) {
+        wait(record->durationUs);
+        if (record->result == 0) {
+            setError(device, record->error);
+            return 0;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t id = record ? static_cast<uint32_t>(record->result) : m_nextObjectId++;
+
+    MtpTraceEntry entry;
+    entry.id = id;
+    entry.parentId = parentId;
+    entry.storageId = storageId;
+    entry.type = LIBMTP_FILETYPE_FOLDER;
+    entry.name = name ? name : "";
+    m_objects[id] = entry;
+    return id;
+}
+
+int MtpTraceReplayer::deleteObject(LIBMTP_mtpdevice_t* device, uint32_t id)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->deleteObject(device, id);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::DeleteObject, {id});
+    if (record) {
+        wait(record->durationUs);
+        if (record->result != 0) {
+            setError(device, record->error);
+            return static_cast<int>(record->result);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_objects.erase(id);
+    return 0;
+}
+
+int MtpTraceReplayer::setFileName(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* file, const char* name)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->setFileName(device, file, name);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::SetFileName, {file->item_id}, name ? name : "");
+    if (record) {
+        wait(record->durationUs);
+        if (record->result != 0) {
+            setError(device, record->error);
+            return static_cast<int>(record->result);
+        }
+    }
+
+    // Как и libmtp, при успехе обновляем имя в переданной структуре
+    free(file->filename);
+    file->filename = strdup(name ? name : "");
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_objects.find(file->item_id);
+    if (it != m_objects.end()) {
+        it->second.name = file->filename;
+    }
+    return 0;
+}
+
+int MtpTraceReplayer::moveObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->moveObject(device, id, storageId, parentId);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::MoveObject, {id, storageId, parentId});
+    if (record) {
+        wait(record->durationUs);
+        if (record->result != 0) {
+            setError(device, record->error);
+            return static_cast<int>(record->result);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_objects.find(id);
+    if (it != m_objects.end()) {
+        it->second.storageId = storageId;
+        it->second.parentId = parentId;
+    }
+    return 0;
+}
+
+int MtpTraceReplayer::copyObject(LIBMTP_mtpdevice_t* device, uint32_t id, uint32_t storageId, uint32_t parentId)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->copyObject(device, id, storageId, parentId);
+    }
+
+    const MtpTraceRecord* record = find(MtpTraceOp::CopyObject, {id, storageId, parentId});
+    if (record) {
+        wait(record->durationUs);
+        if (record->result != 0) {
+            setError(device, record->error);
+            return static_cast<int>(record->result);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_objects.find(id);
+    if (it != m_objects.end()) {
+        MtpTraceEntry entry = it->second;
+        entry.id = m_nextObjectId++;
+        entry.storageId = storageId;
+        entry.parentId = parentId;
+        m_objects[entry.id] = entry;
+    }
+    return 0;
+}
+
+int MtpTraceReplayer::readEventAsync(LIBMTP_mtpdevice_t* device, LIBMTP_event_cb_fn callback, void* data)
+{
+    if (!isReplayDevice(device)) {
+        return m_next->readEventAsync(device, callback, data);
+    }
+
+    // События в трассу не записываются: запрос принимается, но виртуальное
+    // устройство событий не присылает
+    return 0;
+}
+
+bool MtpTraceReplayer::isReplayDevice(LIBMTP_mtpdevice_t* device) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_devices.find(device) != m_devices.end();
+}
+
+const MtpTraceRecord* MtpTraceReplayer::find(MtpTraceOp op, const std::vector<uint64_t>& args,
+                                             const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_responses.find(makeKey(op, args, name));
+    if (it == m_responses.end()) {
+        return nullptr;
+    }
+
+    Responses& responses = it->second;
+    size_t index = std::min(responses.next, responses.records.size() - 1);
+    if (responses.next < responses.records.size()) {
+        ++responses.next;
+    }
+    return &m_records[responses.records[index]];
+}
+
+void MtpTraceReplayer::setError(LIBMTP_mtpdevice_t* device, const std::string& error)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (error == NOT_IN_TRACE_ERROR) {
+        m_missCount++;
+    }
+
+    DeviceState& state = m_devices[device];
+    state.errorText = error.empty() ? "Device error" : error;
+    state.error.errornumber = LIBMTP_ERROR_GENERAL;
+    state.error.error_text = &state.errorText[0];
+    state.hasError = true;
+}
+
+void MtpTraceReplayer::wait(uint64_t durationUs) const
+{
+    double speed = m_speed;
+    if (speed <= 0 || durationUs == 0) {
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(durationUs / speed)));
+}
+
+uint64_t MtpTraceReplayer::estimateTransferUs(uint64_t bytes) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_readBytes == 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(static_cast<double>(bytes) * m_readUs / m_readBytes);
+}
+
+bool MtpTraceReplayer::findObject(uint32_t id, MtpTraceEntry& entry) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_objects.find(id);
+    if (it == m_objects.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+char* MtpTraceReplayer::replayString(LIBMTP_mtpdevice_t* device, MtpTraceOp op)
+{
+    const MtpTraceRecord* record = find(op, {});
+    if (!record) {
+        setError(device, NOT_IN_TRACE_ERROR);
+        return nullptr;
+    }
+
+    wait(record->durationUs);
+    if (record->strings.empty()) {
+        setError(device, record->error);
+        return nullptr;
+    }
+    return duplicate(record->strings[0]);
+}
+
+LIBMTP_file_t* MtpTraceReplayer::replayFiles(LIBMTP_mtpdevice_t* device, const MtpTraceRecord* record)
+{
+    if (!record) {
+        setError(device, NOT_IN_TRACE_ERROR);
+        return nullptr;
+    }
+
+    wait(record->durationUs);
+    if (!record->error.empty()) {
+        setError(device, record->error);
+    }
+    return makeLibmtpFiles(record->entries);
+}
+
+int MtpTraceReplayer::replaySend(LIBMTP_mtpdevice_t* device, LIBMTP_file_t* metadata, MTPDataGetFunc get,
+                                 void* priv)
+{
+    std::string name = metadata->filename ? metadata->filename : "";
+    uint64_t size = metadata->filesize;
+    const MtpTraceRecord* record = find(MtpTraceOp::SendFile,
+                                        {metadata->parent_id, metadata->storage_id, size,
+                                         static_cast<uint64_t>(metadata->filetype)}, name);
+    uint64_t durationUs = record ? record->durationUs : estimateTransferUs(size);
+
+    if (get) {
+        // Источник вычитывается целиком, как при настоящей отправке
+        std::vector<unsigned char> buffer(static_cast<size_t>(std::min(size, REPLAY_CHUNK_SIZE)));
+        for (uint64_t done = 0; done < size;) {
+            uint32_t wanted = static_cast<uint32_t>(std::min(size - done, REPLAY_CHUNK_SIZE));
+            uint32_t length = 0;
+            if (get(nullptr, priv, wanted, buffer.data(), &length) != LIBMTP_HANDLER_RETURN_OK) {
+                setError(device, "Transfer cancelled");
+                return -1;
+            }
+            if (length == 0) {
+                break;
+            }
+            wait(durationUs * length / size);
+            done += length;
+        }
+    } else {
+        wait(durationUs);
+    }
+
+    if (record && record->result != 0) {
+        setError(device, record->error);
+        return static_cast<int>(record->result);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    metadata->item_id = record ? static_cast<uint32_t>(record->value) : m_nextObjectId++;
+
+    MtpTraceEntry entry;
+    entry.id = metadata->item_id;
+    entry.parentId = metadata->parent_id;
+    entry.storageId = metadata->storage_id;
+    entry.size = size;
+    entry.modificationDate = static_cast<int64_t>(metadata->modificationdate);
+    entry.type = static_cast<uint32_t>(metadata->filetype);
+    entry.name = name;
+    m_objects[entry.id] = entry;
+    return 0;
+}
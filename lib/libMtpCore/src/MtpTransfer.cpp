@@ -0,0 +1,232 @@
+#include "MtpTransfer.h"
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// Интервал замера текущей скорости
+const int64_t SAMPLE_INTERVAL_NS = 250 * 1000 * 1000;
+
+// Вес нового замера в сглаженной скорости
+const double SMOOTHING = 0.3;
+
+const double NS_PER_SECOND = 1e9;
+
+} // namespace
+
+MtpTransfer::MtpTransfer()
+    : m_state(static_cast<int>(MtpTransferState::Pending))
+    , m_bytesDone(0)
+    , m_totalBytes(0)
+    , m_initialBytes(0)
+    , m_cancelRequested(false)
+    , m_startTime(0)
+    , m_finishTime(0)
+    , m_instantThroughput(0.0)
+    , m_rateLimit(0)
+    , m_lastSampleTime(0)
+    , m_lastSampleBytes(0)
+    , m_lastCallbackTime(0)
+    , m_callbackInterval(200LL * 1000 * 1000)
+{
+}
+
+void MtpTransfer::setProgressCallback(ProgressCallback callback, uint32_t intervalMs)
+{
+    m_callback = callback;
+    m_callbackInterval = static_cast<int64_t>(intervalMs) * 1000 * 1000;
+}
+
+void MtpTransfer::setRateLimit(uint64_t bytesPerSecond)
+{
+    m_rateLimit.store(bytesPerSecond, std::memory_order_relaxed);
+}
+
+void MtpTransfer::cancel()
+{
+    m_cancelRequested.store(true, std::memory_order_relaxed);
+}
+
+bool MtpTransfer::isCancelRequested() const
+{
+    return m_cancelRequested.load(std::memory_order_relaxed);
+}
+
+MtpTransferState MtpTransfer::getState() const
+{
+    return static_cast<MtpTransferState>(m_state.load());
+}
+
+uint64_t MtpTransfer::getBytesDone() const
+{
+    return m_bytesDone.load(std::memory_order_relaxed);
+}
+
+uint64_t MtpTransfer::getTotalBytes() const
+{
+    return m_totalBytes.load(std::memory_order_relaxed);
+}
+
+double MtpTransfer::getAverageThroughput() const
+{
+    int64_t start = m_startTime.load(std::memory_order_relaxed);
+    if (start == 0) {
+        return 0.0;
+    }
+
+    int64_t finish = m_finishTime.load(std::memory_order_relaxed);
+    int64_t elapsed = (finish ? finish : now()) - start;
+    if (elapsed <= 0) {
+        return 0.0;
+    }
+
+    uint64_t done = getBytesDone();
+    uint64_t initial = m_initialBytes.load(std::memory_order_relaxed);
+    return (done > initial ? done - initial : 0) * NS_PER_SECOND / elapsed;
+}
+
+double MtpTransfer::getInstantThroughput() const
+{
+    double throughput = m_instantThroughput.load(std::memory_order_relaxed);
+
+    // До первого замера используем среднюю скорость
+    return throughput > 0.0 ? throughput : getAverageThroughput();
+}
+
+double MtpTransfer::getEstimatedSecondsLeft() const
+{
+    uint64_t total = getTotalBytes();
+    uint64_t done = getBytesDone();
+    double throughput = getInstantThroughput();
+
+    if (total == 0 || throughput <= 0.0) {
+        return -1.0;
+    }
+    if (done >= total) {
+        return 0.0;
+    }
+
+    return (total - done) / throughput;
+}
+
+void MtpTransfer::wait() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished.wait(lock, [this]() {
+        MtpTransferState state = getState();
+        return state != MtpTransferState::Pending && state != MtpTransferState::Running;
+    });
+}
+
+void MtpTransfer::begin(uint64_t totalBytes, uint64_t initialBytes)
+{
+    int64_t start = now();
+
+    m_totalBytes.store(totalBytes, std::memory_order_relaxed);
+    m_initialBytes.store(initialBytes, std::memory_order_relaxed);
+    m_bytesDone.store(initialBytes, std::memory_order_relaxed);
+    m_instantThroughput.store(0.0, std::memory_order_relaxed);
+    m_finishTime.store(0, std::memory_order_relaxed);
+    m_startTime.store(start, std::memory_order_relaxed);
+    m_lastSampleTime = start;
+    m_lastSampleBytes = initialBytes;
+    m_lastCallbackTime = start;
+    m_state.store(static_cast<int>(MtpTransferState::Running));
+}
+
+bool MtpTransfer::update(uint64_t bytesDone)
+{
+    if (!report(bytesDone)) {
+        return false;
+    }
+
+    poll();
+    pace(bytesDone);
+
+    return !isCancelRequested();
+}
+
+bool MtpTransfer::report(uint64_t bytesDone)
+{
+    m_bytesDone.store(bytesDone, std::memory_order_relaxed);
+    return !isCancelRequested();
+}
+
+void MtpTransfer::poll()
+{
+    int64_t current = now();
+    uint64_t bytesDone = getBytesDone();
+
+    // Сглаженная текущая скорость пересчитывается не чаще SAMPLE_INTERVAL_NS
+    int64_t sampleElapsed = current - m_lastSampleTime;
+    if (sampleElapsed >= SAMPLE_INTERVAL_NS) {
+        // Файл, начатый заново, может вернуть счетчик назад
+        uint64_t delta = bytesDone > m_lastSampleBytes ? bytesDone - m_lastSampleBytes : 0;
+        double sample = delta * NS_PER_SECOND / sampleElapsed;
+        double previous = m_instantThroughput.load(std::memory_order_relaxed);
+        double smoothed = previous > 0.0 ? previous + SMOOTHING * (sample - previous) : sample;
+        m_instantThroughput.store(smoothed, std::memory_order_relaxed);
+        m_lastSampleTime = current;
+        m_lastSampleBytes = bytesDone;
+    }
+
+    if (m_callback && current - m_lastCallbackTime >= m_callbackInterval) {
+        m_lastCallbackTime = current;
+        m_callback(*this);
+    }
+}
+
+void MtpTransfer::pace(uint64_t bytesDone)
+{
+    // Ограничение скорости: если опережаем допустимый темп, ждем
+    uint64_t limit = m_rateLimit.load(std::memory_order_relaxed);
+    if (!limit) {
+        return;
+    }
+
+    // Байты, полученные до продолжения передачи, темп не задают
+    uint64_t initial = m_initialBytes.load(std::memory_order_relaxed);
+    if (bytesDone <= initial) {
+        return;
+    }
+
+    int64_t current = now();
+    int64_t allowedAt = m_startTime.load(std::memory_order_relaxed) +
+                        static_cast<int64_t>((bytesDone - initial) * NS_PER_SECOND / limit);
+    if (allowedAt > current) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(allowedAt - current));
+    }
+}
+
+void MtpTransfer::finish(MtpTransferState state)
+{
+    m_finishTime.store(now(), std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.store(static_cast<int>(state));
+    }
+    m_finished.notify_all();
+
+    if (m_callback) {
+        m_callback(*this);
+    }
+}
+
+int MtpTransfer::libmtpProgress(uint64_t const sent, uint64_t const total, void const* const data)
+{
+    // libmtp передает указатель как const, но счетчики - изменяемое состояние дескриптора
+    MtpTransfer* transfer = const_cast<MtpTransfer*>(static_cast<const MtpTransfer*>(data));
+
+    if (total && transfer->getTotalBytes() != total) {
+        transfer->m_totalBytes.store(total, std::memory_order_relaxed);
+    }
+
+    return transfer->report(sent) ? 0 : 1;
+}
+
+int64_t MtpTransfer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,226 @@
+#include "MtpTransferJournal.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+const char* const JOURNAL_HEADER = "MTPJOURNAL 1";
+
+// Экранирует разделители, чтобы каждое поле оставалось в своей колонке
+std::string escape(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+            case '\\': result += "\\\\"; break;
+            case '\t': result += "\\t"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            default: result += c; break;
+        }
+    }
+    return result;
+}
+
+std::string unescape(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] != '\\' || i + 1 == value.size()) {
+            result += value[i];
+            continue;
+        }
+        switch (value[++i]) {
+            case 't': result += '\t'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            default: result += value[i]; break;
+        }
+    }
+    return result;
+}
+
+std::vector<std::string> splitFields(const std::string& line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(unescape(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start)));
+        if (tab == std::string::npos) {
+            break;
+        }
+        start = tab + 1;
+    }
+    return fields;
+}
+
+const char* stateName(MtpJournalItemState state)
+{
+    switch (state) {
+        case MtpJournalItemState::Completed: return "done";
+        case MtpJournalItemState::Failed: return "failed";
+        case MtpJournalItemState::Pending: break;
+    }
+    return "pending";
+}
+
+bool parseState(const std::string& name, MtpJournalItemState& state)
+{
+    if (name == "pending") {
+        state = MtpJournalItemState::Pending;
+    } else if (name == "done") {
+        state = MtpJournalItemState::Completed;
+    } else if (name == "failed") {
+        state = MtpJournalItemState::Failed;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+MtpTransferJournal::MtpTransferJournal(const std::string& path)
+    : m_path(path)
+{
+}
+
+bool MtpTransferJournal::load()
+{
+    FILE* file = fopen(m_path.c_str(), "r");
+    if (!file) {
+        m_lastError = "Cannot open journal: " + m_path;
+        return false;
+    }
+
+    std::string serialNumber;
+    std::vector<MtpJournalItem> items;
+    bool ok = true;
+    bool headerSeen = false;
+
+    char* buffer = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&buffer, &capacity, file)) >= 0) {
+        std::string line(buffer, static_cast<size_t>(length));
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+        }
+
+        if (!headerSeen) {
+            headerSeen = true;
+            if (line != JOURNAL_HEADER) {
+                ok = false;
+                break;
+            }
+            continue;
+        }
+
+        std::vector<std::string> fields = splitFields(line);
+        if (fields[0] == "device" && fields.size() == 2) {
+            serialNumber = fields[1];
+        } else if (fields[0] == "item" && fields.size() == 10) {
+            MtpJournalItem item;
+            if (!parseState(fields[1], item.state)) {
+                ok = false;
+                break;
+            }
+            item.storageId = static_cast<uint32_t>(strtoul(fields[2].c_str(), nullptr, 10));
+            item.objectId = static_cast<uint32_t>(strtoul(fields[3].c_str(), nullptr, 10));
+            item.size = strtoull(fields[4].c_str(), nullptr, 10);
+            item.offset = strtoull(fields[5].c_str(), nullptr, 10);
+            item.folderPath = fields[6];
+            item.name = fields[7];
+            item.localPath = fields[8];
+            item.error = fields[9];
+            items.push_back(item);
+        } else {
+            ok = false;
+            break;
+        }
+    }
+
+    free(buffer);
+    fclose(file);
+
+    if (!ok || !headerSeen) {
+        m_lastError = "Journal is damaged: " + m_path;
+        return false;
+    }
+
+    m_serialNumber = serialNumber;
+    m_items = items;
+    return true;
+}
+
+bool MtpTransferJournal::save()
+{
+    std::string tempPath = m_path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "w");
+    if (!file) {
+        m_lastError = "Cannot create journal: " + tempPath + ": " + strerror(errno);
+        return false;
+    }
+
+    fprintf(file, "%s\n", JOURNAL_HEADER);
+    fprintf(file, "device\t%s\n", escape(m_serialNumber).c_str());
+    for (const auto& item : m_items) {
+        fprintf(file, "item\t%s\t%u\t%u\t%llu\t%llu\t%s\t%s\t%s\t%s\n",
+                stateName(item.state), item.storageId, item.objectId,
+                static_cast<unsigned long long>(item.size), static_cast<unsigned long long>(item.offset),
+                escape(item.folderPath).c_str(), escape(item.name).c_str(),
+                escape(item.localPath).c_str(), escape(item.error).c_str());
+    }
+
+    // Журнал описывает данные, уже сброшенные на диск, поэтому и сам сбрасывается до переименования
+    bool ok = fflush(file) == 0 && fdatasync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), m_path.c_str()) != 0) {
+        m_lastError = "Cannot write journal: " + m_path + ": " + strerror(errno);
+        unlink(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void MtpTransferJournal::remove()
+{
+    unlink(m_path.c_str());
+}
+
+const std::string& MtpTransferJournal::getPath() const
+{
+    return m_path;
+}
+
+const std::string& MtpTransferJournal::getSerialNumber() const
+{
+    return m_serialNumber;
+}
+
+void MtpTransferJournal::setSerialNumber(const std::string& serialNumber)
+{
+    m_serialNumber = serialNumber;
+}
+
+std::vector<MtpJournalItem>& MtpTransferJournal::getItems()
+{
+    return m_items;
+}
+
+const std::vector<MtpJournalItem>& MtpTransferJournal::getItems() const
+{
+    return m_items;
+}
+
+std::string MtpTransferJournal::getLastError() const
+{
+    return m_lastError;
+}
@@ -0,0 +1,186 @@
+#include "MtpTypes.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+// Нижний регистр для кодовой точки; таблица покрывает латиницу и кириллицу
+uint32_t lowerCodePoint(uint32_t c)
+{
+    if (c < 0x80) {
+        return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+    }
+    // Latin-1: À..Þ, кроме знака умножения
+    if (c >= 0xC0 && c <= 0xDE && c != 0xD7) {
+        return c + 32;
+    }
+    // Latin Extended-A: пары "заглавная, строчная"
+    if ((c >= 0x100 && c <= 0x12F) || (c >= 0x132 && c <= 0x137) || (c >= 0x14A && c <= 0x177)) {
+        return (c % 2 == 0) ? c + 1 : c;
+    }
+    if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) {
+        return (c % 2 == 1) ? c + 1 : c;
+    }
+    if (c == 0x178) {
+        return 0xFF;
+    }
+    // Кириллица: Ѐ..Џ, А..Я и пары расширенных букв
+    if (c >= 0x400 && c <= 0x40F) {
+        return c + 80;
+    }
+    if (c >= 0x410 && c <= 0x42F) {
+        return c + 32;
+    }
+    if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F)) {
+        return (c % 2 == 0) ? c + 1 : c;
+    }
+    if (c >= 0x4C1 && c <= 0x4CE) {
+        return (c % 2 == 1) ? c + 1 : c;
+    }
+    if (c == 0x4C0) {
+        return 0x4CF;
+    }
+    return c;
+}
+
+void appendUtf8(std::string& result, uint32_t c)
+{
+    if (c < 0x80) {
+        result += static_cast<char>(c);
+    } else if (c < 0x800) {
+        result += static_cast<char>(0xC0 | (c >> 6));
+        result += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        result += static_cast<char>(0xE0 | (c >> 12));
+        result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        result += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+} // namespace
+
+std::string toLowerUtf8(const std::string& text)
+{
+    std::string result;
+    result.reserve(text.size());
+
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char lead = static_cast<unsigned char>(text[i]);
+        if (lead < 0x80) {
+            result += static_cast<char>(lowerCodePoint(lead));
+            ++i;
+            continue;
+        }
+
+        // Таблица затрагивает только двухбайтовые символы; более длинные
+        // и некорректные последовательности копируются как есть
+        if ((lead & 0xE0) == 0xC0 && i + 1 < text.size()
+            && (static_cast<unsigned char>(text[i + 1]) & 0xC0) == 0x80) {
+            uint32_t c = ((lead & 0x1F) << 6) | (static_cast<unsigned char>(text[i + 1]) & 0x3F);
+            if (c >= 0x80) {
+                appendUtf8(result, lowerCodePoint(c));
+                i += 2;
+                continue;
+            }
+        }
+
+        result += text[i];
+        ++i;
+    }
+    return result;
+}
+
+bool MtpObjectFilter::matches(const MtpObjectInfo& info) const
+{
+    bool isDirectory = info.isDirectory();
+    if (isDirectory && !includeDirectories) {
+        return false;
+    }
+
+    if (!isDirectory && (info.size < minSize || info.size > maxSize)) {
+        return false;
+    }
+
+    if (modifiedAfter && info.modificationDate < modifiedAfter) {
+        return false;
+    }
+    if (modifiedBefore && info.modificationDate > modifiedBefore) {
+        return false;
+    }
+
+    if (!types.empty() && std::find(types.begin(), types.end(), info.type) == types.end()) {
+        return false;
+    }
+
+    return matchesExtension(info.name);
+}
+
+bool MtpObjectFilter::matchesExtension(const std::string& name) const
+{
+    if (extensions.empty()) {
+        return true;
+    }
+
+    std::string extension = fileExtension(name);
+    if (extension.empty()) {
+        return false;
+    }
+
+    for (const auto& allowed : extensions) {
+        // Допускаем запись расширения с точкой: ".jpg"
+        size_t start = (!allowed.empty() && allowed[0] == '.') ? 1 : 0;
+        if (allowed.size() - start == extension.size() && toLowerUtf8(allowed.substr(start)) == extension) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MtpObjectInfo makeObjectInfo(const LIBMTP_file_t* file, uint32_t storageId)
+{
+    MtpObjectInfo info;
+    info.id = file->item_id;
+    info.parentId = file->parent_id;
+    info.storageId = file->storage_id ? file->storage_id : storageId;
+    info.name = file->filename ? file->filename : "";
+    info.size = file->filesize;
+    info.type = file->filetype;
+    info.modificationDate = file->modificationdate;
+    return info;
+}
+
+std::string fileExtension(const std::string& name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos || dot + 1 >= name.size()) {
+        return std::string();
+    }
+
+    return toLowerUtf8(name.substr(dot + 1));
+}
+
+LIBMTP_filetype_t fileTypeFromName(const std::string& name)
+{
+    static const std::unordered_map<std::string, LIBMTP_filetype_t> extensions = {
+        {"wav", LIBMTP_FILETYPE_WAV},   {"mp3", LIBMTP_FILETYPE_MP3},
+        {"wma", LIBMTP_FILETYPE_WMA},   {"ogg", LIBMTP_FILETYPE_OGG},
+        {"flac", LIBMTP_FILETYPE_FLAC}, {"aac", LIBMTP_FILETYPE_AAC},
+        {"m4a", LIBMTP_FILETYPE_M4A},   {"mp2", LIBMTP_FILETYPE_MP2},
+        {"mp4", LIBMTP_FILETYPE_MP4},   {"wmv", LIBMTP_FILETYPE_WMV},
+        {"avi", LIBMTP_FILETYPE_AVI},   {"mpg", LIBMTP_FILETYPE_MPEG},
+        {"mpeg", LIBMTP_FILETYPE_MPEG}, {"asf", LIBMTP_FILETYPE_ASF},
+        {"mov", LIBMTP_FILETYPE_QT},    {"jpg", LIBMTP_FILETYPE_JPEG},
+        {"jpeg", LIBMTP_FILETYPE_JPEG}, {"tif", LIBMTP_FILETYPE_TIFF},
+        {"tiff", LIBMTP_FILETYPE_TIFF}, {"bmp", LIBMTP_FILETYPE_BMP},
+        {"gif", LIBMTP_FILETYPE_GIF},   {"png", LIBMTP_FILETYPE_PNG},
+        {"txt", LIBMTP_FILETYPE_TEXT},  {"htm", LIBMTP_FILETYPE_HTML},
+        {"html", LIBMTP_FILETYPE_HTML}, {"xml", LIBMTP_FILETYPE_XML},
+        {"doc", LIBMTP_FILETYPE_DOC},   {"xls", LIBMTP_FILETYPE_XLS},
+        {"ppt", LIBMTP_FILETYPE_PPT},   {"vcf", LIBMTP_FILETYPE_VCARD3},
+        {"ics", LIBMTP_FILETYPE_VCALENDAR2}
+    };
+
+    auto it = extensions.find(fileExtension(name));
+    return it != extensions.end() ? it->second : LIBMTP_FILETYPE_UNKNOWN;
+}